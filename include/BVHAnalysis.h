@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include "RayTracingStructs.h"
+
+// Quality metrics of one model's BVH, to compare builder settings per asset.
+// SAH cost & end-point overlap (EPO, Aila et al. 2013) use the same costs: a node test costs
+// BVH_TRAVERSAL_COST, a triangle test BVH_TRIANGLE_COST. Both are relative to the root's surface area,
+// so they are comparable between builds of the same model, not between models.
+
+#define BVH_TRAVERSAL_COST 1.0f
+#define BVH_TRIANGLE_COST 1.0f
+// Size of the traversal stack in RayTriangleBVH (compute.glsl & CPURayTracer)
+#define BVH_TRAVERSAL_STACK_SIZE 32
+
+struct BVHQualityReport {
+	int nodeCount = 0;
+	int leafCount = 0;
+	int triangleCount = 0;
+	int maxDepth = 0;                   // root is depth 0
+	float averageLeafDepth = 0.0f;
+	float sahCost = 0.0f;
+	float epo = 0.0f;
+	int maxLeafTriangles = 0;
+	float averageLeafTriangles = 0.0f;
+	// Bin 0 counts leaves with 1 triangle, bin i leaves with (2^(i-1), 2^i] triangles
+	std::vector<int> leafSizeHistogram;
+	// Near/far traversal keeps at most one pending sibling per level, plus both children of the current node
+	int requiredStackSize = 0;
+	bool exceedsStack = false;
+};
+
+// nodeOffset & triOffset are the model's offsets into nodes & triangles, child & triangle indices are relative to them
+BVHQualityReport AnalyzeBVH(const std::vector<BVHNode>& nodes, int nodeOffset, const std::vector<Triangle>& triangles, int triOffset);
+
+// Multi line report for the console, ends with a warning when the tree is too deep for the traversal stack
+std::string FormatBVHQualityReport(const BVHQualityReport& report);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include "RayTracingStructs.h"
+
+// Memory order of a model's BVH nodes. Traversal only follows startIndex & parentIndex, so any order works as long as
+// the root stays at relative index 0 & the two children of a node stay next to each other, left first.
+// Nodes are placed as units: the root on its own, then sibling pairs. A pair is "hot" in proportion to its parent's
+// surface area, the chance a random ray that reaches the model visits it.
+
+// Nodes per treelet of BVHLayout::Treelet, 32 nodes of 48 bytes are 24 cache lines
+#define BVH_TREELET_NODES 32
+
+enum class BVHLayout {
+	Build = 0,          // depth first, left child's subtree first (the order splitBVH emits)
+	DepthFirst = 1,     // depth first, the child with the larger surface area first
+	VanEmdeBoas = 2,    // cache oblivious: top half of the levels first, then every bottom subtree, recursively
+	Treelet = 3         // greedy treelets of BVH_TREELET_NODES nodes grown by surface area, stored contiguously
+};
+
+#define BVH_LAYOUT_COUNT 4
+
+const char* GetBVHLayoutName(BVHLayout layout);
+// Accepts the names GetBVHLayoutName returns, false for anything else
+bool ParseBVHLayout(const std::string& name, BVHLayout& layout);
+
+// Reorders the nodes of the BVH rooted at nodeOffset in place & rewrites their startIndex & parentIndex.
+// The tree must occupy [nodeOffset, nodeOffset + node count) like LoadModel builds it, leaves keep their triangles.
+// Any layout can be turned into any other. Build gives a left first depth first order of the tree as it is now,
+// which is LoadModel's own order only while the tree hasn't been restructured (e.g. by OptimizeBVH)
+void ReorderBVH(std::vector<BVHNode>& nodes, int nodeOffset, BVHLayout layout);
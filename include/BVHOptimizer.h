@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+
+#include "RayTracingStructs.h"
+
+// Post build SAH optimisation by treelet restructuring (Karras & Aila 2013, "Fast Parallel Construction of
+// High-Quality Bounding Volume Hierarchies"). A treelet is a node & its descendants down to BVH_TREELET_LEAVES
+// subtrees, grown by always opening the largest one. The topology over those subtrees with the lowest SAH is found
+// by dynamic programming over their subsets & written back into the treelet's own node slots.
+// Leaves & triangles never change, only how the inner nodes group them.
+
+#define BVH_TREELET_LEAVES 7
+// Treelets rooted this many levels apart can't share a node (a treelet reaches the children of its leaves,
+// BVH_TREELET_LEAVES levels below its root), so every root at one depth modulo this is done in parallel
+#define BVH_TREELET_SPACING (BVH_TREELET_LEAVES + 1)
+
+struct BVHOptimizeStats {
+	float sahBefore = 0.0f;     // same SAH cost as BVHQualityReport
+	float sahAfter = 0.0f;
+	int rounds = 0;             // every round tries a treelet at each inner node once
+	int treelets = 0;
+	int restructured = 0;       // treelets that got a cheaper topology
+	double seconds = 0.0;
+};
+
+// Optimises the BVH rooted at nodeOffset in place until a round stops improving it or timeBudgetSeconds run out.
+// Nodes end up out of order, apply a BVHLayout afterwards. A treelet is only changed if the tree still fits the
+// traversal stack (BVH_TRAVERSAL_STACK_SIZE) or didn't before either
+BVHOptimizeStats OptimizeBVH(std::vector<BVHNode>& nodes, int nodeOffset, double timeBudgetSeconds);
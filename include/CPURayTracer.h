@@ -0,0 +1,247 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "RayTracingStructs.h"
+#include "Sampler.h"
+#include "EnvironmentMap.h"
+
+// CPU mirror of compute.glsl.
+// Every function here follows its GLSL counterpart line by line so both paths converge to the same image.
+
+struct Ray {
+	glm::vec3 origin;
+	glm::vec3 dir;
+	glm::vec3 invDir;
+};
+
+struct TriangleHitInfo {
+	bool didHit;
+	float dst;
+	glm::vec3 hitPoint;
+	glm::vec3 normal;
+	int triIndex;
+	glm::vec2 barycentric; // weights of posB & posC
+};
+
+struct ModelHitInfo {
+	bool didHit;
+	float dst;
+	glm::vec3 hitPoint;
+	glm::vec3 normal;
+	RayTracingMaterial material;
+	// What was hit, for the primary hit cache
+	int modelIndex;     // -1 for a miss, -2 - index for analytic primitives
+	int triIndex;       // relative to the model's triOffset
+	glm::vec2 barycentric;
+	// Only filled for textured materials, see TriangleTexCoords
+	glm::vec2 uv;
+	float uvDensity;
+};
+
+// First hit features consumed by the denoiser
+struct FirstHitInfo {
+	glm::vec3 albedo;
+	glm::vec3 normal;
+	float depth;
+};
+
+struct RenderSettings {
+	int raysPerPixel = 32;
+	int maxBounces = 3;
+
+	// Adaptive sampling, pixels whose relative error drops below the threshold stop tracing
+	bool adaptiveSampling = true;
+	float adaptiveThreshold = 0.03f;
+	int adaptiveMinSamples = 64;
+	// Global noise target, rendering stops once the mean relative error of the image is below it
+	float noiseTarget = 0.01f;
+
+	// Next event estimation at diffuse bounces toward the sun, or the bright parts of the environment map when one is set,
+	// MIS weighted against the bounce direction
+	bool sunSampling = true;
+	// Next event estimation toward the emissive triangles of SetLights at diffuse bounces, also MIS weighted
+	bool lightSampling = true;
+
+	// Where the random numbers of a path come from, see Sampler.h
+	SamplerType samplerType = SamplerType::Sobol;
+
+	// Primary hit cache for a static camera: the first N samples of a pixel store their camera ray hit,
+	// later samples cycle through them & only trace the bounces. Antialiasing is limited to those N positions, 0 turns it off
+	int primaryCacheSamples = 0;
+
+	// Triangle BVHs are walked over parent links without a stack (safe at any depth), false uses the
+	// near/far traversal with a 32 entry stack. Baked into the compute shader as STACKLESS_TRAVERSAL
+	bool stacklessTraversal = true;
+
+	// Leaf tests read the precomputed TriangleRecords instead of recomputing edges & normal from the Triangles,
+	// only used when SetScene got records. Baked into the compute shader as PRECOMPUTED_TRIANGLES
+	bool precomputedTriangles = true;
+};
+
+// RNG Functions (see rng.glsl)
+uint32_t NextRandom(uint32_t& state);
+float RandomValue(uint32_t& state);
+
+class CPURayTracer {
+public:
+	CPURayTracer();
+
+	// Scene buffers are referenced, not copied. Call again (or ResetAccumulation) after they change.
+	// materials is indexed by Triangle::materialIndex. triangleRecords is optional (see TriangleRecord), it must be parallel to triangles
+	void SetScene(const std::vector<Model>& models, const std::vector<BVHNode>& nodes, const std::vector<Triangle>& triangles,
+		const std::vector<RayTracingMaterial>& materials, const std::vector<TriangleRecord>* triangleRecords = nullptr);
+	// Analytic primitives (see BuildPrimitiveBVH): planes first, then the bounded primitives covered by nodes. Also referenced
+	void SetPrimitives(const std::vector<Primitive>& primitives, const std::vector<BVHNode>& nodes, int planeCount);
+	// Mip chains & texels of the textures RayTracingMaterial::diffuseTexture points to (see TextureLoader.h). Also referenced
+	void SetTextures(const std::vector<TextureMip>& mips, const std::vector<uint32_t>& texels);
+	// Emissive triangles sampled by settings.lightSampling (see EmissiveLights.h), Triangle::lightIndex points in here. Also referenced
+	void SetLights(const std::vector<Light>& lights);
+	// HDR environment replacing the procedural sky & sun, nullptr goes back to them. Also referenced
+	void SetEnvironment(const EnvironmentMap* environment);
+
+	// Resizes the accumulation buffer, this restarts accumulation
+	void Resize(int width, int height);
+
+	// Traces settings.raysPerPixel samples for every pixel and adds them to the running sum
+	void RenderFrame();
+
+	// Throws away accumulated samples, must be called whenever camera, scene or settings change
+	void ResetAccumulation();
+	// Restarts the frame count the independent sampler seeds its paths with, so the next render traces the same paths
+	// as the first one (e.g. when timing the same image several times). ResetAccumulation keeps it running like uFrame
+	void ResetFrameSeed() { m_frame = 0; }
+
+	// Writes the accumulated average radiance (rgb) and sample count (a) of every pixel, bottom row first
+	void ResolveImage(std::vector<glm::vec4>& out) const;
+
+	// Writes the averaged denoiser features: first hit albedo (rgb) & distance (a), first hit normal (xyz)
+	void ResolveAuxiliary(std::vector<glm::vec4>& albedoDepth, std::vector<glm::vec4>& normal) const;
+
+	// Writes the summed triangle BVH work of every pixel: nodes visited, ray-box tests, ray-triangle tests, rays traced.
+	// Returns false (and leaves out empty) unless built with TRAVERSAL_STATS, see TraversalStats.h
+	bool ResolveTraversalCost(std::vector<glm::vec4>& out) const;
+	// Writes the summed misses of every pixel's triangle BVH node reads in the simulated cache (NodeCacheModel),
+	// divide by the rays of ResolveTraversalCost for misses per ray. Also needs TRAVERSAL_STATS
+	bool ResolveNodeCacheMisses(std::vector<float>& out) const;
+
+	// True once adaptive sampling has met the noise target, further RenderFrame calls do nothing
+	bool IsConverged() const;
+
+	int GetWidth() const { return m_width; }
+	int GetHeight() const { return m_height; }
+	int GetAccumulatedFrames() const { return m_accumFrames; }
+	// Average samples per pixel, pixels stop gaining samples once they converge
+	int GetEffectiveSamplesPerPixel() const;
+	int GetActivePixels() const { return m_activePixels; }
+	float GetMeanRelativeError() const { return m_meanRelativeError; }
+
+	// Ray queries
+	ModelHitInfo CalculateRayCollision(const Ray& worldRay) const;
+	// Any hit query for shadow/visibility rays: true if something is hit closer than rayLength (world units along dir)
+	bool IsOccluded(const Ray& worldRay, float rayLength) const;
+	// primaryHit is the hit of the camera ray (rayOrigin, rayDir), traced or from the primary hit cache
+	glm::vec3 Trace(glm::vec3 rayOrigin, glm::vec3 rayDir, const ModelHitInfo& primaryHit, Sampler& sampler, FirstHitInfo& firstHit) const;
+
+	// Primary hit cache helpers
+	static PrimaryHit MakePrimaryHit(const ModelHitInfo& hit);
+	ModelHitInfo LoadPrimaryHit(const PrimaryHit& cached, const Ray& ray) const;
+
+	RenderSettings settings;
+
+	// Camera, same defaults as compute.glsl
+	glm::mat4 camLocalToWorldMatrix = glm::mat4(1.0f);
+	glm::vec3 viewParams = glm::vec3(2.0f, 2.0f, 1.0f);
+	float defocusStrength = 1.0f;
+	float divergeStrength = 0.5f;
+
+private:
+	// sampleIndex is the sample within this frame, pixelSampleCount the samples the pixel took before it
+	glm::vec3 tracePixelSample(int x, int y, int sampleIndex, uint32_t pixelSampleCount, FirstHitInfo& firstHit);
+	TriangleHitInfo rayTriangleBVH(const Ray& ray, float rayLength, int nodeOffset, int triOffset) const;
+	bool rayTriangleBVHOccluded(const Ray& ray, float rayLength, int nodeOffset, int triOffset) const;
+	TriangleHitInfo rayTriangleBVHStackless(const Ray& ray, float rayLength, int nodeOffset, int triOffset) const;
+	bool rayTriangleBVHOccludedStackless(const Ray& ray, float rayLength, int nodeOffset, int triOffset) const;
+	// Records of the model at triOffset, nullptr when the leaves test the Triangles directly
+	const TriangleRecord* triangleRecords(int triOffset) const;
+	int rayPrimitives(const Ray& ray, float& dst) const;
+	// World space corner A & edges of a light's triangle
+	void emissiveTriangle(const Light& light, glm::vec3& posA, glm::vec3& edgeAB, glm::vec3& edgeAC) const;
+	// Picks a light proportional to its power & a uniform point on it, pdf is per solid angle seen from origin
+	glm::vec3 sampleEmissiveLight(const glm::vec3& origin, float uLight, const glm::vec2& uPoint, glm::vec3& emission, float& pdf) const;
+	bool rayPrimitivesOccluded(const Ray& ray, float rayLength) const;
+
+	const std::vector<Model>* m_models;
+	const std::vector<BVHNode>* m_nodes;
+	const std::vector<Triangle>* m_triangles;
+	const std::vector<RayTracingMaterial>* m_materials;
+	const std::vector<TriangleRecord>* m_triangleRecords;
+
+	const std::vector<Primitive>* m_primitives;
+	const std::vector<BVHNode>* m_primitiveNodes;
+	int m_primitivePlaneCount;
+
+	const std::vector<TextureMip>* m_textureMips;
+	const std::vector<uint32_t>* m_textureTexels;
+
+	const EnvironmentMap* m_environment;
+	const std::vector<Light>* m_lights;
+
+	int m_width;
+	int m_height;
+
+	// Running sum of radiance (rgb) and number of samples taken (a)
+	std::vector<glm::vec4> m_accumBuffer;
+	int m_accumFrames;
+
+	// Running sums of the denoiser features, same layout as ResolveAuxiliary
+	std::vector<glm::vec4> m_albedoDepthBuffer;
+	std::vector<glm::vec4> m_normalBuffer;
+
+	// Welford state of the luminance: mean, M2, sample count, converged flag
+	std::vector<glm::vec4> m_varianceBuffer;
+
+	// Running sums of the traversal cost, only allocated with TRAVERSAL_STATS
+	std::vector<glm::vec4> m_traversalCostBuffer;
+	std::vector<float> m_nodeCacheMissBuffer;
+
+	// settings.primaryCacheSamples slots per pixel, filled by the first samples after a reset
+	std::vector<PrimaryHit> m_primaryHitCache;
+	int m_activePixels;
+	float m_meanRelativeError;
+	uint64_t m_totalSamples;
+
+	// Seeds the RNG like uFrame does, keeps increasing across resets so samples never repeat
+	int m_frame;
+};
+
+// Adaptive sampling helpers
+float Luminance(const glm::vec3& color);
+float RelativeError(const glm::vec4& varState);
+
+// Shared intersection routines
+TriangleHitInfo RayTriangle(const Ray& ray, const Triangle& tri);
+bool RayTriangleAnyHit(const Ray& ray, const Triangle& tri, float rayLength);
+// Same tests on the precomputed record, the hit only gets dst & barycentric, see FinishTriangleHit
+TriangleHitInfo RayTriangleRecord(const Ray& ray, const TriangleRecord& record);
+bool RayTriangleRecordAnyHit(const Ray& ray, const TriangleRecord& record, float rayLength);
+// Fills the hit point & interpolated normal of a RayTriangleRecord hit on tri
+void FinishTriangleHit(const Ray& ray, const Triangle& tri, TriangleHitInfo& hit);
+float RayPrimitiveDst(const Ray& ray, const Primitive& prim);
+glm::vec3 PrimitiveNormal(const Primitive& prim, const glm::vec3& hitPoint);
+float RayBoundingBoxDst(const Ray& ray, const glm::vec3& boxMin, const glm::vec3& boxMax);
+glm::vec3 GetEnvironmentLight(const glm::vec3& dir);
+
+// Sun sampling, the environment light is split so the sun can be sampled on its own
+glm::vec3 GetSkyLight(const glm::vec3& dir);
+glm::vec3 GetSunLight(const glm::vec3& dir);
+float SunPdf(const glm::vec3& dir);
+glm::vec3 SampleSunDirection(const glm::vec2& u);
+float PowerHeuristic(float pdfA, float pdfB);
+
+// Environment map lighting (see EnvironmentMap.h), the pdfs are per solid angle
+glm::vec3 EnvironmentRadiance(const EnvironmentMap& environment, const glm::vec3& dir);
+float EnvironmentPdf(const EnvironmentMap& environment, const glm::vec3& dir);
+glm::vec3 SampleEnvironmentDirection(const EnvironmentMap& environment, const glm::vec2& u, float& pdf);
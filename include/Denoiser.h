@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+// Edge avoiding a-trous wavelet filter (Dammertz et al. 2010) guided by first hit albedo, normal & depth.
+// Radiance is divided by albedo before filtering so texture/material detail is not blurred away.
+
+struct DenoiserSettings {
+	int iterations = 5;         // filter radius doubles every iteration (2, 4, 8, ...)
+	float colorSigma = 2.0f;    // halved every iteration, like the paper
+	float normalSigma = 0.3f;
+	float albedoSigma = 0.1f;
+	float depthSigma = 0.2f;    // relative to the center pixel depth
+};
+
+class Denoiser {
+public:
+	// All buffers are width * height, bottom row first.
+	// color: radiance (rgb), albedoDepth: first hit albedo (rgb) & distance (a), normal: first hit shading normal (xyz)
+	void Denoise(int width, int height,
+		const std::vector<glm::vec4>& color,
+		const std::vector<glm::vec4>& albedoDepth,
+		const std::vector<glm::vec4>& normal,
+		std::vector<glm::vec4>& out);
+
+	DenoiserSettings settings;
+
+private:
+	void filterPass(int width, int height, int stepSize, float colorSigma,
+		const std::vector<glm::vec4>& src,
+		const std::vector<glm::vec4>& albedoDepth,
+		const std::vector<glm::vec4>& normal,
+		std::vector<glm::vec4>& dst) const;
+
+	// Ping-pong buffers, kept around so repeated calls don't reallocate
+	std::vector<glm::vec4> m_pingBuffer;
+	std::vector<glm::vec4> m_pongBuffer;
+};
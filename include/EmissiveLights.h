@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include "RayTracingStructs.h"
+
+// Light table for next event estimation toward emissive triangles.
+// After a model's BVH is built its triangles are scanned in parallel, the ones with an emissive material are appended
+// to the table & get their Triangle::lightIndex. Lights are picked proportional to their power with an alias table
+// (O(1) per sample on both tracers), rebuilt over the whole table whenever lights are added.
+
+// Triangles per ParallelFor work item while scanning
+#define LIGHT_SCAN_CHUNK_SIZE 4096
+
+struct LightBuildStats {
+	int triangles = 0;  // scanned
+	int lights = 0;     // emissive triangles added
+	double seconds = 0.0;
+};
+
+// Adds the emissive triangles [triOffset, end) of model modelIndex to lights & sets the lightIndex of every scanned triangle
+LightBuildStats AddEmissiveTriangles(std::vector<Light>& lights, std::vector<Triangle>& triangles,
+	const std::vector<RayTracingMaterial>& materials, int modelIndex, int triOffset);
+
+// Fills probability, aliasThreshold & alias of every light from their power (Vose's method)
+void BuildLightAliasTable(std::vector<Light>& lights);
+
+// One line summary for the console
+std::string FormatLightBuildStats(const LightBuildStats& stats);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <glm/glm.hpp>
+
+// HDR environment map replacing the procedural sky & sun of both tracers.
+// Equirectangular: u = atan2(dir.x, dir.z) / 2pi + 0.5 (u = 0.5 looks down +z, the default camera direction),
+// v = acos(dir.y) / pi (v = 0 straight up, the top row as stb_image loads it).
+// Lighting is importance sampled from a 2D CDF of luminance * sin(theta): one CDF over the rows & one per row,
+// the rows are summed in parallel. The sampling & pdf functions live next to the sky in CPURayTracer.cpp & compute.glsl.
+
+struct EnvironmentMap {
+	int width = 0;
+	int height = 0;
+	// rgb: radiance, a: the row's CDF up to & including this texel (the last texel of a row is 1)
+	std::vector<glm::vec4> texels;
+	// CDF over the rows up to & including each row (the last row is 1)
+	std::vector<float> marginalCdf;
+
+	bool Empty() const { return width == 0 || height == 0; }
+};
+
+struct EnvironmentLoadStats {
+	int width = 0;
+	int height = 0;
+	double loadSeconds = 0.0;   // reading & decoding the file
+	double cdfSeconds = 0.0;    // building the sampling CDFs
+};
+
+// Loads an equirectangular image (anything stb_image reads, .hdr for real radiance) with its radiance scaled by
+// intensity & builds its CDFs. Returns false & leaves map empty if the file can't be read
+bool LoadEnvironmentMap(const std::string& path, float intensity, EnvironmentMap& map, EnvironmentLoadStats* stats = nullptr);
+
+// (Re)builds texels[].a & marginalCdf from the radiance, non finite or negative texels are zeroed first
+void BuildEnvironmentCdf(EnvironmentMap& map);
+
+// One line summary for the console
+std::string FormatEnvironmentLoadStats(const EnvironmentLoadStats& stats);
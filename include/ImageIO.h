@@ -0,0 +1,13 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <glm/glm.hpp>
+
+// Image writers for the CPU render path. Pixels are width * height, bottom row first (same as GL textures).
+
+// Writes linear radiance as a little endian PFM (HDR). Returns false if the file can't be written
+bool WritePFM(const std::string& path, int width, int height, const std::vector<glm::vec4>& pixels);
+
+// Writes an 8 bit RGB PNG, values are clamped to [0, 1] like the viewer does. Returns false if the file can't be written
+bool WritePNG(const std::string& path, int width, int height, const std::vector<glm::vec4>& pixels);
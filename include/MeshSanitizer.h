@@ -0,0 +1,27 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include "RayTracingStructs.h"
+
+// Load time clean up of a model's triangles, run before its BVH is built.
+// Degenerate triangles (non finite corners or no area) and exact duplicates are removed, they only make leaves bigger.
+// Vertex normals that are zero or not finite are replaced by the face normal, so interpolating them can't produce NaNs.
+
+// A triangle is degenerate when |cross(AB, AC)| <= this * (longest edge)^2, i.e. its smallest angle is below ~1e-6 rad
+#define DEGENERATE_TRIANGLE_EPSILON 1e-6f
+
+struct MeshSanitizeStats {
+	int inputTriangles = 0;
+	int degenerateTriangles = 0;    // removed
+	int duplicateTriangles = 0;     // removed, the first copy is kept
+	int repairedNormals = 0;        // vertex normals replaced by the face normal
+	double seconds = 0.0;
+};
+
+// Cleans triangles [triOffset, end) in place & shrinks the vector, the kept triangles stay in order
+MeshSanitizeStats SanitizeTriangles(std::vector<Triangle>& triangles, int triOffset);
+
+// One line summary for the console
+std::string FormatMeshSanitizeStats(const MeshSanitizeStats& stats);
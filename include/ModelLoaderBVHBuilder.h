@@ -1,13 +1,30 @@
+#pragma once
+
 #include <vector>
 #include <optional>
+#include <string>
+#include <chrono>
+#include <cassert>
+#include <unordered_map>
+#include <algorithm>
+#include <iostream>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/constants.hpp> // for glm::radians
+#include <glm/gtc/packing.hpp>
 
 #include "RayTracingStructs.h"
+#include "BVHLayout.h"
+#include "BVHOptimizer.h"
+#include "MeshSanitizer.h"
+#include "NormalGenerator.h"
+#include "TextureLoader.h"
+#include "EmissiveLights.h"
 #include "OBJ_Loader.h"
 
 #define MAX_SPLIT_RES 6
 #define MAX_SPLIT_DEPTH 32
+// The primitive traversals use a 32 entry stack with no overflow check & a tree of depth d needs up to d + 1 entries
+#define MAX_PRIMITIVE_SPLIT_DEPTH 30
 #define MIN_TRIANGLES_PER_NODE 2
 
 std::unordered_map <std::string, int> modelMap;
@@ -15,10 +32,50 @@ std::unordered_map <std::string, int> modelMap;
 std::vector<Model> modelsBuffer;
 std::vector<BVHNode> BVHBuffer;
 std::vector<Triangle> TrianglesBuffer;
+// Precomputed intersection data, parallel to TrianglesBuffer when buildTriangleRecords is on, else left empty
+std::vector<TriangleRecord> TriangleRecordsBuffer;
+// Material table shared by all models, Triangle::materialIndex points in here. Equal materials are stored once
+std::vector<RayTracingMaterial> MaterialsBuffer;
+// Raw bytes of a material -> its index in MaterialsBuffer
+std::unordered_map<std::string, int> materialMap;
+// Mip levels & RGBA8 texels of every diffuse texture, RayTracingMaterial::diffuseTexture points into TextureMipsBuffer
+std::vector<TextureMip> TextureMipsBuffer;
+std::vector<uint32_t> TextureTexelsBuffer;
+// Emissive triangles of all models, Triangle::lightIndex points in here. See EmissiveLights.h
+std::vector<Light> LightsBuffer;
+// Texture file -> its level 0 in TextureMipsBuffer, -1 if it couldn't be loaded. Every file is loaded once
+std::unordered_map<std::string, int> textureMap;
 
 int modelNodeOffset = 0;
 int modelTriOffset = 0;
 
+// Node order LoadModel leaves the BVHs in, see BVHLayout.h
+BVHLayout bvhLayout = BVHLayout::DepthFirst;
+// Time LoadModel may spend improving each BVH with OptimizeBVH, 0 skips it
+double bvhOptimizeSeconds = 0.0;
+// LoadModel removes degenerate & duplicate triangles & repairs bad normals before building the BVH, see MeshSanitizer.h
+bool sanitizeMeshes = true;
+// OBJ files without vn lines get smooth normals instead of objl's flat ones, see NormalGenerator.h
+bool generateMissingNormals = true;
+// Faces meeting at a sharper angle than this (degrees) keep a hard edge between them
+float normalCreaseAngle = 60.0f;
+// LoadModel fills TriangleRecordsBuffer, the tracers fall back to the plain Triangle test without it
+bool buildTriangleRecords = true;
+
+// Time spent in each phase of LoadModel
+struct ModelLoadTimings {
+	double parseSeconds = 0.0; // reading the file & filling TrianglesBuffer
+	double buildSeconds = 0.0; // building the BVH, optimising it included
+	double optimizeSeconds = 0.0;
+	// What sanitizeMeshes found, summed over the models (part of parseSeconds)
+	MeshSanitizeStats sanitize;
+	double normalSeconds = 0.0; // generating missing normals (part of parseSeconds)
+	double textureSeconds = 0.0; // loading textures & building their mips (part of parseSeconds)
+	int textures = 0;
+	double lightSeconds = 0.0; // gathering emissive triangles into LightsBuffer (part of buildSeconds)
+	int lights = 0;
+};
+
 void expandToFit(int idx, const glm::vec3& point) {
 	BVHNode& node = BVHBuffer[idx];
 	
@@ -32,6 +89,93 @@ void expandToFitTris(int idx, const Triangle& triangle) {
 	expandToFit(idx, triangle.posC);
 }
 
+TriangleRecord makeTriangleRecord(const Triangle& tri) {
+	TriangleRecord record;
+	record.posA = tri.posA;
+	record.edgeAB = tri.posB - tri.posA;
+	record.edgeAC = tri.posC - tri.posA;
+
+	glm::vec3 normal = glm::cross(record.edgeAB, record.edgeAC);
+	record.normalX = normal.x;
+	record.normalY = normal.y;
+	record.normalZ = normal.z;
+	return record;
+}
+
+// Index of material in MaterialsBuffer, appended the first time it is seen
+int AddMaterial(const RayTracingMaterial& material) {
+	std::string key(reinterpret_cast<const char*>(&material), sizeof(RayTracingMaterial));
+	auto it = materialMap.find(key);
+	if (it != materialMap.end())
+		return it->second;
+
+	int materialIdx = MaterialsBuffer.size();
+	MaterialsBuffer.push_back(material);
+	materialMap.emplace(std::move(key), materialIdx);
+	return materialIdx;
+}
+
+// Used by meshes without a usemtl or whose material isn't in the MTL file
+RayTracingMaterial defaultModelMaterial() {
+	RayTracingMaterial material;
+	material.color = glm::vec3(1.0f, 0.0f, 0.0f);
+	material.diffuseTexture = -1;
+	material.emissionColor = glm::vec4(0.0f);
+	material.specularColor = glm::vec4(1.0f);
+
+	material.emissionStrength = 0.0f;
+	material.smoothness = 0.5f;
+	material.specularProbability = 0.5f;
+
+	material.flag = 0;
+	return material;
+}
+
+// MTL material in this tracer's terms: Kd is the diffuse color, the brightest channel of Ks the specular chance & Ks
+// scaled to 1 its tint, Ns (0..1000) the smoothness & Ke the emission, split into a color & a strength the same way.
+// diffuseTexture is the loaded map_Kd (it multiplies Kd) or -1
+RayTracingMaterial convertMaterial(const objl::Material& mtl, int diffuseTexture) {
+	glm::vec3 diffuse = glm::vec3(mtl.Kd.X, mtl.Kd.Y, mtl.Kd.Z);
+	glm::vec3 specular = glm::vec3(mtl.Ks.X, mtl.Ks.Y, mtl.Ks.Z);
+	glm::vec3 emission = glm::vec3(mtl.Ke.X, mtl.Ke.Y, mtl.Ke.Z);
+	float specularMax = std::max(specular.x, std::max(specular.y, specular.z));
+	float emissionMax = std::max(emission.x, std::max(emission.y, emission.z));
+
+	RayTracingMaterial material;
+	material.color = glm::clamp(diffuse, 0.0f, 1.0f);
+	material.diffuseTexture = diffuseTexture;
+	material.emissionColor = emissionMax > 0.0f ? glm::vec4(emission / emissionMax, 0.0f) : glm::vec4(0.0f);
+	material.specularColor = specularMax > 0.0f ? glm::vec4(specular / specularMax, 1.0f) : glm::vec4(1.0f);
+
+	material.emissionStrength = std::max(emissionMax, 0.0f);
+	material.smoothness = std::sqrt(glm::clamp(mtl.Ns / 1000.0f, 0.0f, 1.0f));
+	material.specularProbability = glm::clamp(specularMax, 0.0f, 1.0f);
+
+	material.flag = 0;
+	return material;
+}
+
+// Stores the corners' texture coordinates as halves. They are moved by whole texture repeats first so the smallest is
+// in [0, 1), the coordinates stay small & keep their precision while wrapping around samples the same texels
+void packTriangleUVs(Triangle& tri, glm::vec2 uvA, glm::vec2 uvB, glm::vec2 uvC) {
+	glm::vec2 shift = glm::floor(glm::min(uvA, glm::min(uvB, uvC)));
+	tri.uvA = glm::packHalf2x16(uvA - shift);
+	tri.uvB = glm::packHalf2x16(uvB - shift);
+	tri.uvC = glm::packHalf2x16(uvC - shift);
+}
+
+// map_Kd relative to the model's folder. Options before the file name (-bm 1 ...) are skipped
+std::string resolveTexturePath(const std::string& modelPath, std::string texture) {
+	if (!texture.empty() && texture[0] == '-')
+		texture = texture.substr(texture.find_last_of(' ') + 1);
+	std::replace(texture.begin(), texture.end(), '\\', '/');
+	if (texture.empty() || texture[0] == '/' || (texture.size() > 1 && texture[1] == ':'))
+		return texture;
+
+	size_t slash = modelPath.find_last_of("/\\");
+	return slash == std::string::npos ? texture : modelPath.substr(0, slash + 1) + texture;
+}
+
 float costFunction() {
 	// TODO: Implement a cost function for SAH
 	return FP_NAN;
@@ -109,6 +253,11 @@ void splitBVH(int relativeRootIndex, int depth = 0) {
 	BVHBuffer[rightIdx].startIndex = relativeRightStart;
 	BVHBuffer[rightIdx].triangleCount = numRight; // Seat as leaf node
 
+	// Parent links & split axis for the stackless traversal
+	BVHBuffer[leftIdx].parentIndex = relativeRootIndex;
+	BVHBuffer[rightIdx].parentIndex = relativeRootIndex;
+	BVHBuffer[rootIdx].splitAxis = axis;
+
 	// Mark Parent as a non-leaf node 
 	BVHBuffer[rootIdx].startIndex = leftIdx - modelNodeOffset; // Point to first child relative to ModelNodeOffset
 	BVHBuffer[rootIdx].triangleCount = -1; // Mark current as non-leaf node
@@ -138,7 +287,9 @@ void makeRootBVH(int trisCount) {
 }
 
 // Return -1 if model failed to load, else model's position in the modelsBuffer
-int LoadModel(const char* modelPath, std::string internalModelName) {
+int LoadModel(const char* modelPath, std::string internalModelName, ModelLoadTimings* timings = nullptr) {
+	auto parseStart = std::chrono::steady_clock::now();
+
 	objl::Loader loader;
 	bool loadout = loader.LoadFile(modelPath);
 
@@ -152,19 +303,52 @@ int LoadModel(const char* modelPath, std::string internalModelName) {
 	modelMap[internalModelName] = modelIdx;
 	modelsBuffer[modelIdx].triOffset = TrianglesBuffer.size();
 	
-	// Load all triangles into the TrianglesBuffer
+	// objl leaves the material name empty when the mesh has no material or it wasn't found
 	int meshSize = loader.LoadedMeshes.size();
+	auto meshTexturePath = [&](const objl::Mesh& mesh) {
+		return mesh.MeshMaterial.name.empty() || mesh.MeshMaterial.map_Kd.empty() ? std::string() : resolveTexturePath(modelPath, mesh.MeshMaterial.map_Kd);
+	};
+
+	// Textures no model loaded yet, all at once so they load in parallel
+	std::vector<std::string> newTextures;
+	for (int i = 0; i < meshSize; ++i) {
+		std::string texturePath = meshTexturePath(loader.LoadedMeshes[i]);
+		if (!texturePath.empty() && textureMap.emplace(texturePath, -1).second)
+			newTextures.push_back(texturePath);
+	}
+	if (!newTextures.empty()) {
+		std::vector<int> textureIndices;
+		TextureLoadStats textureStats = LoadTextures(newTextures, TextureMipsBuffer, TextureTexelsBuffer, textureIndices);
+		for (size_t i = 0; i < newTextures.size(); ++i) {
+			textureMap[newTextures[i]] = textureIndices[i];
+			if (textureIndices[i] < 0)
+				std::cout << "Couldn't load texture " << newTextures[i] << "\n";
+		}
+		std::cout << FormatTextureLoadStats(textureStats);
+
+		if (timings != nullptr) {
+			timings->textureSeconds += textureStats.seconds;
+			timings->textures += textureStats.loaded;
+		}
+	}
+
+	// Load all triangles into the TrianglesBuffer
 	int trisCount = 0;
 	for (int i = 0; i < meshSize; ++i) {
 		const objl::Mesh& currMesh = loader.LoadedMeshes[i];
 		const auto& verts = currMesh.Vertices;
 		const auto& indices = currMesh.Indices;
+		std::string texturePath = meshTexturePath(currMesh);
+		int materialIdx = AddMaterial(currMesh.MeshMaterial.name.empty() ? defaultModelMaterial()
+			: convertMaterial(currMesh.MeshMaterial, texturePath.empty() ? -1 : textureMap[texturePath]));
 		
 		int indicesCount = currMesh.Indices.size();
 		for (int idx = 0; idx < indicesCount; idx += 3) {
 			Triangle& tri = TrianglesBuffer.emplace_back();
 			trisCount++;
 
+			tri.materialIndex = materialIdx;
+
 			tri.posA = glm::vec3(verts[indices[idx + 0]].Position.X, verts[indices[idx + 0]].Position.Y, verts[indices[idx + 0]].Position.Z);
 			tri.posB = glm::vec3(verts[indices[idx + 1]].Position.X, verts[indices[idx + 1]].Position.Y, verts[indices[idx + 1]].Position.Z);
 			tri.posC = glm::vec3(verts[indices[idx + 2]].Position.X, verts[indices[idx + 2]].Position.Y, verts[indices[idx + 2]].Position.Z);
@@ -172,8 +356,37 @@ int LoadModel(const char* modelPath, std::string internalModelName) {
 			tri.normA = glm::vec3(verts[indices[idx + 0]].Normal.X, verts[indices[idx + 0]].Normal.Y, verts[indices[idx + 0]].Normal.Z);
 			tri.normB = glm::vec3(verts[indices[idx + 1]].Normal.X, verts[indices[idx + 1]].Normal.Y, verts[indices[idx + 1]].Normal.Z);
 			tri.normC = glm::vec3(verts[indices[idx + 2]].Normal.X, verts[indices[idx + 2]].Normal.Y, verts[indices[idx + 2]].Normal.Z);
+
+			packTriangleUVs(tri,
+				glm::vec2(verts[indices[idx + 0]].TextureCoordinate.X, verts[indices[idx + 0]].TextureCoordinate.Y),
+				glm::vec2(verts[indices[idx + 1]].TextureCoordinate.X, verts[indices[idx + 1]].TextureCoordinate.Y),
+				glm::vec2(verts[indices[idx + 2]].TextureCoordinate.X, verts[indices[idx + 2]].TextureCoordinate.Y));
+		}
+	}
+	// Degenerate triangles & broken normals never reach the BVH
+	if (sanitizeMeshes && trisCount > 0) {
+		MeshSanitizeStats sanitizeStats = SanitizeTriangles(TrianglesBuffer, modelsBuffer[modelIdx].triOffset);
+		trisCount = (int)TrianglesBuffer.size() - modelsBuffer[modelIdx].triOffset;
+		if (sanitizeStats.degenerateTriangles + sanitizeStats.duplicateTriangles + sanitizeStats.repairedNormals > 0)
+			std::cout << FormatMeshSanitizeStats(sanitizeStats);
+
+		if (timings != nullptr) {
+			timings->sanitize.inputTriangles += sanitizeStats.inputTriangles;
+			timings->sanitize.degenerateTriangles += sanitizeStats.degenerateTriangles;
+			timings->sanitize.duplicateTriangles += sanitizeStats.duplicateTriangles;
+			timings->sanitize.repairedNormals += sanitizeStats.repairedNormals;
+			timings->sanitize.seconds += sanitizeStats.seconds;
 		}
 	}
+
+	// After sanitizing, so removed duplicates don't count twice around a vertex
+	if (generateMissingNormals && loader.LoadedNormalCount == 0 && trisCount > 0) {
+		NormalGenerationStats normalStats = GenerateSmoothNormals(TrianglesBuffer, modelsBuffer[modelIdx].triOffset, normalCreaseAngle);
+		std::cout << FormatNormalGenerationStats(normalStats);
+		if (timings != nullptr)
+			timings->normalSeconds += normalStats.seconds;
+	}
+
 	// If no triangles were loaded, remove the model and return -1
 	if(trisCount == 0) {
 		modelsBuffer.pop_back();
@@ -185,22 +398,34 @@ int LoadModel(const char* modelPath, std::string internalModelName) {
 	modelNodeOffset = BVHBuffer.size();
 	modelTriOffset = modelsBuffer[modelIdx].triOffset;
 	
+	auto buildStart = std::chrono::steady_clock::now();
+
 	// Expects us to make sure triangles are ready in buffer
 	modelsBuffer[modelIdx].nodeOffset = BVHBuffer.size();
 	makeRootBVH(trisCount);
-
-	// TODO:
-	// Give all model default RayTracingMaterial
-	RayTracingMaterial& rtMat = modelsBuffer[modelIdx].material;
-	rtMat.color = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
-	rtMat.emissionColor = glm::vec4(0.0f);
-	rtMat.specularColor = glm::vec4(1.0f);
-
-	rtMat.emissionStrength = 0.0f;
-	rtMat.smoothness = 0.5f;
-	rtMat.specularProbability = 0.5f;
-
-	rtMat.flag = 0;
+	BVHOptimizeStats optimizeStats;
+	if (bvhOptimizeSeconds > 0)
+		optimizeStats = OptimizeBVH(BVHBuffer, modelNodeOffset, bvhOptimizeSeconds);
+	ReorderBVH(BVHBuffer, modelNodeOffset, bvhLayout);
+
+	// Triangles are in their final order once the BVH is built, nothing after this moves them
+	if (buildTriangleRecords) {
+		TriangleRecordsBuffer.resize(TrianglesBuffer.size());
+		for (int i = modelTriOffset; i < modelTriOffset + trisCount; ++i)
+			TriangleRecordsBuffer[i] = makeTriangleRecord(TrianglesBuffer[i]);
+	}
+	LightBuildStats lightStats = AddEmissiveTriangles(LightsBuffer, TrianglesBuffer, MaterialsBuffer, modelIdx, modelTriOffset);
+	if (lightStats.lights > 0)
+		std::cout << FormatLightBuildStats(lightStats);
+
+	if (timings != nullptr) {
+		auto buildEnd = std::chrono::steady_clock::now();
+		timings->parseSeconds += std::chrono::duration<double>(buildStart - parseStart).count();
+		timings->buildSeconds += std::chrono::duration<double>(buildEnd - buildStart).count();
+		timings->optimizeSeconds += optimizeStats.seconds;
+		timings->lightSeconds += lightStats.seconds;
+		timings->lights += lightStats.lights;
+	}
 
 	// TODO:
 	// Default Model position
@@ -215,4 +440,151 @@ int LoadModel(const char* modelPath, std::string internalModelName) {
 	modelsBuffer[modelIdx].worldToLocalMatrix = glm::inverse(modelsBuffer[modelIdx].localToWorldMatrix);
 
 	return modelIdx;
-}
\ No newline at end of file
+}
+
+// Moves a loaded model, the BVH is in model space so only the matrices change
+void SetModelTransform(int modelIdx, const glm::mat4& localToWorld) {
+	modelsBuffer[modelIdx].localToWorldMatrix = localToWorld;
+	modelsBuffer[modelIdx].worldToLocalMatrix = glm::inverse(localToWorld);
+}
+
+
+// === Analytic primitives ===
+// Planes are unbounded, so they are kept at the front of PrimitivesBuffer & tested one by one.
+// The bounded primitives after them get their own BVH in PrimitiveBVHBuffer, same node layout as BVHBuffer
+// but startIndex is absolute (into PrimitivesBuffer for leaves, PrimitiveBVHBuffer for inner nodes).
+
+std::vector<Primitive> PrimitivesBuffer;
+std::vector<BVHNode> PrimitiveBVHBuffer;
+int primitivePlaneCount = 0;
+
+// Diffuse material with the given color, optionally emissive
+RayTracingMaterial makeMaterial(const glm::vec3& color, float emissionStrength = 0.0f) {
+	RayTracingMaterial material;
+	material.color = color;
+	material.diffuseTexture = -1;
+	material.emissionColor = glm::vec4(color, 0.0f);
+	material.specularColor = glm::vec4(1.0f);
+
+	material.emissionStrength = emissionStrength;
+	material.smoothness = 0.0f;
+	material.specularProbability = 0.0f;
+
+	material.flag = 0;
+	return material;
+}
+
+// Primitives only show up after BuildPrimitiveBVH
+void AddSphere(const glm::vec3& center, float radius, const RayTracingMaterial& material) {
+	Primitive& prim = PrimitivesBuffer.emplace_back();
+	prim.center = center;
+	prim.radius = radius;
+	prim.normal = glm::vec3(0.0f, 1.0f, 0.0f);
+	prim.type = PRIMITIVE_SPHERE;
+	prim.material = material;
+}
+
+// Planes & disks are one sided like triangles, only visible from the side normal points to
+void AddPlane(const glm::vec3& point, const glm::vec3& normal, const RayTracingMaterial& material) {
+	Primitive& prim = PrimitivesBuffer.emplace_back();
+	prim.center = point;
+	prim.radius = 0.0f;
+	prim.normal = glm::normalize(normal);
+	prim.type = PRIMITIVE_PLANE;
+	prim.material = material;
+}
+
+void AddDisk(const glm::vec3& center, const glm::vec3& normal, float radius, const RayTracingMaterial& material) {
+	Primitive& prim = PrimitivesBuffer.emplace_back();
+	prim.center = center;
+	prim.radius = radius;
+	prim.normal = glm::normalize(normal);
+	prim.type = PRIMITIVE_DISK;
+	prim.material = material;
+}
+
+void expandToFitPrimitive(int idx, const Primitive& prim) {
+	// A disk extends r * sqrt(1 - n[axis]^2) along each axis
+	glm::vec3 extent = glm::vec3(prim.radius);
+	if (prim.type == PRIMITIVE_DISK)
+		extent *= glm::sqrt(glm::max(glm::vec3(1.0f) - prim.normal * prim.normal, glm::vec3(0.0f)));
+
+	BVHNode& node = PrimitiveBVHBuffer[idx];
+	node.boundsMin = glm::min(node.boundsMin, prim.center - extent);
+	node.boundsMax = glm::max(node.boundsMax, prim.center + extent);
+}
+
+// Same longest axis midpoint split as splitBVH
+void splitPrimitiveBVH(int rootIdx, int depth = 0) {
+	if (depth >= MAX_PRIMITIVE_SPLIT_DEPTH || PrimitiveBVHBuffer[rootIdx].triangleCount <= MIN_TRIANGLES_PER_NODE)
+		return;
+
+	glm::vec3 center = (PrimitiveBVHBuffer[rootIdx].boundsMin + PrimitiveBVHBuffer[rootIdx].boundsMax) * 0.5f;
+	glm::vec3 extent = PrimitiveBVHBuffer[rootIdx].boundsMax - PrimitiveBVHBuffer[rootIdx].boundsMin;
+
+	int axis = 0;
+	if (extent.y > extent[axis]) axis = 1;
+	if (extent.z > extent[axis]) axis = 2;
+
+	PrimitiveBVHBuffer.emplace_back();
+	int leftIdx = PrimitiveBVHBuffer.size() - 1;
+
+	PrimitiveBVHBuffer.emplace_back();
+	int rightIdx = PrimitiveBVHBuffer.size() - 1;
+
+	int start = PrimitiveBVHBuffer[rootIdx].startIndex;
+	int count = PrimitiveBVHBuffer[rootIdx].triangleCount;
+	int numLeft = 0;
+
+	for (int i = start; i < start + count; ++i) {
+		const Primitive& prim = PrimitivesBuffer[i];
+
+		if (prim.center[axis] < center[axis]) {
+			expandToFitPrimitive(leftIdx, prim);
+			std::swap(PrimitivesBuffer[i], PrimitivesBuffer[start + numLeft]);
+			numLeft++;
+		}
+		else {
+			expandToFitPrimitive(rightIdx, prim);
+		}
+	}
+
+	if (numLeft == 0 || numLeft == count) {
+		PrimitiveBVHBuffer.pop_back();
+		PrimitiveBVHBuffer.pop_back();
+		return;
+	}
+
+	PrimitiveBVHBuffer[leftIdx].startIndex = start;
+	PrimitiveBVHBuffer[leftIdx].triangleCount = numLeft;
+
+	PrimitiveBVHBuffer[rightIdx].startIndex = start + numLeft;
+	PrimitiveBVHBuffer[rightIdx].triangleCount = count - numLeft;
+
+	PrimitiveBVHBuffer[rootIdx].startIndex = leftIdx;
+	PrimitiveBVHBuffer[rootIdx].triangleCount = -1;
+
+	splitPrimitiveBVH(leftIdx, depth + 1);
+	splitPrimitiveBVH(rightIdx, depth + 1);
+}
+
+// Moves planes to the front & rebuilds the primitive BVH, call after adding/changing primitives
+void BuildPrimitiveBVH() {
+	auto firstBounded = std::stable_partition(PrimitivesBuffer.begin(), PrimitivesBuffer.end(),
+		[](const Primitive& prim) { return prim.type == PRIMITIVE_PLANE; });
+	primitivePlaneCount = (int)(firstBounded - PrimitivesBuffer.begin());
+
+	PrimitiveBVHBuffer.clear();
+	int boundedCount = (int)PrimitivesBuffer.size() - primitivePlaneCount;
+	if (boundedCount == 0)
+		return;
+
+	BVHNode& root = PrimitiveBVHBuffer.emplace_back();
+	root.startIndex = primitivePlaneCount;
+	root.triangleCount = boundedCount;
+
+	for (int i = primitivePlaneCount; i < (int)PrimitivesBuffer.size(); ++i)
+		expandToFitPrimitive(0, PrimitivesBuffer[i]);
+
+	splitPrimitiveBVH(0);
+}
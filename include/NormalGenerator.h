@@ -0,0 +1,26 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include "RayTracingStructs.h"
+
+// Smooth vertex normals for meshes that come without them (OBJ files without vn lines).
+// Corners at the same position are welded & every corner gets the angle weighted sum of the face normals around it,
+// skipping faces whose normal is more than the crease angle away from its own face, so hard edges stay hard.
+// Corners are spread over hash buckets by position, each bucket is sorted & smoothed on its own in parallel.
+
+// Corners per bucket on average, small enough that a bucket's sort stays in cache
+#define NORMAL_BUCKET_CORNERS 256
+
+struct NormalGenerationStats {
+	int triangles = 0;
+	int vertices = 0;       // distinct positions after welding
+	double seconds = 0.0;
+};
+
+// Overwrites normA/B/C of triangles [triOffset, end). creaseAngleDegrees >= 180 smooths across every edge
+NormalGenerationStats GenerateSmoothNormals(std::vector<Triangle>& triangles, int triOffset, float creaseAngleDegrees);
+
+// One line summary for the console
+std::string FormatNormalGenerationStats(const NormalGenerationStats& stats);
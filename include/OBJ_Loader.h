@@ -166,6 +166,8 @@ namespace objl
 		Vector3 Kd;
 		// Specular Color
 		Vector3 Ks;
+		// Emissive Color
+		Vector3 Ke;
 		// Specular Exponent
 		float Ns;
 		// Optical Density
@@ -452,7 +454,9 @@ namespace objl
 			std::vector<Vertex> Vertices;
 			std::vector<unsigned int> Indices;
 
+			// Material of every mesh in LoadedMeshes, index aligned
 			std::vector<std::string> MeshMatNames;
+			std::string currentMatName;
 
 			bool listening = false;
 			std::string meshname;
@@ -478,7 +482,7 @@ namespace objl
 							<< "\t| texcoords > " << TCoords.size()
 							<< "\t| normals > " << Normals.size()
 							<< "\t| triangles > " << (Vertices.size() / 3)
-							<< (!MeshMatNames.empty() ? "\t| material: " + MeshMatNames.back() : "");
+							<< (!currentMatName.empty() ? "\t| material: " + currentMatName : "");
 					}
 				}
 				#endif
@@ -511,6 +515,7 @@ namespace objl
 
 							// Insert Mesh
 							LoadedMeshes.push_back(tempMesh);
+							MeshMatNames.push_back(currentMatName);
 
 							// Cleanup
 							Vertices.clear();
@@ -607,8 +612,6 @@ namespace objl
 				// Get Mesh Material Name
 				if (algorithm::firstToken(curline) == "usemtl")
 				{
-					MeshMatNames.push_back(algorithm::tail(curline));
-
 					// Create new Mesh, if Material changes within a group
 					if (!Indices.empty() && !Vertices.empty())
 					{
@@ -627,11 +630,13 @@ namespace objl
 
 						// Insert Mesh
 						LoadedMeshes.push_back(tempMesh);
+						MeshMatNames.push_back(currentMatName);
 
 						// Cleanup
 						Vertices.clear();
 						Indices.clear();
 					}
+					currentMatName = algorithm::tail(curline);
 
 					#ifdef OBJL_CONSOLE_OUTPUT
 					outputIndicator = 0;
@@ -682,10 +687,13 @@ namespace objl
 
 				// Insert Mesh
 				LoadedMeshes.push_back(tempMesh);
+				MeshMatNames.push_back(currentMatName);
 			}
 
 			file.close();
 
+			LoadedNormalCount = Normals.size();
+
 			// Set Materials for each Mesh
 			for (int i = 0; i < MeshMatNames.size(); i++)
 			{
@@ -721,6 +729,8 @@ namespace objl
 		std::vector<unsigned int> LoadedIndices;
 		// Loaded Material Objects
 		std::vector<Material> LoadedMaterials;
+		// Number of vn lines in the file, 0 means every vertex got a flat face normal
+		size_t LoadedNormalCount = 0;
 
 	private:
 		// Generate vertices from a list of positions, 
@@ -1099,6 +1109,19 @@ namespace objl
 					tempMaterial.Ks.Y = std::stof(temp[1]);
 					tempMaterial.Ks.Z = std::stof(temp[2]);
 				}
+				// Emissive Color
+				if (algorithm::firstToken(curline) == "Ke")
+				{
+					std::vector<std::string> temp;
+					algorithm::split(algorithm::tail(curline), temp, " ");
+
+					if (temp.size() != 3)
+						continue;
+
+					tempMaterial.Ke.X = std::stof(temp[0]);
+					tempMaterial.Ke.Y = std::stof(temp[1]);
+					tempMaterial.Ke.Z = std::stof(temp[2]);
+				}
 				// Specular Exponent
 				if (algorithm::firstToken(curline) == "Ns")
 				{
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+
+// Number of worker threads used by the CPU side passes
+inline int GetWorkerCount() {
+	unsigned int hw = std::thread::hardware_concurrency();
+	return hw == 0 ? 1 : (int)hw;
+}
+
+// GetWorkerCount() - 1 threads started on first use & kept until exit, the caller of Run is the last worker.
+// One job at a time: Run returns false without doing anything while another job runs (a nested or concurrent
+// ParallelFor), the caller then does the work on its own.
+class ThreadPool {
+public:
+	static ThreadPool& Get() {
+		static ThreadPool pool(GetWorkerCount() - 1);
+		return pool;
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+		for (std::thread& t : m_threads)
+			t.join();
+	}
+
+	int GetThreadCount() const { return (int)m_threads.size(); }
+
+	// Calls job once on every pool thread & on the calling thread, returns once all calls are done
+	bool Run(const std::function<void()>& job) {
+		if (m_busy.exchange(true))
+			return false;
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_job = &job;
+			m_pending = (int)m_threads.size();
+			m_generation++;
+		}
+		m_wake.notify_all();
+
+		job();
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_done.wait(lock, [&]() { return m_pending == 0; });
+			m_job = nullptr;
+		}
+		m_busy = false;
+		return true;
+	}
+private:
+	ThreadPool(int threadCount) {
+		for (int t = 0; t < threadCount; ++t)
+			m_threads.emplace_back([this]() { workerLoop(); });
+	}
+
+	void workerLoop() {
+		uint64_t seen = 0;
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true) {
+			m_wake.wait(lock, [&]() { return m_stop || m_generation != seen; });
+			if (m_stop)
+				return;
+			seen = m_generation;
+			const std::function<void()>* job = m_job;
+
+			lock.unlock();
+			(*job)();
+			lock.lock();
+
+			if (--m_pending == 0)
+				m_done.notify_one();
+		}
+	}
+
+	std::vector<std::thread> m_threads;
+	std::atomic<bool> m_busy{ false };  // set for the whole of Run, one job at a time
+	std::mutex m_mutex;                 // guards everything below
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+	const std::function<void()>* m_job = nullptr;
+	uint64_t m_generation = 0;
+	int m_pending = 0;
+	bool m_stop = false;
+};
+
+// Calls func(i) for every i in [0, count) spread over all cores (the ThreadPool & the calling thread).
+// Work is handed out in chunks from a shared counter so uneven items (rows, treelets...) balance out.
+template <typename Func>
+void ParallelFor(int count, Func&& func, int chunkSize = 1) {
+	if (count <= 0)
+		return;
+
+	chunkSize = std::max(chunkSize, 1);
+
+	std::atomic<int> next(0);
+	std::function<void()> worker = [&]() {
+		while (true) {
+			int start = next.fetch_add(chunkSize);
+			if (start >= count)
+				break;
+
+			int end = std::min(start + chunkSize, count);
+			for (int i = start; i < end; ++i)
+				func(i);
+		}
+	};
+
+	// Not worth waking the pool for a single chunk. Busy pool (nested call): the caller does it all
+	if ((count + chunkSize - 1) / chunkSize <= 1 || ThreadPool::Get().GetThreadCount() == 0 || !ThreadPool::Get().Run(worker))
+		worker();
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Frame phase timings. GPU phases are measured with GL_TIME_ELAPSED queries that are read a frame later
+// (double buffered, so reading them never stalls), CPU phases with a steady clock. Every sample goes through
+// a lock-free ring buffer, so worker threads can record too, and the render loop turns them into percentiles.
+
+enum class ProfilePhase : uint8_t {
+	CpuFrame,       // one iteration of the render loop
+	CpuTrace,       // CPU path tracer frame
+	CpuDenoise,     // readback & denoiser
+	GpuDispatch,    // compute shader
+	GpuBlit,        // full screen quad & overlay
+	GpuSwap,        // SDL_GL_SwapWindow
+	Count
+};
+
+const char* GetProfilePhaseName(ProfilePhase phase);
+
+struct ProfileSample {
+	ProfilePhase phase;
+	float milliseconds;
+};
+
+// Bounded multi producer, single consumer queue (Vyukov). A full queue drops the sample instead of blocking
+class ProfileSampleRing {
+public:
+	// capacity is rounded up to a power of two
+	explicit ProfileSampleRing(size_t capacity);
+
+	bool Push(const ProfileSample& sample);
+	// Only one thread may pop
+	bool Pop(ProfileSample& sample);
+private:
+	struct Slot {
+		std::atomic<size_t> sequence;
+		ProfileSample sample;
+	};
+
+	std::unique_ptr<Slot[]> m_slots;
+	size_t m_mask;
+	std::atomic<size_t> m_writeIndex;
+	size_t m_readIndex;
+};
+
+struct ProfilePhaseStats {
+	int count = 0;      // samples in the history
+	float p50 = 0.0f;
+	float p95 = 0.0f;
+	float p99 = 0.0f;
+	float max = 0.0f;
+};
+
+class FrameProfiler {
+public:
+	// Needs a current GL context for the queries
+	FrameProfiler();
+	~FrameProfiler();
+
+	// Reads the queries of the previous use of this frame's query set, call once at the start of a frame
+	void BeginFrame();
+
+	// GL_TIME_ELAPSED queries can't nest, so only one GPU phase can be open at a time
+	void BeginGpu(ProfilePhase phase);
+	void EndGpu();
+
+	// Thread safe
+	void RecordCpu(ProfilePhase phase, double milliseconds);
+
+	// Moves queued samples into the per phase histories, call from the thread that reads the stats
+	void Collect();
+
+	ProfilePhaseStats GetStats(ProfilePhase phase) const;
+
+	// One line with p50/p95/p99 of every phase that has samples
+	std::string FormatReport() const;
+
+	static const int HISTORY_SIZE = 256;
+private:
+	static const int QUERY_SETS = 2;
+	static const int PHASE_COUNT = (int)ProfilePhase::Count;
+
+	GLuint m_queries[QUERY_SETS][PHASE_COUNT];
+	bool m_queryPending[QUERY_SETS][PHASE_COUNT];
+	int m_querySet;
+	int m_activeGpuPhase; // -1 when no query is open
+
+	ProfileSampleRing m_ring;
+
+	// Last HISTORY_SIZE samples of every phase, circular
+	std::vector<float> m_history[PHASE_COUNT];
+	int m_historyNext[PHASE_COUNT];
+};
+
+// Records the time until the end of the scope as a CPU sample
+class CpuProfileScope {
+public:
+	CpuProfileScope(FrameProfiler& profiler, ProfilePhase phase);
+	~CpuProfileScope();
+private:
+	FrameProfiler& m_profiler;
+	ProfilePhase m_phase;
+	std::chrono::steady_clock::time_point m_start;
+};
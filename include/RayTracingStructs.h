@@ -1,15 +1,19 @@
 #pragma once
 #include <cstddef>  // offsetof
+#include <cfloat>   // FLT_MAX
+#include <cmath>    // FP_NAN
 #include <type_traits>
+#include <cstdint>
 
 #include <glm/glm.hpp>
 // === Shared GPU <-> CPU structures (std430 layout) ===
 
 
-__pragma(pack(push, 1))
+#pragma pack(push, 1)
 // RayTracingMaterial (64 bytes)
 struct RayTracingMaterial {
-    glm::vec4 color;              // offset 0
+    glm::vec3 color;              // offset 0
+    int   diffuseTexture;         // offset 12, TextureMip index of the map_Kd level 0, -1 for none (color is multiplied by it)
     glm::vec4 emissionColor;      // offset 16
     glm::vec4 specularColor;      // offset 32
 
@@ -20,7 +24,7 @@ struct RayTracingMaterial {
     // stride = 64
 };
 
-// Model (208 bytes)
+// Model (144 bytes), materials are per triangle (Triangle::materialIndex)
 struct Model {
     int nodeOffset; // offset 0
     int triOffset;  // offset 4
@@ -28,9 +32,7 @@ struct Model {
 
     glm::mat4 worldToLocalMatrix;   // offset 16
     glm::mat4 localToWorldMatrix;   // offset 80
-
-    RayTracingMaterial material;    // offset 144
-    // stride = 208
+    // stride = 144
 };
 
 // BVHNode (48 bytes)
@@ -40,38 +42,106 @@ struct BVHNode {
     
     int startIndex; // offset 28
     int triangleCount; // offset 32
-    int _pad1;    // offset 
-    int _pad2;    // offset 
-    int _pad3;    // offset 
+    int parentIndex;   // offset 36, relative like startIndex, -1 for the root (unused by the primitive BVH)
+    int splitAxis;     // offset 40, axis the children were split on, the left child is on the low side
+    int _pad3;    // offset 44
 
     BVHNode() : boundsMin(glm::vec3(FLT_MAX)),
         boundsMax(glm::vec3(FLT_MIN)),
         startIndex(0),
         triangleCount(-1),
         _pad0(FP_NAN),
-        _pad1(0),
-        _pad2(0),
+        parentIndex(-1),
+        splitAxis(0),
         _pad3(0)
     {}
 };
 
 // Triangle (96 bytes)
 struct Triangle {
-    glm::vec3 posA; float _pad0;    // offset 0
-    glm::vec3 posB; float _pad1;    // offset 16
-    glm::vec3 posC; float _pad2;    // offset 32
+    glm::vec3 posA; int materialIndex;  // offset 0, materialIndex is absolute (into the material table)
+    glm::vec3 posB; uint32_t uvA;   // offset 16, texture coordinates of the corners as half2 (see packTriangleUVs)
+    glm::vec3 posC; uint32_t uvB;   // offset 32
 
-    glm::vec3 normA; float _pad3;    // offset 48
-    glm::vec3 normB; float _pad4;    // offset 64
+    glm::vec3 normA; uint32_t uvC;  // offset 48
+    glm::vec3 normB; int lightIndex; // offset 64, into the light table when emissive, else -1
     glm::vec3 normC; float _pad5;    // offset 80
     // stride = 96
 };
-__pragma(pack(pop))
+
+// TriangleRecord (48 bytes), precomputed intersection data of a Triangle at the same index.
+// Leaf tests only read these, the Triangle itself is only fetched for the closest hit's normal
+struct TriangleRecord {
+    glm::vec3 posA;   float normalX;    // offset 0
+    glm::vec3 edgeAB; float normalY;    // offset 16, posB - posA
+    glm::vec3 edgeAC; float normalZ;    // offset 32, posC - posA, normal = cross(edgeAB, edgeAC) (not normalized)
+    // stride = 48
+};
+
+// Analytic primitive types, keep in sync with compute.glsl
+enum PrimitiveType : int {
+    PRIMITIVE_SPHERE = 0,
+    PRIMITIVE_PLANE = 1,
+    PRIMITIVE_DISK = 2,
+};
+
+// Primitive (96 bytes), analytic shape intersected directly instead of through triangles
+struct Primitive {
+    glm::vec3 center;   // offset 0, sphere/disk center or any point on a plane
+    float radius;       // offset 12, sphere/disk radius, unused by planes
+
+    glm::vec3 normal;   // offset 16, plane/disk front facing normal, unused by spheres
+    int type;           // offset 28, PrimitiveType
+
+    RayTracingMaterial material;    // offset 32
+    // stride = 96
+};
+
+// PrimaryHit (16 bytes), camera ray hit kept by the primary hit cache
+struct PrimaryHit {
+    int modelIndex;         // offset 0, -1 for a miss, -2 - index for analytic primitives
+    int triIndex;           // offset 4, relative to the model's triOffset
+    glm::vec2 barycentric;  // offset 8, (u, v) of posB & posC, (dst, 0) for primitives
+};
+
+// TextureMip (16 bytes), one level of a texture's box filtered mip chain. The levels of a texture follow each other,
+// a texture is referenced by the index of its level 0. Texels are RGBA8 sRGB, top row first (as stb_image loads them)
+struct TextureMip {
+    int width;      // offset 0
+    int height;     // offset 4
+    int offset;     // offset 8, first texel in the texel buffer
+    int levelCount; // offset 12, levels from this one to the end of the chain
+};
+
+// Light (24 bytes), an emissive triangle in the light table, picked proportional to its power with Vose's alias table:
+// a uniform slot keeps its own light below aliasThreshold, else it takes alias
+struct Light {
+    int modelIndex;         // offset 0
+    int triIndex;           // offset 4, absolute (into the triangle buffer)
+    float power;            // offset 8, luminance of the emission * area in model space
+    float probability;      // offset 12, power / total power
+    float aliasThreshold;   // offset 16
+    int alias;              // offset 20
+    // stride = 24
+};
+
+// AdaptiveStats (16 bytes), counters written by the compute shader every frame. Every pixel adds at most 1 to the
+// pixel counts & 10000 to the error sum, so 64 bits of error sum hold any resolution (4K sums up to ~8.3e10)
+struct AdaptiveStats {
+    uint32_t activePixels;          // offset 0
+    uint32_t tracedPixels;          // offset 4, pixels that took RAYS_PER_PIXEL samples
+    uint32_t relativeErrorSumLow;   // offset 8, fixed point (x1000), low & high word of a 64 bit sum
+    uint32_t relativeErrorSumHigh;  // offset 12
+
+    uint64_t RelativeErrorSum() const { return ((uint64_t)relativeErrorSumHigh << 32) | relativeErrorSumLow; }
+};
+#pragma pack(pop)
 
 
 // === Compile-time checks ===
 static_assert(sizeof(RayTracingMaterial) == 64, "RayTracingMaterial must be 64 bytes");
 static_assert(offsetof(RayTracingMaterial, color) == 0);
+static_assert(offsetof(RayTracingMaterial, diffuseTexture) == 12);
 static_assert(offsetof(RayTracingMaterial, emissionColor) == 16);
 static_assert(offsetof(RayTracingMaterial, specularColor) == 32);
 static_assert(offsetof(RayTracingMaterial, emissionStrength) == 48);
@@ -79,23 +149,62 @@ static_assert(offsetof(RayTracingMaterial, smoothness) == 52);
 static_assert(offsetof(RayTracingMaterial, specularProbability) == 56);
 static_assert(offsetof(RayTracingMaterial, flag) == 60);
 
-static_assert(sizeof(Model) == 208, "Model must be 208 bytes");
+static_assert(sizeof(Model) == 144, "Model must be 144 bytes");
 static_assert(offsetof(Model, nodeOffset) == 0);
 static_assert(offsetof(Model, triOffset) == 4);
 static_assert(offsetof(Model, worldToLocalMatrix) == 16);
 static_assert(offsetof(Model, localToWorldMatrix) == 80);
-static_assert(offsetof(Model, material) == 144);
 
 static_assert(sizeof(BVHNode) == 48, "BVHNode must be 48 bytes");
 static_assert(offsetof(BVHNode, boundsMin) == 0);
 static_assert(offsetof(BVHNode, boundsMax) == 16);
 static_assert(offsetof(BVHNode, startIndex) == 28);
 static_assert(offsetof(BVHNode, triangleCount) == 32);
+static_assert(offsetof(BVHNode, parentIndex) == 36);
+static_assert(offsetof(BVHNode, splitAxis) == 40);
 
 static_assert(sizeof(Triangle) == 96, "Triangle must be 96 bytes");
 static_assert(offsetof(Triangle, posA) == 0);
+static_assert(offsetof(Triangle, materialIndex) == 12);
 static_assert(offsetof(Triangle, posB) == 16);
 static_assert(offsetof(Triangle, posC) == 32);
+static_assert(offsetof(Triangle, uvA) == 28);
+static_assert(offsetof(Triangle, uvB) == 44);
 static_assert(offsetof(Triangle, normA) == 48);
+static_assert(offsetof(Triangle, uvC) == 60);
 static_assert(offsetof(Triangle, normB) == 64);
+static_assert(offsetof(Triangle, lightIndex) == 76);
 static_assert(offsetof(Triangle, normC) == 80);
+
+static_assert(sizeof(TriangleRecord) == 48, "TriangleRecord must be 48 bytes");
+static_assert(offsetof(TriangleRecord, posA) == 0);
+static_assert(offsetof(TriangleRecord, normalX) == 12);
+static_assert(offsetof(TriangleRecord, edgeAB) == 16);
+static_assert(offsetof(TriangleRecord, normalY) == 28);
+static_assert(offsetof(TriangleRecord, edgeAC) == 32);
+static_assert(offsetof(TriangleRecord, normalZ) == 44);
+
+static_assert(sizeof(Primitive) == 96, "Primitive must be 96 bytes");
+static_assert(offsetof(Primitive, center) == 0);
+static_assert(offsetof(Primitive, radius) == 12);
+static_assert(offsetof(Primitive, normal) == 16);
+static_assert(offsetof(Primitive, type) == 28);
+static_assert(offsetof(Primitive, material) == 32);
+
+static_assert(sizeof(PrimaryHit) == 16, "PrimaryHit must be 16 bytes");
+static_assert(offsetof(PrimaryHit, modelIndex) == 0);
+static_assert(offsetof(PrimaryHit, triIndex) == 4);
+static_assert(offsetof(PrimaryHit, barycentric) == 8);
+
+static_assert(sizeof(TextureMip) == 16, "TextureMip must be 16 bytes");
+static_assert(offsetof(TextureMip, offset) == 8);
+static_assert(offsetof(TextureMip, levelCount) == 12);
+
+static_assert(sizeof(Light) == 24, "Light must be 24 bytes");
+static_assert(offsetof(Light, probability) == 12);
+static_assert(offsetof(Light, aliasThreshold) == 16);
+static_assert(offsetof(Light, alias) == 20);
+
+static_assert(sizeof(AdaptiveStats) == 16, "AdaptiveStats must be 16 bytes");
+static_assert(offsetof(AdaptiveStats, relativeErrorSumLow) == 8);
+static_assert(offsetof(AdaptiveStats, relativeErrorSumHigh) == 12);
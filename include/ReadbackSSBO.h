@@ -0,0 +1,41 @@
+#pragma once
+
+#include <glad/glad.h>
+
+// SSBO the gpu writes every frame & the cpu reads back later (counters, statistics) without a sync point.
+// Immutable storage holding REGION_COUNT copies, persistently & coherently mapped for reading once.
+// Begin() zeroes the next region on the gpu & binds it, End() fences it after the dispatch & Read() copies out the
+// oldest region whose fence has passed, so results arrive a frame or two late instead of stalling the pipeline.
+class ReadbackSSBO {
+public:
+	static const int REGION_COUNT = 3;
+
+	ReadbackSSBO(GLuint bindingLoc, GLsizeiptr size);
+	~ReadbackSSBO();
+
+	// Call before the dispatch that writes the buffer, there must be a free region (see IsFull)
+	void Begin();
+
+	// Call after the dispatch that writes the buffer, its results can be read once this fence passes
+	void End();
+
+	// Copies the oldest region in flight into data & frees it. Returns false if it isn't finished yet, unless wait is set
+	bool Read(void* data, bool wait = false);
+
+	// Forgets every region in flight, for results that no longer apply (e.g. after an accumulation reset)
+	void Discard();
+
+	// Every region is in flight, Read one (waiting if needed) before the next Begin
+	bool IsFull() const { return m_inFlight == REGION_COUNT; }
+	GLuint GetID() const { return m_id; }
+private:
+	GLuint m_id;
+	GLuint m_bindingLocation;
+	GLsizeiptr m_size;
+	GLsizeiptr m_regionStride; // m_size rounded up to GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT
+	const char* m_mapped;
+
+	int m_oldest;   // oldest region in flight, the next one Begin uses follows the m_inFlight regions after it
+	int m_inFlight;
+	GLsync m_fences[REGION_COUNT];
+};
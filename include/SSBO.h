@@ -14,6 +14,8 @@ public:
 	void UnbindBase();
 
 	void SetData(GLsizeiptr size, const void* data);
+	// Reads back part of the buffer, this waits for the GPU to finish writing it
+	void GetData(GLintptr offset, GLsizeiptr size, void* data);
 	GLuint GetID() const { return m_id; }
 	GLenum GetUsage() const { return m_usage; }
 private:
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// CPU mirror of sampler.glsl.
+// A Sampler hands out the random numbers of one path, either independent PCG values or
+// padded 2D Owen scrambled Sobol points (Burley 2020, "Practical Hash-based Owen Scrambling").
+// The Sobol points are shared by all pixels and decorrelated per pixel with a blue noise like toroidal shift,
+// so the remaining error is spread as high frequency noise the eye (and the denoiser) handles better.
+
+enum class SamplerType : int {
+	Independent = 0,
+	Sobol = 1,
+};
+
+struct Sampler {
+	SamplerType type;
+	uint32_t rngState;   // PCG state, only used by the independent sampler
+	uint32_t index;      // sample index in the pixel's sequence
+	uint32_t dimension;  // next 2D dimension pair
+	glm::vec2 shift;     // per pixel toroidal shift
+};
+
+// sampleIndex is the number of samples the pixel already took, rngState seeds the independent sampler
+Sampler CreateSampler(SamplerType type, int pixelX, int pixelY, uint32_t sampleIndex, uint32_t rngState);
+
+// Values in [0, 1). Every call uses a new dimension, draw 2D values together when they belong together
+float SampleNext1D(Sampler& sampler);
+glm::vec2 SampleNext2D(Sampler& sampler);
+
+// Warps from [0, 1)^2
+glm::vec2 SampleDisk(const glm::vec2& u);
+// Cosine weighted direction around normal (pdf = cos / PI), one sqrt & one sin/cos pair instead of 3 Box-Muller normals
+glm::vec3 SampleCosineHemisphere(const glm::vec3& normal, const glm::vec2& u);
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <vector>
+
+// SSBO for data the cpu keeps changing while the gpu reads it (model transforms).
+// Immutable storage holding REGION_COUNT copies of the data, persistently & coherently mapped once.
+// Updates go into a cpu copy, Advance() moves to the next copy the gpu is done with (waiting on its fence)
+// and only writes the byte ranges that changed since that copy was last used, so nothing is reallocated
+// and the gpu never has to wait for an upload.
+class StreamingSSBO {
+public:
+	static const int REGION_COUNT = 3;
+
+	StreamingSSBO(GLuint bindingLoc, GLsizeiptr size, const void* data);
+	~StreamingSSBO();
+
+	// Changes size bytes at offset, the gpu sees them after the next Advance()
+	void Update(GLintptr offset, GLsizeiptr size, const void* data);
+
+	// Call before the dispatch that reads the buffer. With pending updates this switches to the next region,
+	// else the current one is kept. Binds the region to the binding location
+	void Advance();
+
+	// Call after the dispatch that reads the buffer, the current region can't be rewritten until it passes
+	void Fence();
+
+	bool HasPendingUpdates() const { return m_dirtyBegin[m_region] < m_dirtyEnd[m_region]; }
+	GLuint GetID() const { return m_id; }
+private:
+	void waitForRegion(int region);
+
+	GLuint m_id;
+	GLuint m_bindingLocation;
+	GLsizeiptr m_size;
+	GLsizeiptr m_regionStride; // m_size rounded up to GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT
+	char* m_mapped;
+
+	int m_region;
+	GLsync m_fences[REGION_COUNT];
+
+	// Bytes that changed since each region was last written, [begin, end)
+	GLintptr m_dirtyBegin[REGION_COUNT];
+	GLintptr m_dirtyEnd[REGION_COUNT];
+	std::vector<char> m_data;
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "RayTracingStructs.h"
+
+// Diffuse textures (MTL map_Kd) for both tracers.
+// Files are decoded with stb_image on the persistent ThreadPool (ParallelFor.h), then the box filtered mip chains of
+// all textures are built level by level, every level's rows spread over the same threads. Levels are averaged as 16 bit linear RGBA (SSE2 when available) & stored
+// back as RGBA8 sRGB, the texels of every level of every texture share one buffer.
+
+// Destination rows per ParallelFor work item while building mip levels
+#define TEXTURE_ROW_CHUNK 16
+
+struct TextureLoadStats {
+	int loaded = 0;
+	int failed = 0;     // files stb_image couldn't read
+	size_t texels = 0;  // all levels of the loaded textures
+	double seconds = 0.0;
+};
+
+// Appends the textures at paths & their mip chains to mips & texels. textureIndices gets the TextureMip index of every
+// path's level 0, -1 for files that couldn't be loaded
+TextureLoadStats LoadTextures(const std::vector<std::string>& paths, std::vector<TextureMip>& mips,
+	std::vector<uint32_t>& texels, std::vector<int>& textureIndices);
+
+// Averages every 2x2 block of src into one texel of dst, row y of dst only. Texels are 4 interleaved 16 bit channels.
+// Odd edges of src are dropped like in GL, a side of 1 is averaged with itself
+void DownsampleTextureRow(const uint16_t* src, int srcWidth, int srcHeight, uint16_t* dst, int dstWidth, int y);
+
+// One line summary for the console
+std::string FormatTextureLoadStats(const TextureLoadStats& stats);
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <glm/glm.hpp>
+
+// Summaries of the per pixel traversal cost (build with TRAVERSAL_STATS, cmake -DRAYTRACER_TRAVERSAL_STATS=ON).
+// Cost buffers hold running sums per pixel, the same on cpu & gpu:
+// x nodes visited, y ray-box tests, z ray-triangle tests, w rays traced (closest hit & shadow rays).
+// Only the triangle BVHs are counted, the analytic primitives are not.
+// The cpu tracer also feeds every node it reads through a simulated L1 cache per thread (NodeCacheModel),
+// to compare node layouts (BVHLayout.h) without hardware counters.
+
+// Simulated data cache, about an L1 of a desktop core
+#define NODE_CACHE_SIZE (32 * 1024)
+#define NODE_CACHE_WAYS 8
+#define NODE_CACHE_LINE 64
+
+enum class TraversalMetric {
+	Nodes = 0,
+	BoxTests = 1,
+	TriangleTests = 2
+};
+
+const char* GetTraversalMetricName(TraversalMetric metric);
+
+// Distribution of a metric per ray over the pixels that traced at least one ray
+struct TraversalCostSummary {
+	int pixels = 0;
+	float mean = 0.0f;          // over pixels, every pixel weighs the same
+	float p50 = 0.0f;
+	float p99 = 0.0f;
+	float max = 0.0f;
+	float binWidth = 0.0f;      // histogram covers [0, max], bin i is [i * binWidth, (i + 1) * binWidth)
+	std::vector<int> histogram;
+};
+
+TraversalCostSummary SummarizeTraversalCost(const std::vector<glm::vec4>& cost, TraversalMetric metric, int binCount = 16);
+
+// Multi line report of every metric, for the console
+std::string FormatTraversalCostSummary(const std::vector<glm::vec4>& cost, int binCount = 16);
+
+// False colour image of a metric per ray, black (0) over blue & red to white (maxValue and above).
+// maxValue <= 0 uses the p99 of the image so a few outliers don't wash it out
+void TraversalCostHeatmap(const std::vector<glm::vec4>& cost, TraversalMetric metric, float maxValue, std::vector<glm::vec4>& out);
+
+// Set associative LRU cache that only sees BVH node reads, so it is the best case for the nodes:
+// triangles, materials & the image don't evict them like they would in a real cache
+class NodeCacheModel {
+public:
+	NodeCacheModel();
+
+	// Touches every line of [address, address + bytes), returns how many of them missed
+	int Access(const void* address, size_t bytes);
+	void Clear();
+
+private:
+	int m_setCount;
+	// NODE_CACHE_WAYS line addresses per set, most recently used first, 0 is an empty way
+	std::vector<uintptr_t> m_lines;
+};
@@ -7,22 +7,34 @@
 #include <iostream>
 #include <cerrno>
 #include <unordered_map>
+#include <cstdint>
+#include <vector>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 std::string get_file_contents(const char* filename);
 
+// Compile time define, added as "#define name value" right after the shader's #version line
+struct ShaderDefine
+{
+	std::string name;
+	std::string value;
+};
+
 class Shader
 {
 public:
 	// Reference ID of the Shader Program
 	GLuint ID;
 
+	// Where compute program binaries are cached between launches, empty disables the cache
+	static std::string BinaryCacheDirectory;
+
 	// Constructor that build the Shader Program from 2 different shaders
 	Shader(const char* vertexFile, const char* fragmentFile);
 
-	// Constructor that builds the Compute Shader Program
-	Shader(const char* shaderFile, GLenum type);
+	// Constructor that builds the Compute Shader Program, defines override the shader's #ifndef defaults
+	Shader(const char* shaderFile, GLenum type, const std::vector<ShaderDefine>& defines = {});
 
 	// Activates the Shader Program
 	void Activate();
@@ -68,6 +80,16 @@ private:
 	
 	void parsePreprocessorDirectives(std::string& source, const std::string& parentDir);
 
+	void injectDefines(std::string& source, const std::vector<ShaderDefine>& defines);
+
+	// Program binary cache, keyed by the final source & the driver
+	std::string binaryCachePath(const char* shaderFile, const std::string& source);
+	bool loadProgramBinary(const std::string& path);
+	void saveProgramBinary(const std::string& path);
+	uint64_t binaryKey = 0;          // names the cache file
+	uint64_t binaryCheck = 0;        // second, independent hash stored in the file to tell colliding keys apart
+	uint64_t binarySourceLength = 0;
+
 	std::unordered_map<std::string, uint32_t> uniformLocationCache;
 };
 
@@ -1,7 +1,32 @@
 #version 440 
 
 // CONSTANTS
+// The defines below can be overridden at compile time (see ShaderDefine), these are the defaults
+// Samples per pixel per dispatch
+#ifndef RAYS_PER_PIXEL
 #define RAYS_PER_PIXEL 32
+#endif
+#ifndef MAX_BOUNCES
+#define MAX_BOUNCES 3
+#endif
+// 0: one workgroup per pixel, one sample per thread, reduced through shared memory
+// N: NxN pixel tiles per workgroup, one pixel per thread, each thread loops over its samples
+// Mesa llvmpipe ends all loops of an invocation after 65535 iterations in total, use RAYS_PER_PIXEL 1 there
+#ifndef TILE_SIZE
+#define TILE_SIZE 0
+#endif
+// 1: triangle BVHs are walked over parent links without a stack, safe at any depth
+// 0: near/far traversal with a 32 entry stack per thread
+#ifndef STACKLESS_TRAVERSAL
+#define STACKLESS_TRAVERSAL 1
+#endif
+// 1: leaf tests read the precomputed TriangleRecords, the Triangle is only fetched for the closest hit
+// 0: edges & normal are recomputed from the Triangle for every test
+#ifndef PRECOMPUTED_TRIANGLES
+#define PRECOMPUTED_TRIANGLES 1
+#endif
+// Defined: count the triangle BVH work of every ray into traversalCostImage (off by default, it costs registers)
+// #define TRAVERSAL_STATS
 const float inf = 1. / 0.;
 
 // Thanks to Sebastian-Lague for shader
@@ -9,10 +34,15 @@ const float inf = 1. / 0.;
 
 
 // Shader Property
+#if TILE_SIZE > 0
+layout (local_size_x = TILE_SIZE, local_size_y = TILE_SIZE) in;
+#else
 layout (local_size_x = RAYS_PER_PIXEL, local_size_y = 1) in;
+#endif
 
 // include RNG functions
 #pragma include "rng.glsl"
+#pragma include "sampler.glsl"
 
 // Defined Data Structures
 struct Ray {
@@ -23,24 +53,38 @@ struct Ray {
 
 struct Triangle {
     vec3 posA;
+    int materialIndex;  // into Materials
     vec3 posB;
+    uint uvA;           // texture coordinates of the corners, packHalf2x16
     vec3 posC;
+    uint uvB;
   
     vec3 normA;
+    uint uvC;
     vec3 normB;
+    int lightIndex;     // into Lights when emissive, else -1
     vec3 normC;
 };
 
+// Precomputed intersection data of the Triangle at the same index, the normal is cross(edgeAB, edgeAC)
+struct TriangleRecord {
+    vec4 posA;      // w: normal.x
+    vec4 edgeAB;    // w: normal.y
+    vec4 edgeAC;    // w: normal.z
+};
+
 struct TriangleHitInfo {
     bool didHit;
     float dst;
     vec3 hitPoint;
     vec3 normal;
     int triIndex;
+    vec2 barycentric; // weights of posB & posC
 };
 
 struct RayTracingMaterial {
-    vec4 color;
+    vec3 color;
+    int diffuseTexture;     // TextureMips index of the map_Kd level 0, -1 for none (color is multiplied by it)
     vec4 emissionColor;
     vec4 specularColor;
     float emissionStrength;
@@ -54,7 +98,6 @@ struct Model {
     int triOffset;
     mat4 worldToLocalMat;
     mat4 localToWorldMat;
-    RayTracingMaterial material;
 };
 
 struct BVHNode {
@@ -63,6 +106,22 @@ struct BVHNode {
     // If triangleCount > 0, then this is leaf node
     int startIndex;
     int triangleCount;
+    // Relative like startIndex, -1 for the root. The left child is on the low side of splitAxis
+    int parentIndex;
+    int splitAxis;
+};
+
+// Analytic primitive types
+#define PRIMITIVE_SPHERE 0
+#define PRIMITIVE_PLANE 1
+#define PRIMITIVE_DISK 2
+
+struct Primitive {
+    vec3 center;    // sphere/disk center or any point on a plane
+    float radius;   // sphere/disk radius
+    vec3 normal;    // plane/disk front facing normal
+    int type;
+    RayTracingMaterial material;
 };
 
 struct ModelHitInfo {
@@ -71,11 +130,36 @@ struct ModelHitInfo {
     vec3 hitPoint;
     vec3 normal;
     RayTracingMaterial material;
+    // What was hit, for the primary hit cache
+    int modelIndex;     // -1 for a miss, -2 - index for analytic primitives
+    int triIndex;       // relative to the model's triOffset
+    vec2 barycentric;
+    // Only filled for textured materials, see TriangleTexCoords
+    vec2 uv;
+    float uvDensity;
+};
+
+// Compact first hit stored by the primary hit cache
+struct PrimaryHit {
+    int modelIndex;     // same encoding as ModelHitInfo
+    int triIndex;
+    vec2 barycentric;   // (u, v) of the triangle, (dst, 0) for primitives
 };
 
 // Shader Inputs
 // TODO: Allocate a large enough buffer and take count as param and only update needed data from cpu side
 layout (rgba32f, binding = 0) uniform image2D outputImage;
+// Running sum of radiance (rgb) and samples taken (a), kept across frames
+layout (rgba32f, binding = 1) uniform image2D accumImage;
+// Welford state of the luminance per pixel: mean, M2, sample count, converged flag
+layout (rgba32f, binding = 2) uniform image2D varianceImage;
+// Running sums of the denoiser features: first hit albedo (rgb) & distance (a), first hit shading normal (xyz)
+layout (rgba32f, binding = 3) uniform image2D albedoDepthImage;
+layout (rgba32f, binding = 4) uniform image2D normalImage;
+#ifdef TRAVERSAL_STATS
+// Running sums of the triangle BVH work: nodes visited, ray-box tests, ray-triangle tests, rays traced
+layout (rgba32f, binding = 5) uniform image2D traversalCostImage;
+#endif
 
 // Scene Data SSBOs
 layout (std430, binding = 1) buffer ModelsBuffer {
@@ -90,13 +174,131 @@ layout (std430, binding = 3) buffer TrianglesBuffer {
     Triangle Triangles[];
 };
 
+layout (std430, binding = 8) buffer TriangleRecordsBuffer {
+    TriangleRecord TriangleRecords[];
+};
+
+// Materials shared by all models, Triangle.materialIndex points in here
+layout (std430, binding = 9) buffer MaterialsBuffer {
+    RayTracingMaterial Materials[];
+};
+
+// Mip levels of all diffuse textures, the levels of a texture follow its level 0
+struct TextureMip {
+    int width;
+    int height;
+    int offset;     // first texel in TextureTexels
+    int levelCount; // levels from this one to the end of the chain
+};
+
+layout (std430, binding = 10) buffer TextureMipsBuffer {
+    TextureMip TextureMips[];
+};
+
+// RGBA8 sRGB, top row first
+layout (std430, binding = 11) buffer TextureTexelsBuffer {
+    uint TextureTexels[];
+};
+
+// Emissive triangles, picked proportional to their power with an alias table: a uniform slot keeps its own light
+// below aliasThreshold, else it takes alias. Only read when uLightCount > 0
+struct Light {
+    int modelIndex;
+    int triIndex;       // absolute, into Triangles
+    float power;
+    float probability;  // power / total power
+    float aliasThreshold;
+    int alias;
+};
+
+layout (std430, binding = 14) buffer LightsBuffer {
+    Light Lights[];
+};
+
+// HDR environment map, equirectangular with the top row first (see EnvironmentMap.h). Only read when uEnvironmentWidth > 0
+// rgb: radiance, a: the row's CDF up to & including this texel
+layout (std430, binding = 12) buffer EnvironmentTexelsBuffer {
+    vec4 EnvironmentTexels[];
+};
+
+// CDF over the rows up to & including each row
+layout (std430, binding = 13) buffer EnvironmentMarginalBuffer {
+    float EnvironmentMarginal[];
+};
+
+// Analytic primitives, planes first then the bounded primitives covered by PrimitiveNodes
+// Leaves & inner nodes of the primitive BVH use absolute indices
+layout (std430, binding = 5) buffer PrimitivesBuffer {
+    Primitive Primitives[];
+};
+
+layout (std430, binding = 6) buffer PrimitiveBVHBuffer {
+    BVHNode PrimitiveNodes[];
+};
+
+// Primary hit cache, uPrimaryCacheSamples slots per pixel
+layout (std430, binding = 7) buffer PrimaryHitBuffer {
+    PrimaryHit PrimaryHits[];
+};
+
+// Adaptive sampling counters, cleared every frame & summed per workgroup before they get here
+layout (std430, binding = 4) buffer AdaptiveStatsBuffer {
+    uint activePixels;          // pixels still above the error threshold after this frame
+    uint tracedPixels;          // pixels that took RAYS_PER_PIXEL samples this frame
+    uint relativeErrorSumLow;   // sum of per pixel relative error, fixed point (x1000), 64 bit over two words
+    uint relativeErrorSumHigh;
+};
+
+#if TILE_SIZE == 0
 shared vec3 ccontrib[RAYS_PER_PIXEL]; // store per-thread contribution
+shared vec4 cAlbedoDepth[RAYS_PER_PIXEL]; // store per-thread first hit albedo & distance
+shared vec3 cNormal[RAYS_PER_PIXEL]; // store per-thread first hit normal
+#ifdef TRAVERSAL_STATS
+shared vec4 cTraversalCost[RAYS_PER_PIXEL]; // store per-thread traversal cost
+#endif
+#else
+// The tile's adaptive sampling counters, one invocation adds them to AdaptiveStatsBuffer.
+// The error sum of a tile stays below TILE_SIZE^2 * 10000, 32 bits are plenty
+shared uint cActivePixels;
+shared uint cTracedPixels;
+shared uint cErrorSum;
+#endif
+
+#ifdef TRAVERSAL_STATS
+// Traversal cost of this invocation's samples, same layout as traversalCostImage
+vec4 traversalCost = vec4(0.0);
+#define COUNT_TRAVERSAL(component, n) traversalCost.component += float(n)
+#else
+#define COUNT_TRAVERSAL(component, n)
+#endif
 
 // Shader uniforms
 
 uniform vec2 uResolution;
 uniform float uTime;
 uniform int uFrame;
+// Frames already summed into accumImage, 0 restarts accumulation
+uniform int uAccumFrame;
+// Adaptive sampling, pixels whose relative error drops below the threshold stop tracing
+uniform int uAdaptiveSampling;
+uniform float uAdaptiveThreshold;
+uniform int uAdaptiveMinSamples;
+// Next event estimation at diffuse bounces toward the sun, or the environment map's bright texels
+uniform int uSunSampling;
+// Next event estimation toward the emissive triangles at diffuse bounces, uLightCount of them in Lights
+uniform int uLightSampling;
+uniform int uLightCount;
+// Size of the environment map, 0 uses the procedural sky & sun
+uniform int uEnvironmentWidth;
+uniform int uEnvironmentHeight;
+// SAMPLER_INDEPENDENT or SAMPLER_SOBOL, see sampler.glsl
+uniform int uSamplerType;
+// Primitive buffers are never empty on the gpu, so the counts come from here
+uniform int uPrimitiveCount;
+uniform int uPlaneCount;
+// Primary hit cache (static camera): the first N samples of a pixel store their camera ray hit,
+// later samples reuse them & only trace the bounces. 0 turns it off
+uniform int uPrimaryCacheSamples;
 
 // Ray tracer property
 vec3 camPos = vec3(0.0, 0.0, 0.0);
@@ -113,7 +315,7 @@ const vec3 SunColor = vec3(1.0, 0.9, 0.6);
 const float SunIntensity = 10.0;
 const float SunFocus = 500.0;
 
-const int maxBounces = 3;
+const int maxBounces = MAX_BOUNCES;
 const float maxDist = 1e8;
 const float minDist = 1e-8;
 
@@ -126,21 +328,137 @@ float DefocusStrength = 1.0;
 float DivergeStrength = 0.5;
 
 
-// Crude Sky color function for ambient light
-vec3 GetEnvironmentLight(vec3 dir) {
+// Sky gradient & ground, without the sun
+vec3 GetSkyLight(vec3 dir) {
     if(UseSky == 0)
         return vec3(0.0);
-    uint state = 1;
     float skyGradientT = pow(smoothstep(0.0, 0.4, dir.y), 0.35);
     float groundToSkyT = smoothstep(-0.01, 0.0, dir.y);
     
     vec3 skyGradient = mix(SkyColourHorizon, SkyColourZenith, skyGradientT);
+    return mix(GroundColour, skyGradient, groundToSkyT);
+}
 
+// Sun lobe, hidden below the horizon
+vec3 GetSunLight(vec3 dir) {
+    if(UseSky == 0)
+        return vec3(0.0);
     float sun = pow(max(0, dot(dir, SunDirection)), SunFocus) * SunIntensity;
-    // Combine all 3
-    vec3 composite = mix(GroundColour, skyGradient, groundToSkyT) + sun * SunColor * float(groundToSkyT >= 1);
+    return sun * SunColor * float(dir.y >= 0.0);
+}
+
+// Crude Sky color function for ambient light
+vec3 GetEnvironmentLight(vec3 dir) {
+    return GetSkyLight(dir) + GetSunLight(dir);
+}
+
+// Solid angle pdf of SampleSunDirection, proportional to the sun lobe: (n + 1) / 2pi * cos^n
+float SunPdf(vec3 dir) {
+    return (SunFocus + 1.0) / (2.0 * PI) * pow(max(0.0, dot(dir, SunDirection)), SunFocus);
+}
+
+// Samples a direction around SunDirection proportional to the sun lobe
+vec3 SampleSunDirection(vec2 u) {
+    float cosTheta = pow(u.x, 1.0 / (SunFocus + 1.0));
+    float sinTheta = sqrt(max(0.0, 1.0 - cosTheta * cosTheta));
+    float phi = 2.0 * PI * u.y;
+
+    vec3 tangent = normalize(cross(abs(SunDirection.y) < 0.999 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0), SunDirection));
+    vec3 bitangent = cross(SunDirection, tangent);
+    return normalize(tangent * (cos(phi) * sinTheta) + bitangent * (sin(phi) * sinTheta) + SunDirection * cosTheta);
+}
+
+// Equirectangular coordinates of a direction, see EnvironmentMap.h
+vec2 EnvironmentUV(vec3 dir) {
+    return vec2(atan(dir.x, dir.z) / (2.0 * PI) + 0.5, acos(clamp(dir.y, -1.0, 1.0)) / PI);
+}
+
+// Bilinear, wrapping around horizontally & clamped at the poles
+vec3 EnvironmentRadiance(vec3 dir) {
+    int width = uEnvironmentWidth;
+    int height = uEnvironmentHeight;
+    vec2 pos = EnvironmentUV(dir) * vec2(width, height) - 0.5;
+    vec2 base = floor(pos);
+    vec2 f = pos - base;
+
+    int x0 = (int(base.x) % width + width) % width;
+    int x1 = (x0 + 1) % width;
+    int y0 = clamp(int(base.y), 0, height - 1);
+    int y1 = clamp(int(base.y) + 1, 0, height - 1);
+
+    vec3 top = mix(EnvironmentTexels[y0 * width + x0].rgb, EnvironmentTexels[y0 * width + x1].rgb, f.x);
+    vec3 bottom = mix(EnvironmentTexels[y1 * width + x0].rgb, EnvironmentTexels[y1 * width + x1].rgb, f.x);
+    return mix(top, bottom, f.y);
+}
 
-    return composite;
+// Probability of picking texel (x, y): its row from the marginal CDF times the texel from the row's CDF
+float EnvironmentTexelProbability(int x, int y) {
+    int row = y * uEnvironmentWidth;
+    float rowProbability = EnvironmentMarginal[y] - (y > 0 ? EnvironmentMarginal[y - 1] : 0.0);
+    float columnProbability = EnvironmentTexels[row + x].a - (x > 0 ? EnvironmentTexels[row + x - 1].a : 0.0);
+    return rowProbability * columnProbability;
+}
+
+// A texel covers 2pi / width * pi / height of (phi, theta) & sin(theta) times that in solid angle
+float EnvironmentPdf(vec3 dir) {
+    int width = uEnvironmentWidth;
+    int height = uEnvironmentHeight;
+    float sinTheta = sqrt(max(0.0, 1.0 - dir.y * dir.y));
+    if(sinTheta <= 0.0)
+        return 0.0;
+
+    vec2 uv = EnvironmentUV(dir);
+    int x = min(int(uv.x * width), width - 1);
+    int y = min(int(uv.y * height), height - 1);
+    return EnvironmentTexelProbability(x, y) * width * height / (2.0 * PI * PI * sinTheta);
+}
+
+// Picks a texel by binary search in the marginal CDF (u.y) & that row's CDF (u.x), u's position inside the
+// picked CDF steps places the direction inside the texel
+vec3 SampleEnvironmentDirection(vec2 u, out float pdf) {
+    int width = uEnvironmentWidth;
+    int height = uEnvironmentHeight;
+
+    int low = 0;
+    int high = height - 1;
+    while(low < high) {
+        int mid = (low + high) / 2;
+        if(EnvironmentMarginal[mid] > u.y)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+    int y = low;
+
+    int row = y * width;
+    low = 0;
+    high = width - 1;
+    while(low < high) {
+        int mid = (low + high) / 2;
+        if(EnvironmentTexels[row + mid].a > u.x)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+    int x = low;
+
+    float rowStart = y > 0 ? EnvironmentMarginal[y - 1] : 0.0;
+    float columnStart = x > 0 ? EnvironmentTexels[row + x - 1].a : 0.0;
+    float fy = clamp((u.y - rowStart) / (EnvironmentMarginal[y] - rowStart), 0.0, 1.0);
+    float fx = clamp((u.x - columnStart) / (EnvironmentTexels[row + x].a - columnStart), 0.0, 1.0);
+
+    float phi = 2.0 * PI * ((x + fx) / width - 0.5);
+    float theta = PI * (y + fy) / height;
+    float sinTheta = sin(theta);
+    pdf = sinTheta > 0.0 ? EnvironmentTexelProbability(x, y) * width * height / (2.0 * PI * PI * sinTheta) : 0.0;
+    return vec3(sinTheta * sin(phi), cos(theta), sinTheta * cos(phi));
+}
+
+// MIS power heuristic (beta = 2)
+float PowerHeuristic(float pdfA, float pdfB) {
+    float a = pdfA * pdfA;
+    float b = pdfB * pdfB;
+    return a + b > 0.0 ? a / (a + b) : 0.0;
 }
 
 // Ray Intersection function
@@ -166,9 +484,173 @@ TriangleHitInfo RayTriangle(Ray ray, Triangle tri) {
     hitInfo.dst = dst;
     hitInfo.hitPoint = ray.origin + ray.dir * dst;
     hitInfo.normal = normalize(w * tri.normA + u * tri.normB + v * tri.normC);
+    hitInfo.barycentric = vec2(u, v);
+    return hitInfo;
+}
+
+// Yes/no version of RayTriangle for occlusion rays, skips the hit point & normal interpolation
+bool RayTriangleAnyHit(Ray ray, Triangle tri, float rayLength) {
+    vec3 edgeAB = tri.posB - tri.posA;
+    vec3 edgeAC = tri.posC - tri.posA;
+    vec3 normVec = cross(edgeAB, edgeAC);
+    vec3 ao = ray.origin - tri.posA;
+    vec3 dao = cross(ao, ray.dir);
+
+    float det = -dot(ray.dir, normVec);
+    float invDet = 1 / det;
+
+    float dst = dot(ao, normVec) * invDet;
+    float u = dot(edgeAC, dao) * invDet;
+    float v = -dot(edgeAB, dao) * invDet;
+    float w = 1 - u - v;
+
+    return det >= 1E-8 && dst >= 0 && dst < rayLength && u >= 0 && v >= 0 && w >= 0;
+}
+
+// RayTriangle without the edge & normal setup, those come precomputed from the record.
+// Only dst & barycentric are filled in, FinishTriangleHit completes the closest hit
+TriangleHitInfo RayTriangleRecord(Ray ray, TriangleRecord record) {
+    vec3 normVec = vec3(record.posA.w, record.edgeAB.w, record.edgeAC.w);
+    vec3 ao = ray.origin - record.posA.xyz;
+    vec3 dao = cross(ao, ray.dir);
+
+    float det = -dot(ray.dir, normVec);
+    float invDet = 1 / det;
+
+    float dst = dot(ao, normVec) * invDet;
+    float u = dot(record.edgeAC.xyz, dao) * invDet;
+    float v = -dot(record.edgeAB.xyz, dao) * invDet;
+    float w = 1 - u - v;
+
+    TriangleHitInfo hitInfo;
+    hitInfo.didHit = det >= 1E-8 && dst >= 0 && u >= 0 && v >= 0 && w >= 0;
+    hitInfo.dst = dst;
+    hitInfo.barycentric = vec2(u, v);
     return hitInfo;
 }
 
+bool RayTriangleRecordAnyHit(Ray ray, TriangleRecord record, float rayLength) {
+    vec3 normVec = vec3(record.posA.w, record.edgeAB.w, record.edgeAC.w);
+    vec3 ao = ray.origin - record.posA.xyz;
+    vec3 dao = cross(ao, ray.dir);
+
+    float det = -dot(ray.dir, normVec);
+    float invDet = 1 / det;
+
+    float dst = dot(ao, normVec) * invDet;
+    float u = dot(record.edgeAC.xyz, dao) * invDet;
+    float v = -dot(record.edgeAB.xyz, dao) * invDet;
+    float w = 1 - u - v;
+
+    return det >= 1E-8 && dst >= 0 && dst < rayLength && u >= 0 && v >= 0 && w >= 0;
+}
+
+// Fills the hit point & interpolated normal of a RayTriangleRecord hit
+void FinishTriangleHit(Ray ray, Triangle tri, inout TriangleHitInfo hit) {
+    float u = hit.barycentric.x;
+    float v = hit.barycentric.y;
+    float w = 1 - u - v;
+    hit.hitPoint = ray.origin + ray.dir * hit.dst;
+    hit.normal = normalize(w * tri.normA + u * tri.normB + v * tri.normC);
+}
+
+// Distance to an analytic primitive, inf on a miss. Front faces only, like RayTriangle
+float RayPrimitiveDst(Ray ray, Primitive prim) {
+    if(prim.type == PRIMITIVE_SPHERE) {
+        vec3 oc = ray.origin - prim.center;
+        float a = dot(ray.dir, ray.dir);
+        float b = dot(oc, ray.dir);
+        float c = dot(oc, oc) - prim.radius * prim.radius;
+
+        // Only the near root, rays starting inside (or leaving the surface) miss
+        float discriminant = b * b - a * c;
+        if(discriminant < 0)
+            return inf;
+        float dst = (-b - sqrt(discriminant)) / a;
+        return dst >= 0 ? dst : inf;
+    }
+
+    // Plane & disk
+    float denom = dot(prim.normal, ray.dir);
+    if(denom > -1E-8)
+        return inf;
+    float dst = dot(prim.center - ray.origin, prim.normal) / denom;
+    if(dst < 0)
+        return inf;
+
+    if(prim.type == PRIMITIVE_DISK) {
+        vec3 offset = ray.origin + ray.dir * dst - prim.center;
+        if(dot(offset, offset) > prim.radius * prim.radius)
+            return inf;
+    }
+    return dst;
+}
+
+vec3 PrimitiveNormal(Primitive prim, vec3 hitPoint) {
+    if(prim.type == PRIMITIVE_SPHERE)
+        return (hitPoint - prim.center) / prim.radius;
+    return prim.normal;
+}
+
+// Texture coordinate at a triangle hit & 0.5 * log2(uv area / world area) of the triangle, i.e. log2 of the uv size of a
+// unit of world space on it (ray cone texture LOD)
+void TriangleTexCoords(Triangle tri, mat4 localToWorld, vec2 barycentric, out vec2 uv, out float uvDensity) {
+    vec2 uvA = unpackHalf2x16(tri.uvA);
+    vec2 uvB = unpackHalf2x16(tri.uvB);
+    vec2 uvC = unpackHalf2x16(tri.uvC);
+    uv = (1 - barycentric.x - barycentric.y) * uvA + barycentric.x * uvB + barycentric.y * uvC;
+
+    vec2 uvAB = uvB - uvA;
+    vec2 uvAC = uvC - uvA;
+    float uvArea = abs(uvAB.x * uvAC.y - uvAB.y * uvAC.x);
+    vec3 worldAB = (localToWorld * vec4(tri.posB - tri.posA, 0.0)).xyz;
+    vec3 worldAC = (localToWorld * vec4(tri.posC - tri.posA, 0.0)).xyz;
+    float worldArea = length(cross(worldAB, worldAC));
+    uvDensity = 0.5 * log2(max(uvArea, 1e-12) / max(worldArea, 1e-12));
+}
+
+vec3 SrgbToLinear(vec3 c) {
+    return mix(c / 12.92, pow((c + 0.055) / 1.055, vec3(2.4)), greaterThan(c, vec3(0.04045)));
+}
+
+vec3 TextureTexel(TextureMip mip, int x, int y) {
+    return SrgbToLinear(unpackUnorm4x8(TextureTexels[mip.offset + y * mip.width + x]).rgb);
+}
+
+// Bilinear, uv in [0, 1) & wrapped around. v = 0 is the bottom row, the last one in memory
+vec3 SampleTextureLevel(TextureMip mip, vec2 uv) {
+    float x = uv.x * mip.width - 0.5;
+    float y = (1.0 - uv.y) * mip.height - 0.5;
+    float x0 = floor(x);
+    float y0 = floor(y);
+    float tx = x - x0;
+    float ty = y - y0;
+
+    int left = (int(x0) + mip.width) % mip.width;
+    int right = (left + 1) % mip.width;
+    int top = (int(y0) + mip.height) % mip.height;
+    int bottom = (top + 1) % mip.height;
+
+    vec3 upper = mix(TextureTexel(mip, left, top), TextureTexel(mip, right, top), tx);
+    vec3 lower = mix(TextureTexel(mip, left, bottom), TextureTexel(mip, right, bottom), tx);
+    return mix(upper, lower, ty);
+}
+
+// Trilinear, the level is picked so a texel covers uvFootprintLog2 (log2 of the footprint's size in uv units)
+vec3 SampleTexture(int textureIndex, vec2 uv, float uvFootprintLog2) {
+    TextureMip level0 = TextureMips[textureIndex];
+    float lod = uvFootprintLog2 + 0.5 * log2(float(level0.width) * float(level0.height));
+    lod = lod > 0.0 ? min(lod, float(level0.levelCount - 1)) : 0.0;
+
+    uv -= floor(uv);
+    int lower = int(lod);
+    int upper = min(lower + 1, level0.levelCount - 1);
+    vec3 color = SampleTextureLevel(TextureMips[textureIndex + lower], uv);
+    if(upper == lower)
+        return color;
+    return mix(color, SampleTextureLevel(TextureMips[textureIndex + upper], uv), lod - float(lower));
+}
+
 // Thanks to https://tavianator.com/2011/ray_box.html
 float RayBoundingBoxDst(Ray ray, vec3 boxMin, vec3 boxMax) {
     vec3 tMin = (boxMin - ray.origin) * ray.invDir;
@@ -184,6 +666,175 @@ float RayBoundingBoxDst(Ray ray, vec3 boxMin, vec3 boxMax) {
     return dst;
 }
 
+// Closest hit among a leaf's triangles. With PRECOMPUTED_TRIANGLES only dst & barycentric are set,
+// FinishLeafHit completes the closest one after the traversal
+void RayTriangleLeaf(Ray ray, BVHNode node, int triOffset, inout TriangleHitInfo result) {
+    COUNT_TRAVERSAL(z, node.triangleCount);
+    for(int i = 0; i < node.triangleCount; ++i) {
+#if PRECOMPUTED_TRIANGLES
+        TriangleHitInfo triHitInfo = RayTriangleRecord(ray, TriangleRecords[triOffset + node.startIndex + i]);
+#else
+        Triangle tri = Triangles[triOffset + node.startIndex + i];
+        TriangleHitInfo triHitInfo = RayTriangle(ray, tri);
+#endif
+
+        if(triHitInfo.didHit && triHitInfo.dst < result.dst) {
+            result = triHitInfo;
+            result.triIndex = node.startIndex + i;
+        }
+    }
+}
+
+bool RayTriangleLeafOccluded(Ray ray, BVHNode node, int triOffset, float rayLength) {
+    for(int i = 0; i < node.triangleCount; ++i) {
+        COUNT_TRAVERSAL(z, 1);
+#if PRECOMPUTED_TRIANGLES
+        if(RayTriangleRecordAnyHit(ray, TriangleRecords[triOffset + node.startIndex + i], rayLength))
+#else
+        if(RayTriangleAnyHit(ray, Triangles[triOffset + node.startIndex + i], rayLength))
+#endif
+            return true;
+    }
+    return false;
+}
+
+void FinishLeafHit(Ray ray, int triOffset, inout TriangleHitInfo result) {
+#if PRECOMPUTED_TRIANGLES
+    if(result.didHit)
+        FinishTriangleHit(ray, Triangles[triOffset + result.triIndex], result);
+#endif
+}
+
+#if STACKLESS_TRAVERSAL
+
+// Stackless traversal over parent links (Hapala et al. 2011), used by both queries below.
+// Children are visited near first, picked by the ray direction along the parent's split axis, so the order can be
+// recomputed on the way back up. Only the current node & its ancestors are needed, it works at any depth without a stack
+
+// 0 if the left child is the near one, else 1
+int NearChildOffset(BVHNode node, Ray ray) {
+    return ray.dir[node.splitAxis] < 0 ? 1 : 0;
+}
+
+// farChild is finished & so is its parent. Walks up until a finished node is a near child & returns its sibling,
+// the next node to visit, or -1 once the whole tree is done
+int NextAfterFarChild(BVHNode farChild, int nodeOffset, Ray ray) {
+    int child = farChild.parentIndex;
+    if(child == 0)
+        return -1;
+    BVHNode childNode = Nodes[nodeOffset + child];
+    COUNT_TRAVERSAL(x, 1);
+
+    while(true) {
+        int parentIndex = childNode.parentIndex;
+        BVHNode parent = Nodes[nodeOffset + parentIndex];
+        COUNT_TRAVERSAL(x, 1);
+        int nearOffset = NearChildOffset(parent, ray);
+        if(child == parent.startIndex + nearOffset)
+            return parent.startIndex + 1 - nearOffset;
+        if(parentIndex == 0)
+            return -1;
+        child = parentIndex;
+        childNode = parent;
+    }
+    return -1;
+}
+
+TriangleHitInfo RayTriangleBVH(inout Ray ray, float rayLength, int nodeOffset, int triOffset) {
+    TriangleHitInfo result;
+    result.didHit = false;
+    result.dst = rayLength;
+    result.triIndex = -1;
+
+    // Like the stack traversal, the root's box isn't tested
+    BVHNode node = Nodes[nodeOffset];
+    COUNT_TRAVERSAL(x, 1);
+    if(node.triangleCount > 0) {
+        RayTriangleLeaf(ray, node, triOffset, result);
+        FinishLeafHit(ray, triOffset, result);
+        return result;
+    }
+
+    int nearOffset = NearChildOffset(node, ray);
+    int current = node.startIndex + nearOffset;
+    int sibling = node.startIndex + 1 - nearOffset;
+    bool isNearChild = true;
+
+    while(current >= 0) {
+        node = Nodes[nodeOffset + current];
+        COUNT_TRAVERSAL(x, 1);
+
+        // Boxes are tested against the closest hit so far
+        COUNT_TRAVERSAL(y, 1);
+        bool hitBox = RayBoundingBoxDst(ray, node.boundsMin, node.boundsMax) < result.dst;
+        if(hitBox && node.triangleCount <= 0) {
+            nearOffset = NearChildOffset(node, ray);
+            current = node.startIndex + nearOffset;
+            sibling = node.startIndex + 1 - nearOffset;
+            isNearChild = true;
+            continue;
+        }
+        if(hitBox)
+            RayTriangleLeaf(ray, node, triOffset, result);
+
+        // A finished near child continues with its sibling, a finished far child goes back up
+        if(isNearChild) {
+            current = sibling;
+            isNearChild = false;
+        }
+        else {
+            current = NextAfterFarChild(node, nodeOffset, ray);
+        }
+    }
+
+    FinishLeafHit(ray, triOffset, result);
+    return result;
+}
+
+// Any hit traversal, returns as soon as one triangle closer than rayLength is found.
+// Same walk as RayTriangleBVH, the near first order just tends to find an occluder sooner
+bool RayTriangleBVHOccluded(Ray ray, float rayLength, int nodeOffset, int triOffset) {
+    BVHNode node = Nodes[nodeOffset];
+    COUNT_TRAVERSAL(x, 1);
+    if(node.triangleCount > 0)
+        return RayTriangleLeafOccluded(ray, node, triOffset, rayLength);
+
+    int nearOffset = NearChildOffset(node, ray);
+    int current = node.startIndex + nearOffset;
+    int sibling = node.startIndex + 1 - nearOffset;
+    bool isNearChild = true;
+
+    while(current >= 0) {
+        node = Nodes[nodeOffset + current];
+        COUNT_TRAVERSAL(x, 1);
+
+        COUNT_TRAVERSAL(y, 1);
+        bool hitBox = RayBoundingBoxDst(ray, node.boundsMin, node.boundsMax) < rayLength;
+        if(hitBox && node.triangleCount <= 0) {
+            nearOffset = NearChildOffset(node, ray);
+            current = node.startIndex + nearOffset;
+            sibling = node.startIndex + 1 - nearOffset;
+            isNearChild = true;
+            continue;
+        }
+        if(hitBox && RayTriangleLeafOccluded(ray, node, triOffset, rayLength))
+            return true;
+
+        if(isNearChild) {
+            current = sibling;
+            isNearChild = false;
+        }
+        else {
+            current = NextAfterFarChild(node, nodeOffset, ray);
+        }
+    }
+
+    return false;
+}
+
+#else
+
+// Near/far traversal with a fixed stack, trees deeper than 31 levels overflow it (see BVHAnalysis)
 TriangleHitInfo RayTriangleBVH(inout Ray ray, float rayLength, int nodeOffset, int triOffset) {
     TriangleHitInfo result;
     result.didHit = false;
@@ -202,20 +853,10 @@ TriangleHitInfo RayTriangleBVH(inout Ray ray, float rayLength, int nodeOffset, i
         //     return result;
         
         BVHNode node = Nodes[nodeIdx];
+        COUNT_TRAVERSAL(x, 1);
 
         if(node.triangleCount > 0) {
-            for(int i = 0; i < node.triangleCount; ++i) {
-                // out of bounds check here pls
-                // if(triOffset + node.startIndex + i >= Triangles.length() || triOffset + node.startIndex + i < 0)
-                //     return result;
-                Triangle tri = Triangles[triOffset + node.startIndex + i];
-                TriangleHitInfo triHitInfo = RayTriangle(ray, tri);
-
-                if(triHitInfo.didHit && triHitInfo.dst < result.dst) {
-                    result = triHitInfo;
-                    result.triIndex = node.startIndex + i;
-                }
-            }
+            RayTriangleLeaf(ray, node, triOffset, result);
         } 
         else {
             int leftChildIndex = nodeOffset + node.startIndex + 0;
@@ -228,6 +869,7 @@ TriangleHitInfo RayTriangleBVH(inout Ray ray, float rayLength, int nodeOffset, i
 
             float dstLeft = RayBoundingBoxDst(ray, leftChild.boundsMin, leftChild.boundsMax);
             float dstRight = RayBoundingBoxDst(ray, rightChild.boundsMin, rightChild.boundsMax);
+            COUNT_TRAVERSAL(y, 2);
 
             bool isLeftNear = dstLeft <= dstRight;
             float dstNear = isLeftNear ? dstLeft : dstRight;
@@ -242,14 +884,145 @@ TriangleHitInfo RayTriangleBVH(inout Ray ray, float rayLength, int nodeOffset, i
         }
     }
 
+    FinishLeafHit(ray, triOffset, result);
     return result;
 }
 
+// Any hit traversal, returns as soon as one triangle closer than rayLength is found
+// Children don't need near/far ordering since we don't look for the closest hit
+bool RayTriangleBVHOccluded(Ray ray, float rayLength, int nodeOffset, int triOffset) {
+    int stack[32];
+    int stackIndex = 0;
+    stack[stackIndex++] = nodeOffset;
+
+    while(stackIndex > 0) {
+        BVHNode node = Nodes[stack[--stackIndex]];
+        COUNT_TRAVERSAL(x, 1);
+
+        if(node.triangleCount > 0) {
+            if(RayTriangleLeafOccluded(ray, node, triOffset, rayLength))
+                return true;
+        }
+        else {
+            int leftChildIndex = nodeOffset + node.startIndex + 0;
+            int rightChildIndex = nodeOffset + node.startIndex + 1;
+
+            BVHNode leftChild = Nodes[leftChildIndex];
+            BVHNode rightChild = Nodes[rightChildIndex];
+            COUNT_TRAVERSAL(y, 2);
+
+            if(RayBoundingBoxDst(ray, rightChild.boundsMin, rightChild.boundsMax) < rayLength) stack[stackIndex++] = rightChildIndex;
+            if(RayBoundingBoxDst(ray, leftChild.boundsMin, leftChild.boundsMax) < rayLength) stack[stackIndex++] = leftChildIndex;
+        }
+    }
+
+    return false;
+}
+
+#endif
+
+// Closest primitive closer than dst: planes one by one, then the primitive BVH.
+// Returns the primitive index or -1, dst is shortened to the hit
+int RayPrimitives(Ray ray, inout float dst) {
+    int hitIndex = -1;
+
+    for(int i = 0; i < uPlaneCount; ++i) {
+        float primDst = RayPrimitiveDst(ray, Primitives[i]);
+        if(primDst < dst) {
+            dst = primDst;
+            hitIndex = i;
+        }
+    }
+
+    if(uPrimitiveCount <= uPlaneCount)
+        return hitIndex;
+
+    // Unlike the model BVHs the root is tested too, the primitive scene is often small & far away
+    // splitPrimitiveBVH caps the depth at 30, so 32 entries can't overflow
+    int stack[32];
+    int stackIndex = 0;
+    if(RayBoundingBoxDst(ray, PrimitiveNodes[0].boundsMin, PrimitiveNodes[0].boundsMax) < dst)
+        stack[stackIndex++] = 0;
+
+    while(stackIndex > 0) {
+        BVHNode node = PrimitiveNodes[stack[--stackIndex]];
+
+        if(node.triangleCount > 0) {
+            for(int i = node.startIndex; i < node.startIndex + node.triangleCount; ++i) {
+                float primDst = RayPrimitiveDst(ray, Primitives[i]);
+                if(primDst < dst) {
+                    dst = primDst;
+                    hitIndex = i;
+                }
+            }
+        }
+        else {
+            int leftChildIndex = node.startIndex + 0;
+            int rightChildIndex = node.startIndex + 1;
+
+            float dstLeft = RayBoundingBoxDst(ray, PrimitiveNodes[leftChildIndex].boundsMin, PrimitiveNodes[leftChildIndex].boundsMax);
+            float dstRight = RayBoundingBoxDst(ray, PrimitiveNodes[rightChildIndex].boundsMin, PrimitiveNodes[rightChildIndex].boundsMax);
+
+            bool isLeftNear = dstLeft <= dstRight;
+            float dstNear = isLeftNear ? dstLeft : dstRight;
+            float dstFar = isLeftNear ? dstRight : dstLeft;
+            int childIndexNear = isLeftNear ? leftChildIndex : rightChildIndex;
+            int childIndexFar = isLeftNear ? rightChildIndex : leftChildIndex;
+
+            if(dstFar < dst) stack[stackIndex++] = childIndexFar;
+            if(dstNear < dst) stack[stackIndex++] = childIndexNear;
+        }
+    }
+
+    return hitIndex;
+}
+
+bool RayPrimitivesOccluded(Ray ray, float rayLength) {
+    for(int i = 0; i < uPlaneCount; ++i) {
+        if(RayPrimitiveDst(ray, Primitives[i]) < rayLength)
+            return true;
+    }
+
+    if(uPrimitiveCount <= uPlaneCount)
+        return false;
+
+    int stack[32];
+    int stackIndex = 0;
+    if(RayBoundingBoxDst(ray, PrimitiveNodes[0].boundsMin, PrimitiveNodes[0].boundsMax) < rayLength)
+        stack[stackIndex++] = 0;
+
+    while(stackIndex > 0) {
+        BVHNode node = PrimitiveNodes[stack[--stackIndex]];
+
+        if(node.triangleCount > 0) {
+            for(int i = node.startIndex; i < node.startIndex + node.triangleCount; ++i) {
+                if(RayPrimitiveDst(ray, Primitives[i]) < rayLength)
+                    return true;
+            }
+        }
+        else {
+            int leftChildIndex = node.startIndex + 0;
+            int rightChildIndex = node.startIndex + 1;
+
+            if(RayBoundingBoxDst(ray, PrimitiveNodes[rightChildIndex].boundsMin, PrimitiveNodes[rightChildIndex].boundsMax) < rayLength) stack[stackIndex++] = rightChildIndex;
+            if(RayBoundingBoxDst(ray, PrimitiveNodes[leftChildIndex].boundsMin, PrimitiveNodes[leftChildIndex].boundsMax) < rayLength) stack[stackIndex++] = leftChildIndex;
+        }
+    }
+
+    return false;
+}
+
 ModelHitInfo CalculateRayCollision(Ray worldRay) {
     ModelHitInfo result;
     result.didHit = false;
     result.dst = inf;
+    result.modelIndex = -1;
+    result.triIndex = -1;
+    result.barycentric = vec2(0.0);
+    result.uv = vec2(0.0);
+    result.uvDensity = 0.0;
     Ray localRay;
+    COUNT_TRAVERSAL(w, 1);
 
     int modelCount = ModelInfo.length();
 
@@ -269,28 +1042,186 @@ ModelHitInfo CalculateRayCollision(Ray worldRay) {
             result.dst = hit.dst;
             result.normal = normalize(model.localToWorldMat * vec4(hit.normal, 0.0)).xyz;
             result.hitPoint = worldRay.origin + worldRay.dir * hit.dst;
-            result.material = model.material;
+            result.modelIndex = i;
+            result.triIndex = hit.triIndex;
+            result.barycentric = hit.barycentric;
         }
 
     }
 
+    // Only the closest triangle's material & texture coordinates are fetched
+    if(result.didHit) {
+        Model model = ModelInfo[result.modelIndex];
+        Triangle tri = Triangles[model.triOffset + result.triIndex];
+        result.material = Materials[tri.materialIndex];
+        if(result.material.diffuseTexture >= 0)
+            TriangleTexCoords(tri, model.localToWorldMat, result.barycentric, result.uv, result.uvDensity);
+    }
+
+    // Analytic primitives are already in world space, only invDir is missing (Trace doesn't fill it)
+    Ray primitiveRay = worldRay;
+    primitiveRay.invDir = 1 / worldRay.dir;
+    float primitiveDst = result.dst;
+    int primitiveIndex = RayPrimitives(primitiveRay, primitiveDst);
+    if(primitiveIndex >= 0) {
+        Primitive prim = Primitives[primitiveIndex];
+        result.didHit = true;
+        result.dst = primitiveDst;
+        result.hitPoint = worldRay.origin + worldRay.dir * primitiveDst;
+        result.normal = PrimitiveNormal(prim, result.hitPoint);
+        result.material = prim.material;
+        result.modelIndex = -2 - primitiveIndex;
+        result.triIndex = -1;
+        result.barycentric = vec2(primitiveDst, 0.0);
+    }
+
     return result;
 }
 
+PrimaryHit MakePrimaryHit(ModelHitInfo hit) {
+    PrimaryHit cached;
+    cached.modelIndex = hit.didHit ? hit.modelIndex : -1;
+    cached.triIndex = hit.triIndex;
+    cached.barycentric = hit.barycentric;
+    return cached;
+}
+
+// Rebuilds the hit of the same camera ray without any traversal
+ModelHitInfo LoadPrimaryHit(PrimaryHit cached, Ray ray) {
+    ModelHitInfo result;
+    result.didHit = cached.modelIndex != -1;
+    result.dst = inf;
+    result.modelIndex = cached.modelIndex;
+    result.triIndex = cached.triIndex;
+    result.barycentric = cached.barycentric;
+    result.uv = vec2(0.0);
+    result.uvDensity = 0.0;
+
+    if(cached.modelIndex >= 0) {
+        Model model = ModelInfo[cached.modelIndex];
+        Triangle tri = Triangles[model.triOffset + cached.triIndex];
+        float u = cached.barycentric.x;
+        float v = cached.barycentric.y;
+        float w = 1 - u - v;
+
+        vec3 localPoint = w * tri.posA + u * tri.posB + v * tri.posC;
+        vec3 localNormal = normalize(w * tri.normA + u * tri.normB + v * tri.normC);
+        result.hitPoint = (model.localToWorldMat * vec4(localPoint, 1.0)).xyz;
+        result.normal = normalize(model.localToWorldMat * vec4(localNormal, 0.0)).xyz;
+        result.dst = dot(result.hitPoint - ray.origin, ray.dir);
+        result.material = Materials[tri.materialIndex];
+        if(result.material.diffuseTexture >= 0)
+            TriangleTexCoords(tri, model.localToWorldMat, cached.barycentric, result.uv, result.uvDensity);
+    }
+    else if(cached.modelIndex <= -2) {
+        Primitive prim = Primitives[-2 - cached.modelIndex];
+        result.dst = cached.barycentric.x;
+        result.hitPoint = ray.origin + ray.dir * result.dst;
+        result.normal = PrimitiveNormal(prim, result.hitPoint);
+        result.material = prim.material;
+    }
+
+    return result;
+}
+
+// True if anything blocks the ray before rayLength, for shadow & visibility rays
+bool IsOccluded(Ray worldRay, float rayLength) {
+    COUNT_TRAVERSAL(w, 1);
+    if(RayPrimitivesOccluded(worldRay, rayLength))
+        return true;
+
+    Ray localRay;
+    int modelCount = ModelInfo.length();
+
+    for(int i = 0; i < modelCount; ++i) {
+        Model model = ModelInfo[i];
+
+        // The local ray direction isn't normalized, so distances stay in world units
+        localRay.origin = (model.worldToLocalMat * vec4(worldRay.origin, 1.0)).xyz;
+        localRay.dir = (model.worldToLocalMat * vec4(worldRay.dir, 0.0)).xyz;
+        localRay.invDir = 1 / localRay.dir;
+
+        if(RayTriangleBVHOccluded(localRay, rayLength, model.nodeOffset, model.triOffset))
+            return true;
+    }
+
+    return false;
+}
+
+float Luminance(vec3 color) {
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Relative standard error of the pixel mean from its Welford state
+float RelativeError(vec4 varState) {
+    if(varState.z < 2.0)
+        return inf;
+    float varianceOfMean = varState.y / (varState.z - 1.0) / varState.z;
+    return sqrt(varianceOfMean) / (varState.x + 1e-3);
+}
+
+// World space corner A & edges of a light's triangle
+void EmissiveTriangle(Light light, out vec3 posA, out vec3 edgeAB, out vec3 edgeAC) {
+    mat4 localToWorld = ModelInfo[light.modelIndex].localToWorldMat;
+    Triangle tri = Triangles[light.triIndex];
+    posA = (localToWorld * vec4(tri.posA, 1.0)).xyz;
+    edgeAB = (localToWorld * vec4(tri.posB - tri.posA, 0.0)).xyz;
+    edgeAC = (localToWorld * vec4(tri.posC - tri.posA, 0.0)).xyz;
+}
+
+// Solid angle pdf of a light picked with probability & a uniform point on it at toLight: probability / area * dst^2 / cos,
+// with area = |cross| / 2 & cos = -dot(cross, toLight) / (|cross| * dst). Only the front emits, the back is culled by the
+// triangle tests so a bounce could never reach it
+float EmissivePdf(float probability, vec3 edgeAB, vec3 edgeAC, vec3 toLight) {
+    float dst2 = dot(toLight, toLight);
+    float projected = -dot(cross(edgeAB, edgeAC), toLight);
+    return projected > 0.0 ? 2.0 * probability * dst2 * sqrt(dst2) / projected : 0.0;
+}
+
+// Alias table: a uniform slot, then the slot's own light or its alias. The point folds the unit square onto the triangle
+vec3 SampleEmissiveLight(vec3 origin, float uLight, vec2 uPoint, out vec3 emission, out float pdf) {
+    float scaled = uLight * uLightCount;
+    int slot = min(int(scaled), uLightCount - 1);
+    Light light = Lights[scaled - slot < Lights[slot].aliasThreshold ? slot : Lights[slot].alias];
+
+    vec3 posA, edgeAB, edgeAC;
+    EmissiveTriangle(light, posA, edgeAB, edgeAC);
+    float su = sqrt(uPoint.x);
+    vec3 point = posA + edgeAB * (su * (1.0 - uPoint.y)) + edgeAC * (su * uPoint.y);
+
+    RayTracingMaterial material = Materials[Triangles[light.triIndex].materialIndex];
+    emission = material.emissionColor.rgb * material.emissionStrength;
+    pdf = EmissivePdf(light.probability, edgeAB, edgeAC, point - origin);
+    return point;
+}
+
 vec2 mod2(vec2 x, vec2 y) {
     return x - y * floor(x / y);
 }
 
-vec3 Trace(vec3 rayOrigin, vec3 rayDir, inout uint rngState) {
+// primaryHit is the hit of the camera ray (rayOrigin, rayDir), traced or from the primary hit cache
+// Also outputs the first hit features used by the denoiser, misses get the sky color as albedo, no normal & maxDist
+vec3 Trace(vec3 rayOrigin, vec3 rayDir, ModelHitInfo primaryHit, inout Sampler sampler, out vec4 firstHitAlbedoDepth, out vec3 firstHitNormal) {
     vec3 incomingLight = vec3(0.0);
     vec3 rayColor = vec3(1.0);
 
+    firstHitAlbedoDepth = vec4(1.0, 1.0, 1.0, maxDist);
+    firstHitNormal = vec3(0.0);
+
+    // Set when the last hit sampled the environment / the emissive triangles explicitly, what this ray escapes to / hits
+    // is then MIS weighted
+    bool sampledEnvironment = false;
+    bool sampledEmitters = false;
+    vec3 lastNormal = vec3(0.0);
+
+    // Texture LOD treats the whole path as one ray cone from the camera, spreading by a pixel's angle
+    float pixelSpread = viewParams.y / (viewParams.z * uResolution.y);
     float dstSum = 0.0;
     for(int bounceIndex = 0; bounceIndex <= maxBounces; ++bounceIndex) {
         Ray ray;
         ray.origin = rayOrigin;
         ray.dir = rayDir;
-        ModelHitInfo hitInfo = CalculateRayCollision(ray);
+        ModelHitInfo hitInfo = bounceIndex == 0 ? primaryHit : CalculateRayCollision(ray);
 
         if(hitInfo.didHit) {
             dstSum += hitInfo.dst;
@@ -301,33 +1232,125 @@ vec3 Trace(vec3 rayOrigin, vec3 rayDir, inout uint rngState) {
             if(material.flag == 1) 
             {
                 vec2 c = mod2(floor(hitInfo.hitPoint.xy), vec2(2.0));
-                material.color = (c.x == c.y) ? material.color : material.emissionColor;
+                material.color = (c.x == c.y) ? material.color : material.emissionColor.rgb;
+            }
+
+            // The cone's width at the hit, stretched by how slanted the surface is
+            if(material.diffuseTexture >= 0) {
+                float cosTheta = max(abs(dot(hitInfo.normal, rayDir)), 1e-3);
+                float uvFootprint = hitInfo.uvDensity + log2(dstSum * pixelSpread / cosTheta);
+                material.color *= SampleTexture(material.diffuseTexture, hitInfo.uv, uvFootprint);
+            }
+
+            // Albedo is the expected reflectance, so the specular lobe isn't divided out by the denoiser
+            if(bounceIndex == 0) {
+                firstHitAlbedoDepth = vec4(mix(material.color.rgb, material.specularColor.rgb, material.specularProbability), hitInfo.dst);
+                firstHitNormal = hitInfo.normal;
             }
 
             // Figure out new ray pos & dir
-            bool isSpecularBounce = material.specularProbability >= RandomValue(rngState);
+            bool isSpecularBounce = material.specularProbability >= SampleNext1D(sampler);
 
             rayOrigin = hitInfo.hitPoint;
-            vec3 diffuseDir = normalize(hitInfo.normal + RandomDirection(rngState));
+            vec3 diffuseDir = SampleCosineHemisphere(hitInfo.normal, SampleNext2D(sampler));
             vec3 specularDir = reflect(rayDir, hitInfo.normal);
 
             // Might cause problem, bool implicit conv to int
             rayDir = normalize(mix(diffuseDir, specularDir, material.smoothness * float(isSpecularBounce)));
 
-            // Update light calculation
+            // Update light calculation, an emitter the last hit sampled only adds the bounce's MIS share
             vec3 emittedLight = material.emissionColor.rgb * material.emissionStrength;
-            incomingLight += emittedLight * rayColor;
+            float emissionWeight = 1.0;
+            if(sampledEmitters && hitInfo.modelIndex >= 0) {
+                int lightIndex = Triangles[ModelInfo[hitInfo.modelIndex].triOffset + hitInfo.triIndex].lightIndex;
+                if(lightIndex >= 0) {
+                    vec3 posA, edgeAB, edgeAC;
+                    EmissiveTriangle(Lights[lightIndex], posA, edgeAB, edgeAC);
+                    float lightPdf = EmissivePdf(Lights[lightIndex].probability, edgeAB, edgeAC, hitInfo.hitPoint - ray.origin);
+                    emissionWeight = PowerHeuristic(max(0.0, dot(lastNormal, ray.dir)) / PI, lightPdf);
+                }
+            }
+            incomingLight += emittedLight * emissionWeight * rayColor;
+
+            // Next event estimation toward the environment map's bright texels, or the sun for the procedural sky. Only for
+            // diffuse bounces whose continuation is still traced (the diffuse bounce is cosine distributed, so the BRDF is
+            // color / PI & its pdf is cos / PI)
+            sampledEnvironment = uSunSampling != 0 && !isSpecularBounce && bounceIndex < maxBounces;
+            lastNormal = hitInfo.normal;
+            if(sampledEnvironment) {
+                vec3 lightDir;
+                float lightPdf;
+                if(uEnvironmentWidth > 0)
+                    lightDir = SampleEnvironmentDirection(SampleNext2D(sampler), lightPdf);
+                else {
+                    lightDir = SampleSunDirection(SampleNext2D(sampler));
+                    lightPdf = lightDir.y >= 0.0 ? SunPdf(lightDir) : 0.0;
+                }
+                float cosTheta = dot(hitInfo.normal, lightDir);
+
+                if(cosTheta > 0.0 && lightPdf > 0.0) {
+                    Ray shadowRay;
+                    shadowRay.origin = hitInfo.hitPoint;
+                    shadowRay.dir = lightDir;
+                    shadowRay.invDir = 1 / lightDir;
+
+                    if(!IsOccluded(shadowRay, inf)) {
+                        float weight = PowerHeuristic(lightPdf, cosTheta / PI);
+                        vec3 light = uEnvironmentWidth > 0 ? EnvironmentRadiance(lightDir) : GetSunLight(lightDir);
+                        incomingLight += light * material.color.rgb * (cosTheta / PI / lightPdf * weight) * rayColor;
+                    }
+                }
+            }
+
+            // Same toward one point on one emissive triangle, the shadow ray stops just short of it
+            sampledEmitters = uLightSampling != 0 && uLightCount > 0 && !isSpecularBounce && bounceIndex < maxBounces;
+            if(sampledEmitters) {
+                float uLight = SampleNext1D(sampler);
+                vec2 uPoint = SampleNext2D(sampler);
+                vec3 emission;
+                float lightPdf;
+                vec3 toLight = SampleEmissiveLight(hitInfo.hitPoint, uLight, uPoint, emission, lightPdf) - hitInfo.hitPoint;
+                float lightDst = length(toLight);
+                vec3 lightDir = toLight / lightDst;
+                float cosTheta = dot(hitInfo.normal, lightDir);
+
+                if(cosTheta > 0.0 && lightPdf > 0.0) {
+                    Ray shadowRay;
+                    shadowRay.origin = hitInfo.hitPoint;
+                    shadowRay.dir = lightDir;
+                    shadowRay.invDir = 1 / lightDir;
+
+                    if(!IsOccluded(shadowRay, lightDst * (1.0 - 1e-4))) {
+                        float weight = PowerHeuristic(lightPdf, cosTheta / PI);
+                        incomingLight += emission * material.color.rgb * (cosTheta / PI / lightPdf * weight) * rayColor;
+                    }
+                }
+            }
+
             // This too might cause problem, bool conv. to int
-            rayColor *= mix(material.color, material.specularColor, isSpecularBounce).rgb;
+            rayColor *= mix(material.color, material.specularColor.rgb, bvec3(isSpecularBounce));
 
             // Random early exit if rayColor is nearly 0 (no contrib. to final color anyways)
             float p = max(rayColor.r, max(rayColor.g, rayColor.b));
-            if(RandomValue(rngState) >= p) {
+            if(SampleNext1D(sampler) >= p) {
                 break;
             }
             rayColor *= 1.0 / p;
         } else {
-            incomingLight += GetEnvironmentLight(rayDir) * rayColor;
+            // The light was sampled at the last hit, only add the bounce's MIS share of it
+            float bouncePdf = max(0.0, dot(lastNormal, rayDir)) / PI;
+            if(uEnvironmentWidth > 0) {
+                vec3 light = EnvironmentRadiance(rayDir);
+                if(bounceIndex == 0)
+                    firstHitAlbedoDepth.rgb = clamp(light, 0.0, 1.0);
+                float weight = sampledEnvironment ? PowerHeuristic(bouncePdf, EnvironmentPdf(rayDir)) : 1.0;
+                incomingLight += light * weight * rayColor;
+            } else {
+                if(bounceIndex == 0)
+                    firstHitAlbedoDepth.rgb = clamp(GetEnvironmentLight(rayDir), 0.0, 1.0);
+                float sunWeight = sampledEnvironment ? PowerHeuristic(bouncePdf, SunPdf(rayDir)) : 1.0;
+                incomingLight += (GetSkyLight(rayDir) + GetSunLight(rayDir) * sunWeight) * rayColor;
+            }
             break;
         }
     }
@@ -336,16 +1359,22 @@ vec3 Trace(vec3 rayOrigin, vec3 rayDir, inout uint rngState) {
 }
 
 // BIG ASSUMPTION: I am assuming the i.uv in seb's code is from 0.0, 0.0(bot-left) to 1.0, 1.0(top-right)
-void main() {
-    // Local Thread ID
-    uint localThreadID = gl_LocalInvocationID.x;
-
-    ivec2 pixelCoord = ivec2(gl_WorkGroupID.xy);
-    int pixelIndex = pixelCoord.x + pixelCoord.y * int(uResolution.x);
+// Traces one sample of a pixel. sampleIndex is the sample's index in the pixel's sequence, threadSeed decorrelates
+// the independent sampler between samples of the same dispatch
+vec3 TracePixelSample(ivec2 pixelCoord, int pixelIndex, uint sampleIndex, uint threadSeed, uint cachedSamples,
+                      out vec4 firstHitAlbedoDepth, out vec3 firstHitNormal) {
     vec2 uv = vec2(pixelCoord) / uResolution; 
 
-    // Create a rngState
-    uint rngState = pixelIndex + uFrame * 719393 + localThreadID * 16943;
+    // Create a rngState, the low discrepancy sampler continues the pixel's sequence instead
+    uint rngState = pixelIndex + uFrame * 719393 + threadSeed * 16943;
+
+    // With the primary hit cache the camera ray must be reproducible, so it is sampled from the cache slot
+    // instead of the sample index, the bounces still continue the pixel's sequence
+    bool usePrimaryCache = uPrimaryCacheSamples > 0;
+    uint cacheSlot = usePrimaryCache ? sampleIndex % uint(uPrimaryCacheSamples) : 0u;
+    Sampler sampler = usePrimaryCache
+        ? CreateSampler(uSamplerType, pixelCoord, cacheSlot, uint(pixelIndex) * 9781u + cacheSlot * 16943u)
+        : CreateSampler(uSamplerType, pixelCoord, sampleIndex, rngState);
 
     // Calculate focal point
     vec3 focusPointLocal = vec3(uv - vec2(0.5), 1.0) * viewParams;
@@ -357,34 +1386,219 @@ void main() {
     vec3 camRight = CamLocalToWorldMatrix[0].xyz; // Column 0
     vec3 camUp = CamLocalToWorldMatrix[1].xyz; // Column 1
 
-    // Trace multiple rays and average together (done at last)
-    // Here, I have 32 threads running for each pixel, & 1 ray per thread
-    // So we will have overall 32 rays per pixel
-    
     // Calculate ray origin and direction
-    vec2 defocusJitter = RandomPointInCircle(rngState) * DefocusStrength / uResolution.x;
+    vec2 defocusJitter = SampleDisk(SampleNext2D(sampler)) * DefocusStrength / uResolution.x;
     vec3 rayOrigin = _WorldSpaceCameraPos + camRight * defocusJitter.x + camUp * defocusJitter.y;
     
     // Jitter the focus point when calculating the ray direction to allow for blurring the image
     // (at low strengths, this can be used for anti-aliasing)
-    vec2 jitter = RandomPointInCircle(rngState) * DivergeStrength / uResolution.x;
+    vec2 jitter = SampleDisk(SampleNext2D(sampler)) * DivergeStrength / uResolution.x;
     vec3 jitteredFocusPoint = focusPoint + camRight * jitter.x + camUp * jitter.y;
     vec3 rayDir = normalize(jitteredFocusPoint - rayOrigin);
 
-    // Trace the ray
-    ccontrib[localThreadID] = Trace(rayOrigin, rayDir, rngState);
+    if(usePrimaryCache) {
+        sampler.index = sampleIndex;
+        sampler.rngState = rngState;
+    }
+
+    Ray cameraRay;
+    cameraRay.origin = rayOrigin;
+    cameraRay.dir = rayDir;
+
+    // The first uPrimaryCacheSamples samples of a pixel fill its slots, the cache restarts with accumulation.
+    // cachedSamples is how many slots are known to be written & visible to this invocation
+    ModelHitInfo primaryHit;
+    uint cacheIndex = uint(pixelIndex) * uint(max(uPrimaryCacheSamples, 1)) + cacheSlot;
+    if(usePrimaryCache && cachedSamples >= uint(uPrimaryCacheSamples)) {
+        primaryHit = LoadPrimaryHit(PrimaryHits[cacheIndex], cameraRay);
+    }
+    else {
+        primaryHit = CalculateRayCollision(cameraRay);
+        if(usePrimaryCache && sampleIndex < uint(uPrimaryCacheSamples))
+            PrimaryHits[cacheIndex] = MakePrimaryHit(primaryHit);
+    }
+
+    return Trace(rayOrigin, rayDir, primaryHit, sampler, firstHitAlbedoDepth, firstHitNormal);
+}
+
+// Welford update of the luminance mean & variance
+void AddVarianceSample(inout vec4 varState, vec3 contrib) {
+    float x = Luminance(contrib);
+    varState.z += 1.0;
+    float delta = x - varState.x;
+    varState.x += delta / varState.z;
+    varState.y += delta * (x - varState.x);
+}
+
+// Adds this frame's RAYS_PER_PIXEL samples of a pixel to the accumulation & feature images
+void StorePixel(ivec2 pixelCoord, vec4 varState, vec3 val, vec4 albedoDepth, vec3 normal) {
+    // Add this frame's samples to the running sum & output the average so far
+    vec4 accum = uAccumFrame > 0 ? imageLoad(accumImage, pixelCoord) : vec4(0.0);
+    accum += vec4(val, float(RAYS_PER_PIXEL));
+    imageStore(accumImage, pixelCoord, accum);
+    imageStore(outputImage, pixelCoord, vec4(accum.rgb / accum.a, 1.0));
+
+    // Features are summed like radiance, divide by accum.a to get the average
+    if(uAccumFrame > 0) {
+        albedoDepth += imageLoad(albedoDepthImage, pixelCoord);
+        normal += imageLoad(normalImage, pixelCoord).xyz;
+    }
+    imageStore(albedoDepthImage, pixelCoord, albedoDepth);
+    imageStore(normalImage, pixelCoord, vec4(normal, 0.0));
+
+    varState.w = float(varState.z >= float(uAdaptiveMinSamples) && RelativeError(varState) < uAdaptiveThreshold);
+    imageStore(varianceImage, pixelCoord, varState);
+}
+
+#ifdef TRAVERSAL_STATS
+// Adds this frame's traversal cost of a pixel to its running sum
+void StoreTraversalCost(ivec2 pixelCoord, vec4 cost) {
+    if(uAccumFrame > 0)
+        cost += imageLoad(traversalCostImage, pixelCoord);
+    imageStore(traversalCostImage, pixelCoord, cost);
+}
+#endif
+
+// Every pixel reports its error so the cpu can check the global noise target, fixed point (x1000, up to 10000)
+// pixels below the minimum sample count have no reliable estimate yet, so count them as very noisy
+uint PixelError(vec4 varState) {
+    float pixelError = varState.z < float(uAdaptiveMinSamples) ? 10.0 : min(RelativeError(varState), 10.0);
+    return uint(pixelError * 1000.0);
+}
+
+// Adds counters of one or more pixels to AdaptiveStatsBuffer. Only while adaptive sampling is on, nothing clears them otherwise
+void AddAdaptiveStats(uint activeCount, uint tracedCount, uint errorSum) {
+    if(activeCount > 0u)
+        atomicAdd(activePixels, activeCount);
+    if(tracedCount > 0u)
+        atomicAdd(tracedPixels, tracedCount);
+    // The sum overflows 32 bits above ~430k pixels, every add that wraps the low word carries into the high one
+    uint previous = atomicAdd(relativeErrorSumLow, errorSum);
+    if(previous + errorSum < previous)
+        atomicAdd(relativeErrorSumHigh, 1u);
+}
+
+#if TILE_SIZE > 0
+
+// Tile dispatch: neighbouring pixels share a workgroup, so their rays stay coherent & only the counters are reduced
+void main() {
+    ivec2 pixelCoord = ivec2(gl_GlobalInvocationID.xy);
+    int pixelIndex = pixelCoord.x + pixelCoord.y * int(uResolution.x);
+    // Pixels past the edge still reach the barriers, uAdaptiveSampling keeps them in uniform control flow
+    bool inside = all(lessThan(pixelCoord, ivec2(uResolution)));
+
+    if(uAdaptiveSampling != 0) {
+        if(gl_LocalInvocationIndex == 0u) {
+            cActivePixels = 0u;
+            cTracedPixels = 0u;
+            cErrorSum = 0u;
+        }
+        barrier();
+    }
+
+    vec4 varState = uAccumFrame > 0 && inside ? imageLoad(varianceImage, pixelCoord) : vec4(0.0);
+    bool converged = uAdaptiveSampling != 0 && varState.w > 0.5;
+
+    if(inside && !converged) {
+        vec3 val = vec3(0.0);
+        vec4 albedoDepth = vec4(0.0);
+        vec3 normal = vec3(0.0);
+
+        for(int i = 0; i < RAYS_PER_PIXEL; i++) {
+            // Samples run in order in this thread, so every earlier cache slot is already written
+            uint sampleIndex = uint(varState.z);
+            vec4 firstHitAlbedoDepth;
+            vec3 firstHitNormal;
+            vec3 contrib = TracePixelSample(pixelCoord, pixelIndex, sampleIndex, uint(i), sampleIndex,
+                                            firstHitAlbedoDepth, firstHitNormal);
+            val += contrib;
+            albedoDepth += firstHitAlbedoDepth;
+            normal += firstHitNormal;
+            AddVarianceSample(varState, contrib);
+        }
+
+        StorePixel(pixelCoord, varState, val, albedoDepth, normal);
+#ifdef TRAVERSAL_STATS
+        StoreTraversalCost(pixelCoord, traversalCost);
+#endif
+    }
+
+    // Shared atomics per pixel, then a single invocation per tile touches the global counters
+    if(uAdaptiveSampling != 0) {
+        if(inside) {
+            if(!converged)
+                atomicAdd(cTracedPixels, 1u);
+            if(varState.w < 0.5)
+                atomicAdd(cActivePixels, 1u);
+            atomicAdd(cErrorSum, PixelError(varState));
+        }
+        barrier();
+        if(gl_LocalInvocationIndex == 0u)
+            AddAdaptiveStats(cActivePixels, cTracedPixels, cErrorSum);
+    }
+}
+
+#else
+
+void main() {
+    // Local Thread ID
+    uint localThreadID = gl_LocalInvocationID.x;
+
+    ivec2 pixelCoord = ivec2(gl_WorkGroupID.xy);
+    int pixelIndex = pixelCoord.x + pixelCoord.y * int(uResolution.x);
+
+    // Converged pixels are skipped by the whole workgroup, the barrier stays in uniform control flow
+    vec4 varState = uAccumFrame > 0 ? imageLoad(varianceImage, pixelCoord) : vec4(0.0);
+    bool converged = uAdaptiveSampling != 0 && varState.w > 0.5;
+
+    // Trace multiple rays and average together (done at last)
+    // Here, I have 32 threads running for each pixel, & 1 ray per thread
+    // So we will have overall 32 rays per pixel
+    vec4 firstHitAlbedoDepth = vec4(0.0);
+    vec3 firstHitNormal = vec3(0.0);
+    vec3 contrib = vec3(0.0);
+    if(!converged) {
+        // Slots are only read from frames after the one that filled them, so there is no race inside the workgroup
+        uint sampleIndex = uint(varState.z) + localThreadID;
+        contrib = TracePixelSample(pixelCoord, pixelIndex, sampleIndex, localThreadID, uint(varState.z),
+                                   firstHitAlbedoDepth, firstHitNormal);
+    }
+    ccontrib[localThreadID] = contrib;
+    cAlbedoDepth[localThreadID] = firstHitAlbedoDepth;
+    cNormal[localThreadID] = firstHitNormal;
+#ifdef TRAVERSAL_STATS
+    cTraversalCost[localThreadID] = traversalCost;
+#endif
     
     barrier(); // Synchronize threads in the workgroup
 
     //Only thread - 0 writes the final value
     if(localThreadID == 0) { 
-        vec3 val = vec3(0.0);
+        if(!converged) {
+            vec3 val = vec3(0.0);
+            vec4 albedoDepth = vec4(0.0);
+            vec3 normal = vec3(0.0);
+
+            //#pragma optionNV(unroll all)
+            for(int i = 0; i < RAYS_PER_PIXEL; i++) {
+                val += ccontrib[i];
+                albedoDepth += cAlbedoDepth[i];
+                normal += cNormal[i];
+                AddVarianceSample(varState, ccontrib[i]);
+            }
 
-        //#pragma optionNV(unroll all)
-        for(int i = 0; i < RAYS_PER_PIXEL; i++)
-            val += ccontrib[i];
-        
-        val /= float(RAYS_PER_PIXEL); // Average contribution
-        imageStore(outputImage, pixelCoord, vec4(val, 1.0));
+            StorePixel(pixelCoord, varState, val, albedoDepth, normal);
+#ifdef TRAVERSAL_STATS
+            vec4 cost = vec4(0.0);
+            for(int i = 0; i < RAYS_PER_PIXEL; i++)
+                cost += cTraversalCost[i];
+            StoreTraversalCost(pixelCoord, cost);
+#endif
+        }
+
+        if(uAdaptiveSampling != 0)
+            AddAdaptiveStats(varState.w < 0.5 ? 1u : 0u, converged ? 0u : 1u, PixelError(varState));
     }
-}
\ No newline at end of file
+}
+
+#endif
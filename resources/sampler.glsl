@@ -0,0 +1,113 @@
+#version 440
+
+// Sampler Functions, include after rng.glsl
+// A Sampler hands out the random numbers of one path, either independent PCG values or
+// padded 2D Owen scrambled Sobol points (Burley 2020, "Practical Hash-based Owen Scrambling").
+// The Sobol points are shared by all pixels and decorrelated per pixel with a blue noise like toroidal shift.
+#define SAMPLER_INDEPENDENT 0
+#define SAMPLER_SOBOL 1
+
+struct Sampler {
+    int type;
+    uint rngState;   // PCG state, only used by the independent sampler
+    uint index;      // sample index in the pixel's sequence
+    uint dimension;  // next 2D dimension pair
+    vec2 shift;      // per pixel toroidal shift
+};
+
+uint PcgHash(uint v) {
+    uint state = v * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+uint HashCombine(uint seed, uint v) {
+    return seed ^ (v + (seed << 6u) + (seed >> 2u));
+}
+
+// Hash based Owen scramble of reversed bits, each bit only depends on the bits below it
+uint LaineKarrasPermutation(uint x, uint seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+uint NestedUniformScramble(uint x, uint seed) {
+    return bitfieldReverse(LaineKarrasPermutation(bitfieldReverse(x), seed));
+}
+
+// Second Sobol dimension, the first one is just bitfieldReverse(index)
+uint SobolDimension1(uint index) {
+    uint result = 0u;
+    for(uint v = 1u << 31; index != 0u; index >>= 1, v ^= v >> 1) {
+        if((index & 1u) != 0u)
+            result ^= v;
+    }
+    return result;
+}
+
+// Keeps the top 24 bits so the float never rounds up to 1
+float ToUnitFloat(uint x) {
+    return float(x >> 8) * (1.0 / 16777216.0);
+}
+
+// sampleIndex is the number of samples the pixel already took, rngState seeds the independent sampler
+Sampler CreateSampler(int type, ivec2 pixel, uint sampleIndex, uint rngState) {
+    Sampler sampler;
+    sampler.type = type;
+    sampler.rngState = rngState;
+    sampler.index = sampleIndex;
+    sampler.dimension = 0u;
+
+    // R2 & interleaved gradient noise dither masks, both have most of their energy at high frequencies
+    vec2 p = vec2(pixel);
+    sampler.shift = vec2(
+        fract(0.7548776662 * p.x + 0.5698402909 * p.y),
+        fract(52.9829189 * fract(0.06711056 * p.x + 0.00583715 * p.y)));
+    return sampler;
+}
+
+// Values in [0, 1). Every call uses a new dimension, draw 2D values together when they belong together
+vec2 SampleNext2D(inout Sampler sampler) {
+    if(sampler.type == SAMPLER_INDEPENDENT)
+        return vec2(RandomValue(sampler.rngState), RandomValue(sampler.rngState));
+
+    uint dimension = sampler.dimension++;
+    uint seed = PcgHash(dimension);
+
+    // Shuffle the index so dimension pairs aren't correlated, then scramble both coordinates
+    uint index = NestedUniformScramble(sampler.index, seed);
+    vec2 u = vec2(
+        ToUnitFloat(NestedUniformScramble(bitfieldReverse(index), HashCombine(seed, 0u))),
+        ToUnitFloat(NestedUniformScramble(SobolDimension1(index), HashCombine(seed, 1u))));
+
+    // Per pixel shift, offset along the R2 sequence for every dimension
+    vec2 shift = sampler.shift + float(dimension) * vec2(0.7548776662, 0.5698402909);
+    u += shift - floor(shift);
+    return u - floor(u);
+}
+
+float SampleNext1D(inout Sampler sampler) {
+    if(sampler.type == SAMPLER_INDEPENDENT)
+        return RandomValue(sampler.rngState);
+    return SampleNext2D(sampler).x;
+}
+
+// Warps from [0, 1)^2
+vec2 SampleDisk(vec2 u) {
+    float angle = u.x * 2 * PI;
+    return vec2(cos(angle), sin(angle)) * sqrt(u.y);
+}
+
+// Cosine weighted direction around normal (pdf = cos / PI): normal + a uniform point on the unit sphere
+// One sqrt & one sin/cos pair instead of 3 Box-Muller normals
+vec3 SampleCosineHemisphere(vec3 normal, vec2 u) {
+    float z = 1.0 - 2.0 * u.x;
+    float r = sqrt(max(0.0, 1.0 - z * z));
+    float phi = 2.0 * PI * u.y;
+    vec3 spherePoint = vec3(r * cos(phi), r * sin(phi), z);
+    return normalize(normal + spherePoint);
+}
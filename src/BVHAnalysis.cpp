@@ -0,0 +1,192 @@
+#include "BVHAnalysis.h"
+
+#include <algorithm>
+#include <cstdio>
+
+static float surfaceArea(const glm::vec3& boxMin, const glm::vec3& boxMax) {
+	glm::vec3 size = glm::max(boxMax - boxMin, glm::vec3(0.0f));
+	return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+static float polygonArea(const std::vector<glm::vec3>& polygon) {
+	glm::vec3 sum = glm::vec3(0.0f);
+	for (size_t i = 2; i < polygon.size(); ++i)
+		sum += glm::cross(polygon[i - 1] - polygon[0], polygon[i] - polygon[0]);
+	return 0.5f * glm::length(sum);
+}
+
+// Area of the part of a triangle inside a box, Sutherland-Hodgman against the 6 box planes
+static float clippedTriangleArea(const Triangle& tri, const glm::vec3& boxMin, const glm::vec3& boxMax) {
+	std::vector<glm::vec3> polygon = { tri.posA, tri.posB, tri.posC };
+	std::vector<glm::vec3> clipped;
+
+	for (int plane = 0; plane < 6 && !polygon.empty(); ++plane) {
+		int axis = plane % 3;
+		bool isMax = plane >= 3;
+		float bound = isMax ? boxMax[axis] : boxMin[axis];
+		auto inside = [&](const glm::vec3& p) { return isMax ? p[axis] <= bound : p[axis] >= bound; };
+
+		clipped.clear();
+		for (size_t i = 0; i < polygon.size(); ++i) {
+			const glm::vec3& current = polygon[i];
+			const glm::vec3& next = polygon[(i + 1) % polygon.size()];
+			if (inside(current))
+				clipped.push_back(current);
+			if (inside(current) != inside(next)) {
+				float t = (bound - current[axis]) / (next[axis] - current[axis]);
+				clipped.push_back(glm::mix(current, next, t));
+			}
+		}
+		polygon.swap(clipped);
+	}
+
+	return polygon.size() < 3 ? 0.0f : polygonArea(polygon);
+}
+
+namespace {
+
+struct NodeInfo {
+	int firstLeaf;      // leaves of the subtree are [firstLeaf, firstLeaf + leafCount) in depth first order
+	int leafCount;
+	int triangleCount;
+	float cost;         // cost of testing the node, BVH_TRAVERSAL_COST or BVH_TRIANGLE_COST per triangle
+};
+
+struct Analysis {
+	const std::vector<BVHNode>& nodes;
+	int nodeOffset;
+	BVHQualityReport& report;
+	std::vector<NodeInfo> info;         // by relative node index
+	std::vector<int> triangleLeaf;      // depth first number of the leaf holding each triangle (relative index)
+	double leafDepthSum = 0.0;
+	double sahSum = 0.0;
+
+	// Post order, leaves are numbered as they are reached so every subtree covers a contiguous range of them.
+	// Its triangles don't have to be contiguous, OptimizeBVH regroups leaves
+	void visit(int relativeIndex, int depth) {
+		const BVHNode& node = nodes[nodeOffset + relativeIndex];
+		if ((int)info.size() <= relativeIndex)
+			info.resize(relativeIndex + 1);
+		float area = surfaceArea(node.boundsMin, node.boundsMax);
+		report.nodeCount++;
+
+		if (node.triangleCount > 0) {
+			info[relativeIndex] = { report.leafCount, 1, node.triangleCount, BVH_TRIANGLE_COST * node.triangleCount };
+			if ((int)triangleLeaf.size() < node.startIndex + node.triangleCount)
+				triangleLeaf.resize(node.startIndex + node.triangleCount, -1);
+			std::fill(triangleLeaf.begin() + node.startIndex, triangleLeaf.begin() + node.startIndex + node.triangleCount, report.leafCount);
+			report.leafCount++;
+			report.maxDepth = std::max(report.maxDepth, depth);
+			report.maxLeafTriangles = std::max(report.maxLeafTriangles, node.triangleCount);
+			leafDepthSum += depth;
+
+			int bin = 0;
+			while ((1 << bin) < node.triangleCount)
+				bin++;
+			if ((int)report.leafSizeHistogram.size() <= bin)
+				report.leafSizeHistogram.resize(bin + 1, 0);
+			report.leafSizeHistogram[bin]++;
+		}
+		else {
+			visit(node.startIndex + 0, depth + 1);
+			visit(node.startIndex + 1, depth + 1);
+			const NodeInfo& left = info[node.startIndex + 0];
+			const NodeInfo& right = info[node.startIndex + 1];
+			info[relativeIndex] = { left.firstLeaf, left.leafCount + right.leafCount, left.triangleCount + right.triangleCount, BVH_TRAVERSAL_COST };
+		}
+
+		sahSum += info[relativeIndex].cost * area;
+	}
+};
+
+}
+
+BVHQualityReport AnalyzeBVH(const std::vector<BVHNode>& nodes, int nodeOffset, const std::vector<Triangle>& triangles, int triOffset) {
+	BVHQualityReport report;
+	if (nodeOffset < 0 || nodeOffset >= (int)nodes.size())
+		return report;
+
+	Analysis analysis = { nodes, nodeOffset, report, {}, {} };
+	analysis.visit(0, 0);
+
+	const BVHNode& root = nodes[nodeOffset];
+	float rootArea = surfaceArea(root.boundsMin, root.boundsMax);
+	const NodeInfo& rootInfo = analysis.info[0];
+	report.triangleCount = rootInfo.triangleCount;
+	report.averageLeafDepth = (float)(analysis.leafDepthSum / report.leafCount);
+	report.averageLeafTriangles = (float)report.triangleCount / report.leafCount;
+	report.sahCost = rootArea > 0 ? (float)(analysis.sahSum / rootArea) : 0.0f;
+	report.requiredStackSize = report.maxDepth + 1;
+	report.exceedsStack = report.requiredStackSize > BVH_TRAVERSAL_STACK_SIZE;
+
+	// EPO: cost weighted area of every triangle inside nodes that don't contain it, over the total triangle area.
+	// Every triangle walks the nodes its bounds overlap, a node outside its subtree stays outside for all descendants
+	double overlapSum = 0.0;
+	double triangleAreaSum = 0.0;
+	std::vector<int> stack;
+	for (int t = 0; t < (int)analysis.triangleLeaf.size(); ++t) {
+		int leaf = analysis.triangleLeaf[t];
+		if (leaf < 0)
+			continue;
+		const Triangle& tri = triangles[triOffset + t];
+		glm::vec3 triMin = glm::min(tri.posA, glm::min(tri.posB, tri.posC));
+		glm::vec3 triMax = glm::max(tri.posA, glm::max(tri.posB, tri.posC));
+		triangleAreaSum += 0.5f * glm::length(glm::cross(tri.posB - tri.posA, tri.posC - tri.posA));
+
+		stack.assign(1, 0);
+		while (!stack.empty()) {
+			int relativeIndex = stack.back();
+			stack.pop_back();
+			const BVHNode& node = nodes[nodeOffset + relativeIndex];
+			if (glm::any(glm::lessThan(node.boundsMax, triMin)) || glm::any(glm::greaterThan(node.boundsMin, triMax)))
+				continue;
+
+			const NodeInfo& nodeInfo = analysis.info[relativeIndex];
+			if (leaf < nodeInfo.firstLeaf || leaf >= nodeInfo.firstLeaf + nodeInfo.leafCount) {
+				float area = clippedTriangleArea(tri, node.boundsMin, node.boundsMax);
+				if (area <= 0)
+					continue; // only the bounds touch, so none of the children overlap the triangle either
+				overlapSum += nodeInfo.cost * area;
+			}
+
+			if (node.triangleCount <= 0) {
+				stack.push_back(node.startIndex + 0);
+				stack.push_back(node.startIndex + 1);
+			}
+		}
+	}
+	report.epo = triangleAreaSum > 0 ? (float)(overlapSum / triangleAreaSum) : 0.0f;
+
+	return report;
+}
+
+std::string FormatBVHQualityReport(const BVHQualityReport& report) {
+	std::string text;
+	char line[256];
+
+	snprintf(line, sizeof(line), "BVH: %d nodes, %d leaves, %d triangles | SAH %.2f | EPO %.3f\n",
+		report.nodeCount, report.leafCount, report.triangleCount, report.sahCost, report.epo);
+	text += line;
+	snprintf(line, sizeof(line), "  depth: max %d avg %.1f | leaf triangles: max %d avg %.1f\n",
+		report.maxDepth, report.averageLeafDepth, report.maxLeafTriangles, report.averageLeafTriangles);
+	text += line;
+
+	text += "  leaf sizes:";
+	for (size_t bin = 0; bin < report.leafSizeHistogram.size(); ++bin) {
+		int low = bin == 0 ? 1 : (1 << (bin - 1)) + 1;
+		int high = 1 << bin;
+		if (low == high)
+			snprintf(line, sizeof(line), " [%d] %d", low, report.leafSizeHistogram[bin]);
+		else
+			snprintf(line, sizeof(line), " [%d-%d] %d", low, high, report.leafSizeHistogram[bin]);
+		text += line;
+	}
+	text += "\n";
+
+	if (report.exceedsStack) {
+		snprintf(line, sizeof(line), "  WARNING: stack traversal needs %d entries, it only has %d (the stackless default is fine)\n",
+			report.requiredStackSize, BVH_TRAVERSAL_STACK_SIZE);
+		text += line;
+	}
+	return text;
+}
@@ -0,0 +1,176 @@
+#include "BVHLayout.h"
+
+#include <algorithm>
+#include <cassert>
+
+static const char* layoutNames[BVH_LAYOUT_COUNT] = { "build", "depth-first", "veb", "treelet" };
+
+const char* GetBVHLayoutName(BVHLayout layout) {
+	int index = (int)layout;
+	return index >= 0 && index < BVH_LAYOUT_COUNT ? layoutNames[index] : "?";
+}
+
+bool ParseBVHLayout(const std::string& name, BVHLayout& layout) {
+	for (int i = 0; i < BVH_LAYOUT_COUNT; ++i) {
+		if (name == layoutNames[i]) {
+			layout = (BVHLayout)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static float surfaceArea(const BVHNode& node) {
+	glm::vec3 size = glm::max(node.boundsMax - node.boundsMin, glm::vec3(0.0f));
+	return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+namespace {
+
+// A unit is the root (first == 0, size 1) or the sibling pair starting at first. Indices are relative to nodeOffset
+struct Layout {
+	const BVHNode* nodes;
+	std::vector<int> order;             // relative indices in their new order
+
+	int unitSize(int first) const { return first == 0 ? 1 : 2; }
+
+	bool isInner(int index) const { return nodes[index].triangleCount <= 0; }
+
+	// Child pairs of a unit's inner nodes, hottest (largest parent) first
+	int childUnits(int first, int out[2]) const {
+		int count = 0;
+		for (int i = first; i < first + unitSize(first); ++i) {
+			if (isInner(i))
+				out[count++] = nodes[i].startIndex;
+		}
+		if (count == 2 && surfaceArea(nodes[first + 1]) > surfaceArea(nodes[first]))
+			std::swap(out[0], out[1]);
+		return count;
+	}
+
+	void emit(int first) {
+		for (int i = first; i < first + unitSize(first); ++i)
+			order.push_back(i);
+	}
+
+	// Build: splitBVH appends a node's child pair, then finishes the left subtree before the right one
+	void buildOrder(int index) {
+		if (!isInner(index))
+			return;
+		emit(nodes[index].startIndex);
+		buildOrder(nodes[index].startIndex + 0);
+		buildOrder(nodes[index].startIndex + 1);
+	}
+
+	void depthFirst(int first) {
+		emit(first);
+		int children[2];
+		int count = childUnits(first, children);
+		for (int i = 0; i < count; ++i)
+			depthFirst(children[i]);
+	}
+
+	// Height in units, a lone leaf pair is 1
+	int unitHeight(int first) const {
+		int children[2];
+		int count = childUnits(first, children);
+		int height = 0;
+		for (int i = 0; i < count; ++i)
+			height = std::max(height, unitHeight(children[i]));
+		return height + 1;
+	}
+
+	void unitsAtDepth(int first, int depth, std::vector<int>& out) const {
+		if (depth == 0) {
+			out.push_back(first);
+			return;
+		}
+		int children[2];
+		int count = childUnits(first, children);
+		for (int i = 0; i < count; ++i)
+			unitsAtDepth(children[i], depth - 1, out);
+	}
+
+	// Places the units of the first `levels` levels below first: the top half of them, then every subtree hanging
+	// off it, both recursively. Any block of memory then holds a subtree whose height is proportional to its size
+	void vanEmdeBoas(int first, int levels) {
+		if (levels <= 1) {
+			emit(first);
+			return;
+		}
+		int topLevels = levels / 2;
+		vanEmdeBoas(first, topLevels);
+
+		std::vector<int> bottom;
+		unitsAtDepth(first, topLevels, bottom);
+		for (int unit : bottom)
+			vanEmdeBoas(unit, levels - topLevels);
+	}
+
+	// Grows a treelet from first by always taking the hottest pair on its border, then lays out the pairs left on
+	// the border the same way, hottest first
+	void treelet(int first) {
+		std::vector<int> border = { first };
+		int nodeCount = 0;
+		while (!border.empty() && nodeCount + unitSize(border.back()) <= BVH_TREELET_NODES) {
+			int unit = border.back();
+			border.pop_back();
+			emit(unit);
+			nodeCount += unitSize(unit);
+
+			int children[2];
+			int count = childUnits(unit, children);
+			border.insert(border.end(), children, children + count);
+			// Hottest last so it's the next one taken
+			std::sort(border.begin(), border.end(), [&](int a, int b) {
+				return surfaceArea(nodes[nodes[a].parentIndex]) < surfaceArea(nodes[nodes[b].parentIndex]);
+			});
+		}
+
+		for (auto it = border.rbegin(); it != border.rend(); ++it)
+			treelet(*it);
+	}
+};
+
+}
+
+static int countNodes(const BVHNode* nodes, int index) {
+	if (nodes[index].triangleCount > 0)
+		return 1;
+	return 1 + countNodes(nodes, nodes[index].startIndex + 0) + countNodes(nodes, nodes[index].startIndex + 1);
+}
+
+void ReorderBVH(std::vector<BVHNode>& nodes, int nodeOffset, BVHLayout layout) {
+	if (nodeOffset < 0 || nodeOffset >= (int)nodes.size())
+		return;
+
+	BVHNode* modelNodes = nodes.data() + nodeOffset;
+	int nodeCount = countNodes(modelNodes, 0);
+
+	Layout builder = { modelNodes, {} };
+	builder.order.reserve(nodeCount);
+	switch (layout) {
+		case BVHLayout::DepthFirst: builder.depthFirst(0); break;
+		case BVHLayout::VanEmdeBoas: builder.vanEmdeBoas(0, builder.unitHeight(0)); break;
+		case BVHLayout::Treelet: builder.treelet(0); break;
+		default: builder.emit(0); builder.buildOrder(0); break;
+	}
+	assert((int)builder.order.size() == nodeCount && builder.order[0] == 0);
+
+	std::vector<int> newIndex(nodeCount);
+	for (int i = 0; i < nodeCount; ++i)
+		newIndex[builder.order[i]] = i;
+
+	std::vector<BVHNode> reordered(nodeCount);
+	for (int i = 0; i < nodeCount; ++i) {
+		BVHNode node = modelNodes[builder.order[i]];
+		if (node.triangleCount <= 0) {
+			assert(newIndex[node.startIndex + 1] == newIndex[node.startIndex] + 1);
+			node.startIndex = newIndex[node.startIndex];
+		}
+		if (node.parentIndex >= 0)
+			node.parentIndex = newIndex[node.parentIndex];
+		reordered[i] = node;
+	}
+	std::copy(reordered.begin(), reordered.end(), modelNodes);
+}
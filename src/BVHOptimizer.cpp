@@ -0,0 +1,249 @@
+#include "BVHOptimizer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+
+#include "BVHAnalysis.h"
+#include "ParallelFor.h"
+
+static float surfaceArea(const glm::vec3& boxMin, const glm::vec3& boxMax) {
+	glm::vec3 size = glm::max(boxMax - boxMin, glm::vec3(0.0f));
+	return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+// Index of the lowest set bit, value > 0
+static int lowestBit(int value) {
+	int bit = 0;
+	while ((value & 1) == 0) {
+		value >>= 1;
+		bit++;
+	}
+	return bit;
+}
+
+namespace {
+
+// Per node state, refreshed before every batch of treelets. Indices are relative to the model's nodeOffset
+struct TreeInfo {
+	std::vector<int> depth;
+	std::vector<int> height;    // levels below the node, 0 for leaves
+	std::vector<float> area;
+	std::vector<float> cost;    // SAH cost of the subtree, not divided by the root's area
+
+	void update(const BVHNode* nodes, int index, int nodeDepth) {
+		if ((int)depth.size() <= index) {
+			depth.resize(index + 1);
+			height.resize(index + 1);
+			area.resize(index + 1);
+			cost.resize(index + 1);
+		}
+		const BVHNode& node = nodes[index];
+		depth[index] = nodeDepth;
+		area[index] = surfaceArea(node.boundsMin, node.boundsMax);
+
+		if (node.triangleCount > 0) {
+			height[index] = 0;
+			cost[index] = BVH_TRIANGLE_COST * node.triangleCount * area[index];
+			return;
+		}
+		update(nodes, node.startIndex + 0, nodeDepth + 1);
+		update(nodes, node.startIndex + 1, nodeDepth + 1);
+		height[index] = 1 + std::max(height[node.startIndex + 0], height[node.startIndex + 1]);
+		cost[index] = BVH_TRAVERSAL_COST * area[index] + cost[node.startIndex + 0] + cost[node.startIndex + 1];
+	}
+};
+
+const int subsetCount = 1 << BVH_TREELET_LEAVES;
+
+struct Treelet {
+	BVHNode* nodes;
+	const TreeInfo& info;
+
+	int root;
+	int leaves[BVH_TREELET_LEAVES];
+	int leafCount = 0;
+	// Child pair of every inner node of the treelet, reused for the new inner nodes
+	int slots[BVH_TREELET_LEAVES - 1];
+	int slotCount = 0;
+
+	// By subset of the leaves (bit i is leaves[i])
+	glm::vec3 boundsMin[subsetCount];
+	glm::vec3 boundsMax[subsetCount];
+	float bestCost[subsetCount];
+	int bestSplit[subsetCount];     // subset of the first child, always holds the lowest leaf of the set
+	int bestHeight[subsetCount];
+
+	// The arrays are filled by grow & optimize, only up to leafCount / slotCount
+	Treelet(BVHNode* treeNodes, const TreeInfo& treeInfo, int rootIndex) : nodes(treeNodes), info(treeInfo), root(rootIndex) {}
+
+	// Opens the largest leaf that has children until there are BVH_TREELET_LEAVES
+	void grow() {
+		slots[slotCount++] = nodes[root].startIndex;
+		leaves[leafCount++] = nodes[root].startIndex + 0;
+		leaves[leafCount++] = nodes[root].startIndex + 1;
+
+		while (leafCount < BVH_TREELET_LEAVES) {
+			int largest = -1;
+			for (int i = 0; i < leafCount; ++i) {
+				if (nodes[leaves[i]].triangleCount <= 0 && (largest < 0 || info.area[leaves[i]] > info.area[leaves[largest]]))
+					largest = i;
+			}
+			if (largest < 0)
+				break;
+
+			int opened = leaves[largest];
+			slots[slotCount++] = nodes[opened].startIndex;
+			leaves[largest] = nodes[opened].startIndex + 0;
+			leaves[leafCount++] = nodes[opened].startIndex + 1;
+		}
+	}
+
+	// Cheapest topology of every subset, smallest subsets first
+	void solve() {
+		int full = (1 << leafCount) - 1;
+		for (int set = 1; set <= full; ++set) {
+			int lowest = set & -set;
+			if (set == lowest) {
+				int leaf = leaves[lowestBit(set)];
+				boundsMin[set] = nodes[leaf].boundsMin;
+				boundsMax[set] = nodes[leaf].boundsMax;
+				bestCost[set] = info.cost[leaf];
+				bestHeight[set] = info.height[leaf];
+				continue;
+			}
+
+			boundsMin[set] = glm::min(boundsMin[lowest], boundsMin[set ^ lowest]);
+			boundsMax[set] = glm::max(boundsMax[lowest], boundsMax[set ^ lowest]);
+
+			// Every split into two non empty halves, the half with the lowest leaf is enumerated only
+			bestCost[set] = std::numeric_limits<float>::infinity();
+			for (int part = (set - 1) & set; part > 0; part = (part - 1) & set) {
+				if ((part & lowest) == 0)
+					continue;
+				float cost = bestCost[part] + bestCost[set ^ part];
+				if (cost < bestCost[set]) {
+					bestCost[set] = cost;
+					bestSplit[set] = part;
+				}
+			}
+			bestCost[set] += BVH_TRAVERSAL_COST * surfaceArea(boundsMin[set], boundsMax[set]);
+			bestHeight[set] = 1 + std::max(bestHeight[bestSplit[set]], bestHeight[set ^ bestSplit[set]]);
+		}
+	}
+
+	// Writes the subtree of set to index. Children go into the next free slot, the lower one along the axis their
+	// centers are furthest apart on becomes the left child, like splitBVH
+	void write(int set, int index, int parent, const BVHNode* leafNodes, int& nextSlot) {
+		if ((set & (set - 1)) == 0) {
+			BVHNode node = leafNodes[lowestBit(set)];
+			node.parentIndex = parent;
+			nodes[index] = node;
+			if (node.triangleCount <= 0) {
+				nodes[node.startIndex + 0].parentIndex = index;
+				nodes[node.startIndex + 1].parentIndex = index;
+			}
+			return;
+		}
+
+		int first = bestSplit[set];
+		int second = set ^ first;
+		glm::vec3 offset = (boundsMin[second] + boundsMax[second]) - (boundsMin[first] + boundsMax[first]);
+		glm::vec3 distance = glm::abs(offset);
+		int axis = distance.x >= distance.y && distance.x >= distance.z ? 0 : (distance.y >= distance.z ? 1 : 2);
+		if (offset[axis] < 0)
+			std::swap(first, second);
+
+		int slot = slots[nextSlot++];
+		write(first, slot + 0, index, leafNodes, nextSlot);
+		write(second, slot + 1, index, leafNodes, nextSlot);
+
+		BVHNode& node = nodes[index];
+		node.boundsMin = boundsMin[set];
+		node.boundsMax = boundsMax[set];
+		node.startIndex = slot;
+		node.triangleCount = -1;
+		node.parentIndex = parent;
+		node.splitAxis = axis;
+	}
+
+	// True if the treelet got a cheaper topology
+	bool optimize() {
+		grow();
+		if (leafCount < 3)
+			return false; // two subtrees can only be grouped one way
+
+		solve();
+		int full = (1 << leafCount) - 1;
+		if (bestCost[full] >= info.cost[root] * 0.9999f)
+			return false;
+
+		// The stackless traversal doesn't care, but keep trees usable with the stack one
+		int newDepth = info.depth[root] + bestHeight[full];
+		int oldDepth = info.depth[root] + info.height[root];
+		if (newDepth > BVH_TRAVERSAL_STACK_SIZE - 1 && newDepth > oldDepth)
+			return false;
+
+		BVHNode leafNodes[BVH_TREELET_LEAVES];
+		for (int i = 0; i < leafCount; ++i)
+			leafNodes[i] = nodes[leaves[i]];
+
+		int nextSlot = 0;
+		write(full, root, nodes[root].parentIndex, leafNodes, nextSlot);
+		return true;
+	}
+};
+
+}
+
+BVHOptimizeStats OptimizeBVH(std::vector<BVHNode>& nodes, int nodeOffset, double timeBudgetSeconds) {
+	BVHOptimizeStats stats;
+	if (nodeOffset < 0 || nodeOffset >= (int)nodes.size())
+		return stats;
+
+	auto start = std::chrono::steady_clock::now();
+	auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeBudgetSeconds));
+	BVHNode* modelNodes = nodes.data() + nodeOffset;
+
+	TreeInfo info;
+	info.update(modelNodes, 0, 0);
+	stats.sahBefore = info.area[0] > 0 ? info.cost[0] / info.area[0] : 0.0f;
+
+	std::vector<int> roots;
+	bool improved = true;
+	while (improved && std::chrono::steady_clock::now() < deadline) {
+		improved = false;
+		stats.rounds++;
+
+		// Depths move as treelets change, so they are refreshed before every batch
+		for (int phase = BVH_TREELET_SPACING - 1; phase >= 0 && std::chrono::steady_clock::now() < deadline; --phase) {
+			info.update(modelNodes, 0, 0);
+			roots.clear();
+			for (int i = 0; i < (int)info.depth.size(); ++i) {
+				if (modelNodes[i].triangleCount <= 0 && info.depth[i] % BVH_TREELET_SPACING == phase)
+					roots.push_back(i);
+			}
+
+			std::atomic<int> restructured(0);
+			std::atomic<int> treelets(0);
+			ParallelFor((int)roots.size(), [&](int i) {
+				if (std::chrono::steady_clock::now() >= deadline)
+					return;
+				Treelet treelet(modelNodes, info, roots[i]);
+				treelets++;
+				if (treelet.optimize())
+					restructured++;
+			}, 16);
+
+			stats.treelets += treelets;
+			stats.restructured += restructured;
+			improved |= restructured > 0;
+		}
+	}
+
+	info.update(modelNodes, 0, 0);
+	stats.sahAfter = info.area[0] > 0 ? info.cost[0] / info.area[0] : 0.0f;
+	stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
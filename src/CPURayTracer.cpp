@@ -0,0 +1,1385 @@
+#include "CPURayTracer.h"
+
+#include <cmath>
+#include <limits>
+#include <atomic>
+#include <array>
+#include <glm/gtc/packing.hpp>
+
+#include "ParallelFor.h"
+#include "TraversalStats.h"
+
+#define PI 3.14159265359f
+
+static const float inf = std::numeric_limits<float>::infinity();
+
+// Sky settings, keep in sync with compute.glsl
+static const int UseSky = 1;
+static const glm::vec3 GroundColour = glm::vec3(0.35f, 0.3f, 0.35f);
+static const glm::vec3 SkyColourHorizon = glm::vec3(1.0f);
+static const glm::vec3 SkyColourZenith = glm::vec3(0.38f, 0.45f, 0.8f);
+
+static const glm::vec3 SunDirection = glm::normalize(glm::vec3(0.8f, 0.6f, -0.1f));
+static const glm::vec3 SunColor = glm::vec3(1.0f, 0.9f, 0.6f);
+static const float SunIntensity = 10.0f;
+static const float SunFocus = 500.0f;
+
+static const float maxDist = 1e8f;
+
+#ifdef TRAVERSAL_STATS
+// Triangle BVH work of the pixel the current thread is tracing, same layout as ResolveTraversalCost
+static thread_local glm::vec4 t_traversalCost;
+#define COUNT_TRAVERSAL(component, n) t_traversalCost.component += float(n)
+// Every triangle BVH node read goes through the thread's cache model, misses of the current pixel
+static thread_local NodeCacheModel t_nodeCache;
+static thread_local float t_nodeCacheMisses;
+#define READ_NODE(node) t_nodeCacheMisses += float(t_nodeCache.Access(&(node), sizeof(BVHNode)))
+#else
+#define COUNT_TRAVERSAL(component, n)
+#define READ_NODE(node)
+#endif
+
+// PCG (permuted congruential generator). Thanks to:
+// www.pcg-random.org and www.shadertoy.com/view/XlGcRh
+uint32_t NextRandom(uint32_t& state) {
+	state = state * 747796405u + 2891336453u;
+	uint32_t result = ((state >> ((state >> 28) + 4)) ^ state) * 277803737u;
+	result = (result >> 22) ^ result;
+	return result;
+}
+
+// Returns float value between [0..1]
+float RandomValue(uint32_t& state) {
+	return (float)NextRandom(state) / 4294967295.0f; // 2^32 - 1
+}
+
+// Sky gradient & ground, without the sun
+glm::vec3 GetSkyLight(const glm::vec3& dir) {
+	if (UseSky == 0)
+		return glm::vec3(0.0f);
+
+	float skyGradientT = std::pow(glm::smoothstep(0.0f, 0.4f, dir.y), 0.35f);
+	float groundToSkyT = glm::smoothstep(-0.01f, 0.0f, dir.y);
+
+	glm::vec3 skyGradient = glm::mix(SkyColourHorizon, SkyColourZenith, skyGradientT);
+	return glm::mix(GroundColour, skyGradient, groundToSkyT);
+}
+
+// Sun lobe, hidden below the horizon
+glm::vec3 GetSunLight(const glm::vec3& dir) {
+	if (UseSky == 0)
+		return glm::vec3(0.0f);
+
+	float sun = std::pow(std::max(0.0f, glm::dot(dir, SunDirection)), SunFocus) * SunIntensity;
+	return sun * SunColor * float(dir.y >= 0.0f);
+}
+
+// Crude Sky color function for ambient light
+glm::vec3 GetEnvironmentLight(const glm::vec3& dir) {
+	return GetSkyLight(dir) + GetSunLight(dir);
+}
+
+// Solid angle pdf of SampleSunDirection, proportional to the sun lobe: (n + 1) / 2pi * cos^n
+float SunPdf(const glm::vec3& dir) {
+	return (SunFocus + 1.0f) / (2.0f * PI) * std::pow(std::max(0.0f, glm::dot(dir, SunDirection)), SunFocus);
+}
+
+// Samples a direction around SunDirection proportional to the sun lobe
+glm::vec3 SampleSunDirection(const glm::vec2& u) {
+	float cosTheta = std::pow(u.x, 1.0f / (SunFocus + 1.0f));
+	float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+	float phi = 2.0f * PI * u.y;
+
+	glm::vec3 tangent = glm::normalize(glm::cross(std::abs(SunDirection.y) < 0.999f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f), SunDirection));
+	glm::vec3 bitangent = glm::cross(SunDirection, tangent);
+	return glm::normalize(tangent * (std::cos(phi) * sinTheta) + bitangent * (std::sin(phi) * sinTheta) + SunDirection * cosTheta);
+}
+
+// Equirectangular coordinates of a direction, see EnvironmentMap.h
+static glm::vec2 environmentUV(const glm::vec3& dir) {
+	return glm::vec2(std::atan2(dir.x, dir.z) / (2.0f * PI) + 0.5f, std::acos(glm::clamp(dir.y, -1.0f, 1.0f)) / PI);
+}
+
+// Bilinear, wrapping around horizontally & clamped at the poles
+glm::vec3 EnvironmentRadiance(const EnvironmentMap& environment, const glm::vec3& dir) {
+	int width = environment.width;
+	int height = environment.height;
+	glm::vec2 pos = environmentUV(dir) * glm::vec2(width, height) - 0.5f;
+	glm::vec2 base = glm::floor(pos);
+	glm::vec2 f = pos - base;
+
+	int x0 = ((int)base.x % width + width) % width;
+	int x1 = (x0 + 1) % width;
+	int y0 = glm::clamp((int)base.y, 0, height - 1);
+	int y1 = glm::clamp((int)base.y + 1, 0, height - 1);
+	const glm::vec4* texels = environment.texels.data();
+
+	glm::vec3 top = glm::mix(glm::vec3(texels[y0 * width + x0]), glm::vec3(texels[y0 * width + x1]), f.x);
+	glm::vec3 bottom = glm::mix(glm::vec3(texels[y1 * width + x0]), glm::vec3(texels[y1 * width + x1]), f.x);
+	return glm::mix(top, bottom, f.y);
+}
+
+// Probability of picking texel (x, y): its row from the marginal CDF times the texel from the row's CDF
+static float environmentTexelProbability(const EnvironmentMap& environment, int x, int y) {
+	const float* marginal = environment.marginalCdf.data();
+	const glm::vec4* row = environment.texels.data() + y * environment.width;
+	float rowProbability = marginal[y] - (y > 0 ? marginal[y - 1] : 0.0f);
+	float columnProbability = row[x].a - (x > 0 ? row[x - 1].a : 0.0f);
+	return rowProbability * columnProbability;
+}
+
+// A texel covers 2pi / width * pi / height of (phi, theta) & sin(theta) times that in solid angle
+float EnvironmentPdf(const EnvironmentMap& environment, const glm::vec3& dir) {
+	int width = environment.width;
+	int height = environment.height;
+	float sinTheta = std::sqrt(std::max(0.0f, 1.0f - dir.y * dir.y));
+	if (sinTheta <= 0.0f)
+		return 0.0f;
+
+	glm::vec2 uv = environmentUV(dir);
+	int x = std::min((int)(uv.x * width), width - 1);
+	int y = std::min((int)(uv.y * height), height - 1);
+	return environmentTexelProbability(environment, x, y) * width * height / (2.0f * PI * PI * sinTheta);
+}
+
+// Picks a texel by binary search in the marginal CDF (u.y) & that row's CDF (u.x), u's position inside the
+// picked CDF steps places the direction inside the texel
+glm::vec3 SampleEnvironmentDirection(const EnvironmentMap& environment, const glm::vec2& u, float& pdf) {
+	int width = environment.width;
+	int height = environment.height;
+	const float* marginal = environment.marginalCdf.data();
+
+	int low = 0;
+	int high = height - 1;
+	while (low < high) {
+		int mid = (low + high) / 2;
+		if (marginal[mid] > u.y)
+			high = mid;
+		else
+			low = mid + 1;
+	}
+	int y = low;
+
+	const glm::vec4* row = environment.texels.data() + y * width;
+	low = 0;
+	high = width - 1;
+	while (low < high) {
+		int mid = (low + high) / 2;
+		if (row[mid].a > u.x)
+			high = mid;
+		else
+			low = mid + 1;
+	}
+	int x = low;
+
+	float rowStart = y > 0 ? marginal[y - 1] : 0.0f;
+	float columnStart = x > 0 ? row[x - 1].a : 0.0f;
+	float fy = glm::clamp((u.y - rowStart) / (marginal[y] - rowStart), 0.0f, 1.0f);
+	float fx = glm::clamp((u.x - columnStart) / (row[x].a - columnStart), 0.0f, 1.0f);
+
+	float phi = 2.0f * PI * ((x + fx) / width - 0.5f);
+	float theta = PI * (y + fy) / height;
+	float sinTheta = std::sin(theta);
+	pdf = sinTheta > 0.0f ? environmentTexelProbability(environment, x, y) * width * height / (2.0f * PI * PI * sinTheta) : 0.0f;
+	return glm::vec3(sinTheta * std::sin(phi), std::cos(theta), sinTheta * std::cos(phi));
+}
+
+// MIS power heuristic (beta = 2)
+float PowerHeuristic(float pdfA, float pdfB) {
+	float a = pdfA * pdfA;
+	float b = pdfB * pdfB;
+	return a + b > 0.0f ? a / (a + b) : 0.0f;
+}
+
+float Luminance(const glm::vec3& color) {
+	return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+// Relative standard error of the pixel mean from its Welford state
+float RelativeError(const glm::vec4& varState) {
+	if (varState.z < 2.0f)
+		return inf;
+	float varianceOfMean = varState.y / (varState.z - 1.0f) / varState.z;
+	return std::sqrt(varianceOfMean) / (varState.x + 1e-3f);
+}
+
+TriangleHitInfo RayTriangle(const Ray& ray, const Triangle& tri) {
+	glm::vec3 edgeAB = tri.posB - tri.posA;
+	glm::vec3 edgeAC = tri.posC - tri.posA;
+	glm::vec3 normVec = glm::cross(edgeAB, edgeAC);
+	glm::vec3 ao = ray.origin - tri.posA;
+	glm::vec3 dao = glm::cross(ao, ray.dir);
+
+	float det = -glm::dot(ray.dir, normVec);
+	float invDet = 1 / det;
+
+	// Calculate dst to triangle & baycentric coords
+	float dst = glm::dot(ao, normVec) * invDet;
+	float u = glm::dot(edgeAC, dao) * invDet;
+	float v = -glm::dot(edgeAB, dao) * invDet;
+	float w = 1 - u - v;
+
+	TriangleHitInfo hitInfo;
+	hitInfo.didHit = det >= 1E-8f && dst >= 0 && u >= 0 && v >= 0 && w >= 0;
+	hitInfo.dst = dst;
+	hitInfo.hitPoint = ray.origin + ray.dir * dst;
+	hitInfo.normal = glm::normalize(w * tri.normA + u * tri.normB + v * tri.normC);
+	hitInfo.triIndex = -1;
+	hitInfo.barycentric = glm::vec2(u, v);
+	return hitInfo;
+}
+
+// Yes/no version of RayTriangle for occlusion rays, skips the hit point & normal interpolation
+bool RayTriangleAnyHit(const Ray& ray, const Triangle& tri, float rayLength) {
+	glm::vec3 edgeAB = tri.posB - tri.posA;
+	glm::vec3 edgeAC = tri.posC - tri.posA;
+	glm::vec3 normVec = glm::cross(edgeAB, edgeAC);
+	glm::vec3 ao = ray.origin - tri.posA;
+	glm::vec3 dao = glm::cross(ao, ray.dir);
+
+	float det = -glm::dot(ray.dir, normVec);
+	float invDet = 1 / det;
+
+	float dst = glm::dot(ao, normVec) * invDet;
+	float u = glm::dot(edgeAC, dao) * invDet;
+	float v = -glm::dot(edgeAB, dao) * invDet;
+	float w = 1 - u - v;
+
+	return det >= 1E-8f && dst >= 0 && dst < rayLength && u >= 0 && v >= 0 && w >= 0;
+}
+
+// RayTriangle without the edge & normal setup, those come precomputed from the record
+TriangleHitInfo RayTriangleRecord(const Ray& ray, const TriangleRecord& record) {
+	glm::vec3 normVec = glm::vec3(record.normalX, record.normalY, record.normalZ);
+	glm::vec3 ao = ray.origin - record.posA;
+	glm::vec3 dao = glm::cross(ao, ray.dir);
+
+	float det = -glm::dot(ray.dir, normVec);
+	float invDet = 1 / det;
+
+	float dst = glm::dot(ao, normVec) * invDet;
+	float u = glm::dot(record.edgeAC, dao) * invDet;
+	float v = -glm::dot(record.edgeAB, dao) * invDet;
+	float w = 1 - u - v;
+
+	TriangleHitInfo hitInfo;
+	hitInfo.didHit = det >= 1E-8f && dst >= 0 && u >= 0 && v >= 0 && w >= 0;
+	hitInfo.dst = dst;
+	hitInfo.triIndex = -1;
+	hitInfo.barycentric = glm::vec2(u, v);
+	return hitInfo;
+}
+
+bool RayTriangleRecordAnyHit(const Ray& ray, const TriangleRecord& record, float rayLength) {
+	glm::vec3 normVec = glm::vec3(record.normalX, record.normalY, record.normalZ);
+	glm::vec3 ao = ray.origin - record.posA;
+	glm::vec3 dao = glm::cross(ao, ray.dir);
+
+	float det = -glm::dot(ray.dir, normVec);
+	float invDet = 1 / det;
+
+	float dst = glm::dot(ao, normVec) * invDet;
+	float u = glm::dot(record.edgeAC, dao) * invDet;
+	float v = -glm::dot(record.edgeAB, dao) * invDet;
+	float w = 1 - u - v;
+
+	return det >= 1E-8f && dst >= 0 && dst < rayLength && u >= 0 && v >= 0 && w >= 0;
+}
+
+void FinishTriangleHit(const Ray& ray, const Triangle& tri, TriangleHitInfo& hit) {
+	float u = hit.barycentric.x;
+	float v = hit.barycentric.y;
+	float w = 1 - u - v;
+	hit.hitPoint = ray.origin + ray.dir * hit.dst;
+	hit.normal = glm::normalize(w * tri.normA + u * tri.normB + v * tri.normC);
+}
+
+// Distance to an analytic primitive, inf on a miss. Front faces only, like RayTriangle
+float RayPrimitiveDst(const Ray& ray, const Primitive& prim) {
+	if (prim.type == PRIMITIVE_SPHERE) {
+		glm::vec3 oc = ray.origin - prim.center;
+		float a = glm::dot(ray.dir, ray.dir);
+		float b = glm::dot(oc, ray.dir);
+		float c = glm::dot(oc, oc) - prim.radius * prim.radius;
+
+		// Only the near root, rays starting inside (or leaving the surface) miss
+		float discriminant = b * b - a * c;
+		if (discriminant < 0)
+			return inf;
+		float dst = (-b - std::sqrt(discriminant)) / a;
+		return dst >= 0 ? dst : inf;
+	}
+
+	// Plane & disk
+	float denom = glm::dot(prim.normal, ray.dir);
+	if (denom > -1E-8f)
+		return inf;
+	float dst = glm::dot(prim.center - ray.origin, prim.normal) / denom;
+	if (dst < 0)
+		return inf;
+
+	if (prim.type == PRIMITIVE_DISK) {
+		glm::vec3 offset = ray.origin + ray.dir * dst - prim.center;
+		if (glm::dot(offset, offset) > prim.radius * prim.radius)
+			return inf;
+	}
+	return dst;
+}
+
+glm::vec3 PrimitiveNormal(const Primitive& prim, const glm::vec3& hitPoint) {
+	if (prim.type == PRIMITIVE_SPHERE)
+		return (hitPoint - prim.center) / prim.radius;
+	return prim.normal;
+}
+
+// Texture coordinate at a triangle hit & 0.5 * log2(uv area / world area) of the triangle, i.e. log2 of the uv size of a
+// unit of world space on it (ray cone texture LOD)
+void TriangleTexCoords(const Triangle& tri, const glm::mat4& localToWorld, const glm::vec2& barycentric, glm::vec2& uv, float& uvDensity) {
+	glm::vec2 uvA = glm::unpackHalf2x16(tri.uvA);
+	glm::vec2 uvB = glm::unpackHalf2x16(tri.uvB);
+	glm::vec2 uvC = glm::unpackHalf2x16(tri.uvC);
+	uv = (1 - barycentric.x - barycentric.y) * uvA + barycentric.x * uvB + barycentric.y * uvC;
+
+	glm::vec2 uvAB = uvB - uvA;
+	glm::vec2 uvAC = uvC - uvA;
+	float uvArea = std::abs(uvAB.x * uvAC.y - uvAB.y * uvAC.x);
+	glm::vec3 worldAB = glm::vec3(localToWorld * glm::vec4(tri.posB - tri.posA, 0.0f));
+	glm::vec3 worldAC = glm::vec3(localToWorld * glm::vec4(tri.posC - tri.posA, 0.0f));
+	float worldArea = glm::length(glm::cross(worldAB, worldAC));
+	uvDensity = 0.5f * std::log2(std::max(uvArea, 1e-12f) / std::max(worldArea, 1e-12f));
+}
+
+// 8 bit sRGB to linear, one entry per value
+static const std::array<float, 256>& srgbToLinearTable() {
+	static const std::array<float, 256> table = []() {
+		std::array<float, 256> values;
+		for (int i = 0; i < 256; ++i) {
+			float c = i / 255.0f;
+			values[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+		return values;
+	}();
+	return table;
+}
+
+static glm::vec3 textureTexel(const TextureMip& mip, const uint32_t* texels, int x, int y) {
+	const std::array<float, 256>& toLinear = srgbToLinearTable();
+	uint32_t texel = texels[mip.offset + y * mip.width + x];
+	return glm::vec3(toLinear[texel & 0xFFu], toLinear[(texel >> 8) & 0xFFu], toLinear[(texel >> 16) & 0xFFu]);
+}
+
+// Bilinear, uv in [0, 1) & wrapped around. v = 0 is the bottom row, the last one in memory
+glm::vec3 SampleTextureLevel(const TextureMip& mip, const uint32_t* texels, const glm::vec2& uv) {
+	float x = uv.x * mip.width - 0.5f;
+	float y = (1.0f - uv.y) * mip.height - 0.5f;
+	float x0 = std::floor(x);
+	float y0 = std::floor(y);
+	float tx = x - x0;
+	float ty = y - y0;
+
+	int left = ((int)x0 + mip.width) % mip.width;
+	int right = (left + 1) % mip.width;
+	int top = ((int)y0 + mip.height) % mip.height;
+	int bottom = (top + 1) % mip.height;
+
+	glm::vec3 upper = glm::mix(textureTexel(mip, texels, left, top), textureTexel(mip, texels, right, top), tx);
+	glm::vec3 lower = glm::mix(textureTexel(mip, texels, left, bottom), textureTexel(mip, texels, right, bottom), tx);
+	return glm::mix(upper, lower, ty);
+}
+
+// Trilinear, the level is picked so a texel covers uvFootprintLog2 (log2 of the footprint's size in uv units)
+glm::vec3 SampleTexture(const TextureMip* mips, const uint32_t* texels, int textureIndex, glm::vec2 uv, float uvFootprintLog2) {
+	const TextureMip& level0 = mips[textureIndex];
+	float lod = uvFootprintLog2 + 0.5f * std::log2((float)level0.width * (float)level0.height);
+	lod = lod > 0.0f ? std::min(lod, (float)(level0.levelCount - 1)) : 0.0f;
+
+	uv -= glm::floor(uv);
+	int lower = (int)lod;
+	int upper = std::min(lower + 1, level0.levelCount - 1);
+	glm::vec3 color = SampleTextureLevel(mips[textureIndex + lower], texels, uv);
+	if (upper == lower)
+		return color;
+	return glm::mix(color, SampleTextureLevel(mips[textureIndex + upper], texels, uv), lod - (float)lower);
+}
+
+// Thanks to https://tavianator.com/2011/ray_box.html
+float RayBoundingBoxDst(const Ray& ray, const glm::vec3& boxMin, const glm::vec3& boxMax) {
+	glm::vec3 tMin = (boxMin - ray.origin) * ray.invDir;
+	glm::vec3 tMax = (boxMax - ray.origin) * ray.invDir;
+	glm::vec3 t1 = glm::min(tMin, tMax);
+	glm::vec3 t2 = glm::max(tMin, tMax);
+
+	float tNear = std::max(std::max(t1.x, t1.y), t1.z);
+	float tFar = std::min(std::min(t2.x, t2.y), t2.z);
+
+	bool hit = tFar >= tNear && tFar > 0;
+	float dst = hit ? (tNear > 0 ? tNear : 0) : inf;
+	return dst;
+}
+
+CPURayTracer::CPURayTracer()
+	: m_models(nullptr),
+	m_nodes(nullptr),
+	m_triangles(nullptr),
+	m_materials(nullptr),
+	m_triangleRecords(nullptr),
+	m_primitives(nullptr),
+	m_primitiveNodes(nullptr),
+	m_primitivePlaneCount(0),
+	m_textureMips(nullptr),
+	m_textureTexels(nullptr),
+	m_environment(nullptr),
+	m_lights(nullptr),
+	m_width(0),
+	m_height(0),
+	m_accumFrames(0),
+	m_activePixels(0),
+	m_meanRelativeError(inf),
+	m_totalSamples(0),
+	m_frame(0)
+{}
+
+void CPURayTracer::SetScene(const std::vector<Model>& models, const std::vector<BVHNode>& nodes, const std::vector<Triangle>& triangles,
+	const std::vector<RayTracingMaterial>& materials, const std::vector<TriangleRecord>* triangleRecords) {
+	m_models = &models;
+	m_nodes = &nodes;
+	m_triangles = &triangles;
+	m_materials = &materials;
+	m_triangleRecords = triangleRecords;
+	ResetAccumulation();
+}
+
+void CPURayTracer::SetPrimitives(const std::vector<Primitive>& primitives, const std::vector<BVHNode>& nodes, int planeCount) {
+	m_primitives = &primitives;
+	m_primitiveNodes = &nodes;
+	m_primitivePlaneCount = planeCount;
+	ResetAccumulation();
+}
+
+void CPURayTracer::SetTextures(const std::vector<TextureMip>& mips, const std::vector<uint32_t>& texels) {
+	m_textureMips = &mips;
+	m_textureTexels = &texels;
+	ResetAccumulation();
+}
+
+void CPURayTracer::SetLights(const std::vector<Light>& lights) {
+	m_lights = &lights;
+	ResetAccumulation();
+}
+
+void CPURayTracer::SetEnvironment(const EnvironmentMap* environment) {
+	m_environment = environment != nullptr && !environment->Empty() ? environment : nullptr;
+	ResetAccumulation();
+}
+
+void CPURayTracer::Resize(int width, int height) {
+	m_width = width;
+	m_height = height;
+	m_accumBuffer.assign((size_t)width * height, glm::vec4(0.0f));
+	m_albedoDepthBuffer.assign((size_t)width * height, glm::vec4(0.0f));
+	m_normalBuffer.assign((size_t)width * height, glm::vec4(0.0f));
+	m_varianceBuffer.assign((size_t)width * height, glm::vec4(0.0f));
+#ifdef TRAVERSAL_STATS
+	m_traversalCostBuffer.assign((size_t)width * height, glm::vec4(0.0f));
+	m_nodeCacheMissBuffer.assign((size_t)width * height, 0.0f);
+#endif
+	ResetAccumulation();
+}
+
+void CPURayTracer::ResetAccumulation() {
+	std::fill(m_accumBuffer.begin(), m_accumBuffer.end(), glm::vec4(0.0f));
+	std::fill(m_albedoDepthBuffer.begin(), m_albedoDepthBuffer.end(), glm::vec4(0.0f));
+	std::fill(m_normalBuffer.begin(), m_normalBuffer.end(), glm::vec4(0.0f));
+	std::fill(m_varianceBuffer.begin(), m_varianceBuffer.end(), glm::vec4(0.0f));
+	std::fill(m_traversalCostBuffer.begin(), m_traversalCostBuffer.end(), glm::vec4(0.0f));
+	std::fill(m_nodeCacheMissBuffer.begin(), m_nodeCacheMissBuffer.end(), 0.0f);
+	// No need to clear, the slots are refilled before they're read
+	m_primaryHitCache.resize((size_t)m_width * m_height * std::max(settings.primaryCacheSamples, 0));
+	m_accumFrames = 0;
+	m_activePixels = m_width * m_height;
+	m_meanRelativeError = inf;
+	m_totalSamples = 0;
+}
+
+bool CPURayTracer::IsConverged() const {
+	if (!settings.adaptiveSampling || m_accumFrames == 0)
+		return false;
+	return m_activePixels == 0 || m_meanRelativeError <= settings.noiseTarget;
+}
+
+int CPURayTracer::GetEffectiveSamplesPerPixel() const {
+	if (m_width <= 0 || m_height <= 0)
+		return 0;
+	return (int)(m_totalSamples / ((uint64_t)m_width * m_height));
+}
+
+void CPURayTracer::RenderFrame() {
+	if (m_models == nullptr || m_width <= 0 || m_height <= 0)
+		return;
+
+	if (IsConverged())
+		return;
+
+	m_frame++;
+
+	std::atomic<int> activePixels(0);
+	std::atomic<int> tracedPixels(0);
+	std::vector<float> rowErrorSum(m_height, 0.0f);
+
+	// One row per work item, rows have similar cost so this balances well
+	ParallelFor(m_height, [&](int y) {
+		int rowActive = 0;
+		int rowTraced = 0;
+		for (int x = 0; x < m_width; ++x) {
+			size_t pixelIndex = (size_t)y * m_width + x;
+			glm::vec4& varState = m_varianceBuffer[pixelIndex];
+
+			if (!(settings.adaptiveSampling && varState.w > 0.5f)) {
+				glm::vec3 val = glm::vec3(0.0f);
+#ifdef TRAVERSAL_STATS
+				t_traversalCost = glm::vec4(0.0f);
+				t_nodeCacheMisses = 0.0f;
+#endif
+				for (int i = 0; i < settings.raysPerPixel; ++i) {
+					FirstHitInfo firstHit;
+					glm::vec3 sample = tracePixelSample(x, y, i, (uint32_t)varState.z, firstHit);
+					val += sample;
+					m_albedoDepthBuffer[pixelIndex] += glm::vec4(firstHit.albedo, firstHit.depth);
+					m_normalBuffer[pixelIndex] += glm::vec4(firstHit.normal, 0.0f);
+
+					// Welford update of the luminance mean & variance
+					float lum = Luminance(sample);
+					varState.z += 1.0f;
+					float delta = lum - varState.x;
+					varState.x += delta / varState.z;
+					varState.y += delta * (lum - varState.x);
+				}
+
+				m_accumBuffer[pixelIndex] += glm::vec4(val, (float)settings.raysPerPixel);
+#ifdef TRAVERSAL_STATS
+				m_traversalCostBuffer[pixelIndex] += t_traversalCost;
+				m_nodeCacheMissBuffer[pixelIndex] += t_nodeCacheMisses;
+#endif
+				varState.w = float(varState.z >= settings.adaptiveMinSamples && RelativeError(varState) < settings.adaptiveThreshold);
+
+				rowTraced++;
+				if (varState.w < 0.5f)
+					rowActive++;
+			}
+
+			// Pixels below the minimum sample count have no reliable estimate yet, so count them as very noisy
+			rowErrorSum[y] += varState.z < settings.adaptiveMinSamples ? 10.0f : std::min(RelativeError(varState), 10.0f);
+		}
+		activePixels += rowActive;
+		tracedPixels += rowTraced;
+	});
+
+	double errorSum = 0.0;
+	for (float rowError : rowErrorSum)
+		errorSum += rowError;
+
+	m_activePixels = activePixels;
+	m_meanRelativeError = (float)(errorSum / ((double)m_width * m_height));
+	m_totalSamples += (uint64_t)tracedPixels * settings.raysPerPixel;
+	m_accumFrames++;
+}
+
+void CPURayTracer::ResolveImage(std::vector<glm::vec4>& out) const {
+	out.resize(m_accumBuffer.size());
+	for (size_t i = 0; i < m_accumBuffer.size(); ++i) {
+		const glm::vec4& accum = m_accumBuffer[i];
+		out[i] = accum.a > 0 ? glm::vec4(glm::vec3(accum) / accum.a, accum.a) : glm::vec4(0.0f);
+	}
+}
+
+void CPURayTracer::ResolveAuxiliary(std::vector<glm::vec4>& albedoDepth, std::vector<glm::vec4>& normal) const {
+	albedoDepth.resize(m_accumBuffer.size());
+	normal.resize(m_accumBuffer.size());
+	for (size_t i = 0; i < m_accumBuffer.size(); ++i) {
+		float sampleCount = m_accumBuffer[i].a;
+		albedoDepth[i] = sampleCount > 0 ? m_albedoDepthBuffer[i] / sampleCount : glm::vec4(0.0f);
+		normal[i] = sampleCount > 0 ? m_normalBuffer[i] / sampleCount : glm::vec4(0.0f);
+	}
+}
+
+bool CPURayTracer::ResolveTraversalCost(std::vector<glm::vec4>& out) const {
+#ifdef TRAVERSAL_STATS
+	out = m_traversalCostBuffer;
+	return true;
+#else
+	out.clear();
+	return false;
+#endif
+}
+
+bool CPURayTracer::ResolveNodeCacheMisses(std::vector<float>& out) const {
+#ifdef TRAVERSAL_STATS
+	out = m_nodeCacheMissBuffer;
+	return true;
+#else
+	out.clear();
+	return false;
+#endif
+}
+
+// Same as main() in compute.glsl, sampleIndex plays the role of the local thread id
+glm::vec3 CPURayTracer::tracePixelSample(int x, int y, int sampleIndex, uint32_t pixelSampleCount, FirstHitInfo& firstHit) {
+	int pixelIndex = x + y * m_width;
+	glm::vec2 uv = glm::vec2(x, y) / glm::vec2(m_width, m_height);
+
+	// Create a rngState, the low discrepancy sampler continues the pixel's sequence instead
+	uint32_t rngState = (uint32_t)pixelIndex + (uint32_t)m_frame * 719393u + (uint32_t)sampleIndex * 16943u;
+
+	// With the primary hit cache the camera ray must be reproducible, so it is sampled from the cache slot
+	// instead of the sample index, the bounces still continue the pixel's sequence
+	uint32_t cacheSamples = (uint32_t)std::max(settings.primaryCacheSamples, 0);
+	bool usePrimaryCache = cacheSamples > 0;
+	uint32_t cacheSlot = usePrimaryCache ? pixelSampleCount % cacheSamples : 0;
+	Sampler sampler = usePrimaryCache
+		? CreateSampler(settings.samplerType, x, y, cacheSlot, (uint32_t)pixelIndex * 9781u + cacheSlot * 16943u)
+		: CreateSampler(settings.samplerType, x, y, pixelSampleCount, rngState);
+
+	// Calculate focal point
+	glm::vec3 focusPointLocal = glm::vec3(uv - glm::vec2(0.5f), 1.0f) * viewParams;
+	glm::vec3 focusPoint = glm::vec3(camLocalToWorldMatrix * glm::vec4(focusPointLocal, 1.0f));
+
+	glm::vec3 camRight = glm::vec3(camLocalToWorldMatrix[0]);
+	glm::vec3 camUp = glm::vec3(camLocalToWorldMatrix[1]);
+	glm::vec3 camPos = glm::vec3(camLocalToWorldMatrix[3]);
+
+	glm::vec2 defocusJitter = SampleDisk(SampleNext2D(sampler)) * defocusStrength / (float)m_width;
+	glm::vec3 rayOrigin = camPos + camRight * defocusJitter.x + camUp * defocusJitter.y;
+
+	glm::vec2 jitter = SampleDisk(SampleNext2D(sampler)) * divergeStrength / (float)m_width;
+	glm::vec3 jitteredFocusPoint = focusPoint + camRight * jitter.x + camUp * jitter.y;
+	glm::vec3 rayDir = glm::normalize(jitteredFocusPoint - rayOrigin);
+
+	if (usePrimaryCache) {
+		sampler.index = pixelSampleCount;
+		sampler.rngState = rngState;
+	}
+
+	Ray cameraRay;
+	cameraRay.origin = rayOrigin;
+	cameraRay.dir = rayDir;
+
+	// The first primaryCacheSamples samples of a pixel fill its slots, the cache restarts with accumulation
+	ModelHitInfo primaryHit;
+	size_t cacheIndex = (size_t)pixelIndex * cacheSamples + cacheSlot;
+	if (usePrimaryCache && pixelSampleCount >= cacheSamples) {
+		primaryHit = LoadPrimaryHit(m_primaryHitCache[cacheIndex], cameraRay);
+	}
+	else {
+		primaryHit = CalculateRayCollision(cameraRay);
+		if (usePrimaryCache)
+			m_primaryHitCache[cacheIndex] = MakePrimaryHit(primaryHit);
+	}
+
+	return Trace(rayOrigin, rayDir, primaryHit, sampler, firstHit);
+}
+
+const TriangleRecord* CPURayTracer::triangleRecords(int triOffset) const {
+	if (!settings.precomputedTriangles || m_triangleRecords == nullptr || m_triangleRecords->size() != m_triangles->size())
+		return nullptr;
+	return m_triangleRecords->data() + triOffset;
+}
+
+// Closest hit among a leaf's triangles, triangles & records start at the model's first triangle.
+// Record hits only get dst & barycentric, finishLeafHit completes the closest one after the traversal
+static void rayTriangleLeaf(const Ray& ray, const BVHNode& node, const Triangle* triangles, const TriangleRecord* records, TriangleHitInfo& result) {
+	COUNT_TRAVERSAL(z, node.triangleCount);
+	if (records != nullptr) {
+		for (int i = 0; i < node.triangleCount; ++i) {
+			TriangleHitInfo triHitInfo = RayTriangleRecord(ray, records[node.startIndex + i]);
+
+			if (triHitInfo.didHit && triHitInfo.dst < result.dst) {
+				result = triHitInfo;
+				result.triIndex = node.startIndex + i;
+			}
+		}
+		return;
+	}
+
+	for (int i = 0; i < node.triangleCount; ++i) {
+		TriangleHitInfo triHitInfo = RayTriangle(ray, triangles[node.startIndex + i]);
+
+		if (triHitInfo.didHit && triHitInfo.dst < result.dst) {
+			result = triHitInfo;
+			result.triIndex = node.startIndex + i;
+		}
+	}
+}
+
+static bool rayTriangleLeafOccluded(const Ray& ray, const BVHNode& node, const Triangle* triangles, const TriangleRecord* records, float rayLength) {
+	for (int i = 0; i < node.triangleCount; ++i) {
+		COUNT_TRAVERSAL(z, 1);
+		bool hit = records != nullptr
+			? RayTriangleRecordAnyHit(ray, records[node.startIndex + i], rayLength)
+			: RayTriangleAnyHit(ray, triangles[node.startIndex + i], rayLength);
+		if (hit)
+			return true;
+	}
+	return false;
+}
+
+static void finishLeafHit(const Ray& ray, const Triangle* triangles, const TriangleRecord* records, TriangleHitInfo& result) {
+	if (records != nullptr && result.didHit)
+		FinishTriangleHit(ray, triangles[result.triIndex], result);
+}
+
+// Near/far traversal with a fixed stack, trees deeper than 31 levels overflow it (see BVHAnalysis)
+TriangleHitInfo CPURayTracer::rayTriangleBVH(const Ray& ray, float rayLength, int nodeOffset, int triOffset) const {
+	if (settings.stacklessTraversal)
+		return rayTriangleBVHStackless(ray, rayLength, nodeOffset, triOffset);
+
+	const std::vector<BVHNode>& nodes = *m_nodes;
+	const Triangle* triangles = m_triangles->data() + triOffset;
+	const TriangleRecord* records = triangleRecords(triOffset);
+
+	TriangleHitInfo result;
+	result.didHit = false;
+	result.dst = rayLength;
+	result.triIndex = -1;
+
+	int stack[32];
+	int stackIndex = 0;
+	stack[stackIndex++] = nodeOffset;
+
+	while (stackIndex > 0) {
+		const BVHNode& node = nodes[stack[--stackIndex]];
+		COUNT_TRAVERSAL(x, 1);
+		READ_NODE(node);
+
+		if (node.triangleCount > 0) {
+			rayTriangleLeaf(ray, node, triangles, records, result);
+		}
+		else {
+			int leftChildIndex = nodeOffset + node.startIndex + 0;
+			int rightChildIndex = nodeOffset + node.startIndex + 1;
+
+			const BVHNode& leftChild = nodes[leftChildIndex];
+			const BVHNode& rightChild = nodes[rightChildIndex];
+			READ_NODE(leftChild);
+			READ_NODE(rightChild);
+
+			float dstLeft = RayBoundingBoxDst(ray, leftChild.boundsMin, leftChild.boundsMax);
+			float dstRight = RayBoundingBoxDst(ray, rightChild.boundsMin, rightChild.boundsMax);
+			COUNT_TRAVERSAL(y, 2);
+
+			bool isLeftNear = dstLeft <= dstRight;
+			float dstNear = isLeftNear ? dstLeft : dstRight;
+			float dstFar = isLeftNear ? dstRight : dstLeft;
+			int childIndexNear = isLeftNear ? leftChildIndex : rightChildIndex;
+			int childIndexFar = isLeftNear ? rightChildIndex : leftChildIndex;
+
+			if (dstFar < result.dst) stack[stackIndex++] = childIndexFar;
+			if (dstNear < result.dst) stack[stackIndex++] = childIndexNear;
+		}
+	}
+
+	finishLeafHit(ray, triangles, records, result);
+	return result;
+}
+
+// Any hit traversal, returns as soon as one triangle closer than rayLength is found
+// Children don't need near/far ordering since we don't look for the closest hit
+bool CPURayTracer::rayTriangleBVHOccluded(const Ray& ray, float rayLength, int nodeOffset, int triOffset) const {
+	if (settings.stacklessTraversal)
+		return rayTriangleBVHOccludedStackless(ray, rayLength, nodeOffset, triOffset);
+
+	const std::vector<BVHNode>& nodes = *m_nodes;
+	const Triangle* triangles = m_triangles->data() + triOffset;
+	const TriangleRecord* records = triangleRecords(triOffset);
+
+	int stack[32];
+	int stackIndex = 0;
+	stack[stackIndex++] = nodeOffset;
+
+	while (stackIndex > 0) {
+		const BVHNode& node = nodes[stack[--stackIndex]];
+		COUNT_TRAVERSAL(x, 1);
+		READ_NODE(node);
+
+		if (node.triangleCount > 0) {
+			if (rayTriangleLeafOccluded(ray, node, triangles, records, rayLength))
+				return true;
+		}
+		else {
+			int leftChildIndex = nodeOffset + node.startIndex + 0;
+			int rightChildIndex = nodeOffset + node.startIndex + 1;
+
+			const BVHNode& leftChild = nodes[leftChildIndex];
+			const BVHNode& rightChild = nodes[rightChildIndex];
+			READ_NODE(leftChild);
+			READ_NODE(rightChild);
+			COUNT_TRAVERSAL(y, 2);
+
+			if (RayBoundingBoxDst(ray, rightChild.boundsMin, rightChild.boundsMax) < rayLength) stack[stackIndex++] = rightChildIndex;
+			if (RayBoundingBoxDst(ray, leftChild.boundsMin, leftChild.boundsMax) < rayLength) stack[stackIndex++] = leftChildIndex;
+		}
+	}
+
+	return false;
+}
+
+// Stackless traversal over parent links (Hapala et al. 2011), same as compute.glsl.
+// Children are visited near first, picked by the ray direction along the parent's split axis, so the order can be
+// recomputed on the way back up. Only the current node & its ancestors are needed, it works at any depth without a stack
+
+// 0 if the left child is the near one, else 1
+static int nearChildOffset(const BVHNode& node, const Ray& ray) {
+	return ray.dir[node.splitAxis] < 0 ? 1 : 0;
+}
+
+// farChild is finished & so is its parent. Walks up until a finished node is a near child & returns its sibling,
+// the next node to visit, or -1 once the whole tree is done
+static int nextAfterFarChild(const BVHNode& farChild, const BVHNode* nodes, const Ray& ray) {
+	int child = farChild.parentIndex;
+	if (child == 0)
+		return -1;
+	const BVHNode* childNode = &nodes[child];
+	COUNT_TRAVERSAL(x, 1);
+	READ_NODE(*childNode);
+
+	while (true) {
+		int parentIndex = childNode->parentIndex;
+		const BVHNode& parent = nodes[parentIndex];
+		COUNT_TRAVERSAL(x, 1);
+		READ_NODE(parent);
+		int nearOffset = nearChildOffset(parent, ray);
+		if (child == parent.startIndex + nearOffset)
+			return parent.startIndex + 1 - nearOffset;
+		if (parentIndex == 0)
+			return -1;
+		child = parentIndex;
+		childNode = &parent;
+	}
+}
+
+TriangleHitInfo CPURayTracer::rayTriangleBVHStackless(const Ray& ray, float rayLength, int nodeOffset, int triOffset) const {
+	const BVHNode* nodes = m_nodes->data() + nodeOffset;
+	const Triangle* triangles = m_triangles->data() + triOffset;
+	const TriangleRecord* records = triangleRecords(triOffset);
+
+	TriangleHitInfo result;
+	result.didHit = false;
+	result.dst = rayLength;
+	result.triIndex = -1;
+
+	// Like the stack traversal, the root's box isn't tested
+	COUNT_TRAVERSAL(x, 1);
+	READ_NODE(nodes[0]);
+	if (nodes[0].triangleCount > 0) {
+		rayTriangleLeaf(ray, nodes[0], triangles, records, result);
+		finishLeafHit(ray, triangles, records, result);
+		return result;
+	}
+
+	int nearOffset = nearChildOffset(nodes[0], ray);
+	int current = nodes[0].startIndex + nearOffset;
+	int sibling = nodes[0].startIndex + 1 - nearOffset;
+	bool isNearChild = true;
+
+	while (current >= 0) {
+		const BVHNode& node = nodes[current];
+		COUNT_TRAVERSAL(x, 1);
+		READ_NODE(node);
+
+		// Boxes are tested against the closest hit so far
+		COUNT_TRAVERSAL(y, 1);
+		bool hitBox = RayBoundingBoxDst(ray, node.boundsMin, node.boundsMax) < result.dst;
+		if (hitBox && node.triangleCount <= 0) {
+			nearOffset = nearChildOffset(node, ray);
+			current = node.startIndex + nearOffset;
+			sibling = node.startIndex + 1 - nearOffset;
+			isNearChild = true;
+			continue;
+		}
+		if (hitBox)
+			rayTriangleLeaf(ray, node, triangles, records, result);
+
+		// A finished near child continues with its sibling, a finished far child goes back up
+		if (isNearChild) {
+			current = sibling;
+			isNearChild = false;
+		}
+		else {
+			current = nextAfterFarChild(node, nodes, ray);
+		}
+	}
+
+	finishLeafHit(ray, triangles, records, result);
+	return result;
+}
+
+// Same walk as rayTriangleBVHStackless, the near first order just tends to find an occluder sooner
+bool CPURayTracer::rayTriangleBVHOccludedStackless(const Ray& ray, float rayLength, int nodeOffset, int triOffset) const {
+	const BVHNode* nodes = m_nodes->data() + nodeOffset;
+	const Triangle* triangles = m_triangles->data() + triOffset;
+	const TriangleRecord* records = triangleRecords(triOffset);
+
+	COUNT_TRAVERSAL(x, 1);
+	READ_NODE(nodes[0]);
+	if (nodes[0].triangleCount > 0)
+		return rayTriangleLeafOccluded(ray, nodes[0], triangles, records, rayLength);
+
+	int nearOffset = nearChildOffset(nodes[0], ray);
+	int current = nodes[0].startIndex + nearOffset;
+	int sibling = nodes[0].startIndex + 1 - nearOffset;
+	bool isNearChild = true;
+
+	while (current >= 0) {
+		const BVHNode& node = nodes[current];
+		COUNT_TRAVERSAL(x, 1);
+		READ_NODE(node);
+
+		COUNT_TRAVERSAL(y, 1);
+		bool hitBox = RayBoundingBoxDst(ray, node.boundsMin, node.boundsMax) < rayLength;
+		if (hitBox && node.triangleCount <= 0) {
+			nearOffset = nearChildOffset(node, ray);
+			current = node.startIndex + nearOffset;
+			sibling = node.startIndex + 1 - nearOffset;
+			isNearChild = true;
+			continue;
+		}
+		if (hitBox && rayTriangleLeafOccluded(ray, node, triangles, records, rayLength))
+			return true;
+
+		if (isNearChild) {
+			current = sibling;
+			isNearChild = false;
+		}
+		else {
+			current = nextAfterFarChild(node, nodes, ray);
+		}
+	}
+
+	return false;
+}
+
+// Closest primitive closer than dst: planes one by one, then the primitive BVH.
+// Returns the primitive index or -1, dst is shortened to the hit
+int CPURayTracer::rayPrimitives(const Ray& ray, float& dst) const {
+	if (m_primitives == nullptr)
+		return -1;
+
+	const std::vector<Primitive>& primitives = *m_primitives;
+	const std::vector<BVHNode>& nodes = *m_primitiveNodes;
+	int hitIndex = -1;
+
+	for (int i = 0; i < m_primitivePlaneCount; ++i) {
+		float primDst = RayPrimitiveDst(ray, primitives[i]);
+		if (primDst < dst) {
+			dst = primDst;
+			hitIndex = i;
+		}
+	}
+
+	if (nodes.empty())
+		return hitIndex;
+
+	// Unlike the model BVHs the root is tested too, the primitive scene is often small & far away
+	// splitPrimitiveBVH caps the depth at MAX_PRIMITIVE_SPLIT_DEPTH, so 32 entries can't overflow
+	int stack[32];
+	int stackIndex = 0;
+	if (RayBoundingBoxDst(ray, nodes[0].boundsMin, nodes[0].boundsMax) < dst)
+		stack[stackIndex++] = 0;
+
+	while (stackIndex > 0) {
+		const BVHNode& node = nodes[stack[--stackIndex]];
+
+		if (node.triangleCount > 0) {
+			for (int i = node.startIndex; i < node.startIndex + node.triangleCount; ++i) {
+				float primDst = RayPrimitiveDst(ray, primitives[i]);
+				if (primDst < dst) {
+					dst = primDst;
+					hitIndex = i;
+				}
+			}
+		}
+		else {
+			int leftChildIndex = node.startIndex + 0;
+			int rightChildIndex = node.startIndex + 1;
+
+			float dstLeft = RayBoundingBoxDst(ray, nodes[leftChildIndex].boundsMin, nodes[leftChildIndex].boundsMax);
+			float dstRight = RayBoundingBoxDst(ray, nodes[rightChildIndex].boundsMin, nodes[rightChildIndex].boundsMax);
+
+			bool isLeftNear = dstLeft <= dstRight;
+			float dstNear = isLeftNear ? dstLeft : dstRight;
+			float dstFar = isLeftNear ? dstRight : dstLeft;
+			int childIndexNear = isLeftNear ? leftChildIndex : rightChildIndex;
+			int childIndexFar = isLeftNear ? rightChildIndex : leftChildIndex;
+
+			if (dstFar < dst) stack[stackIndex++] = childIndexFar;
+			if (dstNear < dst) stack[stackIndex++] = childIndexNear;
+		}
+	}
+
+	return hitIndex;
+}
+
+bool CPURayTracer::rayPrimitivesOccluded(const Ray& ray, float rayLength) const {
+	if (m_primitives == nullptr)
+		return false;
+
+	const std::vector<Primitive>& primitives = *m_primitives;
+	const std::vector<BVHNode>& nodes = *m_primitiveNodes;
+
+	for (int i = 0; i < m_primitivePlaneCount; ++i) {
+		if (RayPrimitiveDst(ray, primitives[i]) < rayLength)
+			return true;
+	}
+
+	if (nodes.empty())
+		return false;
+
+	int stack[32];
+	int stackIndex = 0;
+	if (RayBoundingBoxDst(ray, nodes[0].boundsMin, nodes[0].boundsMax) < rayLength)
+		stack[stackIndex++] = 0;
+
+	while (stackIndex > 0) {
+		const BVHNode& node = nodes[stack[--stackIndex]];
+
+		if (node.triangleCount > 0) {
+			for (int i = node.startIndex; i < node.startIndex + node.triangleCount; ++i) {
+				if (RayPrimitiveDst(ray, primitives[i]) < rayLength)
+					return true;
+			}
+		}
+		else {
+			int leftChildIndex = node.startIndex + 0;
+			int rightChildIndex = node.startIndex + 1;
+
+			if (RayBoundingBoxDst(ray, nodes[rightChildIndex].boundsMin, nodes[rightChildIndex].boundsMax) < rayLength) stack[stackIndex++] = rightChildIndex;
+			if (RayBoundingBoxDst(ray, nodes[leftChildIndex].boundsMin, nodes[leftChildIndex].boundsMax) < rayLength) stack[stackIndex++] = leftChildIndex;
+		}
+	}
+
+	return false;
+}
+
+bool CPURayTracer::IsOccluded(const Ray& worldRay, float rayLength) const {
+	COUNT_TRAVERSAL(w, 1);
+	if (rayPrimitivesOccluded(worldRay, rayLength))
+		return true;
+
+	Ray localRay;
+
+	for (const Model& model : *m_models) {
+		// The local ray direction isn't normalized, so distances stay in world units
+		localRay.origin = glm::vec3(model.worldToLocalMatrix * glm::vec4(worldRay.origin, 1.0f));
+		localRay.dir = glm::vec3(model.worldToLocalMatrix * glm::vec4(worldRay.dir, 0.0f));
+		localRay.invDir = 1.0f / localRay.dir;
+
+		if (rayTriangleBVHOccluded(localRay, rayLength, model.nodeOffset, model.triOffset))
+			return true;
+	}
+
+	return false;
+}
+
+ModelHitInfo CPURayTracer::CalculateRayCollision(const Ray& worldRay) const {
+	ModelHitInfo result;
+	result.didHit = false;
+	result.dst = inf;
+	result.modelIndex = -1;
+	result.triIndex = -1;
+	result.barycentric = glm::vec2(0.0f);
+	result.uv = glm::vec2(0.0f);
+	result.uvDensity = 0.0f;
+	Ray localRay;
+	COUNT_TRAVERSAL(w, 1);
+
+	for (int i = 0; i < (int)m_models->size(); ++i) {
+		const Model& model = (*m_models)[i];
+
+		// Transform ray into model's local coordinate system
+		localRay.origin = glm::vec3(model.worldToLocalMatrix * glm::vec4(worldRay.origin, 1.0f));
+		localRay.dir = glm::vec3(model.worldToLocalMatrix * glm::vec4(worldRay.dir, 0.0f));
+		localRay.invDir = 1.0f / localRay.dir;
+
+		TriangleHitInfo hit = rayTriangleBVH(localRay, result.dst, model.nodeOffset, model.triOffset);
+
+		if (hit.dst < result.dst) {
+			result.didHit = true;
+			result.dst = hit.dst;
+			result.normal = glm::normalize(glm::vec3(model.localToWorldMatrix * glm::vec4(hit.normal, 0.0f)));
+			result.hitPoint = worldRay.origin + worldRay.dir * hit.dst;
+			result.modelIndex = i;
+			result.triIndex = hit.triIndex;
+			result.barycentric = hit.barycentric;
+		}
+	}
+
+	// Only the closest triangle's material & texture coordinates are fetched
+	if (result.didHit) {
+		const Model& model = (*m_models)[result.modelIndex];
+		const Triangle& tri = (*m_triangles)[model.triOffset + result.triIndex];
+		result.material = (*m_materials)[tri.materialIndex];
+		if (result.material.diffuseTexture >= 0)
+			TriangleTexCoords(tri, model.localToWorldMatrix, result.barycentric, result.uv, result.uvDensity);
+	}
+
+	// Analytic primitives are already in world space, only invDir is missing (Trace doesn't fill it)
+	Ray primitiveRay = worldRay;
+	primitiveRay.invDir = 1.0f / worldRay.dir;
+	float primitiveDst = result.dst;
+	int primitiveIndex = rayPrimitives(primitiveRay, primitiveDst);
+	if (primitiveIndex >= 0) {
+		const Primitive& prim = (*m_primitives)[primitiveIndex];
+		result.didHit = true;
+		result.dst = primitiveDst;
+		result.hitPoint = worldRay.origin + worldRay.dir * primitiveDst;
+		result.normal = PrimitiveNormal(prim, result.hitPoint);
+		result.material = prim.material;
+		result.modelIndex = -2 - primitiveIndex;
+		result.triIndex = -1;
+		result.barycentric = glm::vec2(primitiveDst, 0.0f);
+	}
+
+	return result;
+}
+
+PrimaryHit CPURayTracer::MakePrimaryHit(const ModelHitInfo& hit) {
+	PrimaryHit cached;
+	cached.modelIndex = hit.didHit ? hit.modelIndex : -1;
+	cached.triIndex = hit.triIndex;
+	cached.barycentric = hit.barycentric;
+	return cached;
+}
+
+// Rebuilds the hit of the same camera ray without any traversal
+ModelHitInfo CPURayTracer::LoadPrimaryHit(const PrimaryHit& cached, const Ray& ray) const {
+	ModelHitInfo result;
+	result.didHit = cached.modelIndex != -1;
+	result.dst = inf;
+	result.modelIndex = cached.modelIndex;
+	result.triIndex = cached.triIndex;
+	result.barycentric = cached.barycentric;
+	result.uv = glm::vec2(0.0f);
+	result.uvDensity = 0.0f;
+
+	if (cached.modelIndex >= 0) {
+		const Model& model = (*m_models)[cached.modelIndex];
+		const Triangle& tri = (*m_triangles)[model.triOffset + cached.triIndex];
+		float u = cached.barycentric.x;
+		float v = cached.barycentric.y;
+		float w = 1 - u - v;
+
+		glm::vec3 localPoint = w * tri.posA + u * tri.posB + v * tri.posC;
+		glm::vec3 localNormal = glm::normalize(w * tri.normA + u * tri.normB + v * tri.normC);
+		result.hitPoint = glm::vec3(model.localToWorldMatrix * glm::vec4(localPoint, 1.0f));
+		result.normal = glm::normalize(glm::vec3(model.localToWorldMatrix * glm::vec4(localNormal, 0.0f)));
+		result.dst = glm::dot(result.hitPoint - ray.origin, ray.dir);
+		result.material = (*m_materials)[tri.materialIndex];
+		if (result.material.diffuseTexture >= 0)
+			TriangleTexCoords(tri, model.localToWorldMatrix, cached.barycentric, result.uv, result.uvDensity);
+	}
+	else if (cached.modelIndex <= -2) {
+		const Primitive& prim = (*m_primitives)[-2 - cached.modelIndex];
+		result.dst = cached.barycentric.x;
+		result.hitPoint = ray.origin + ray.dir * result.dst;
+		result.normal = PrimitiveNormal(prim, result.hitPoint);
+		result.material = prim.material;
+	}
+
+	return result;
+}
+
+void CPURayTracer::emissiveTriangle(const Light& light, glm::vec3& posA, glm::vec3& edgeAB, glm::vec3& edgeAC) const {
+	const glm::mat4& localToWorld = (*m_models)[light.modelIndex].localToWorldMatrix;
+	const Triangle& tri = (*m_triangles)[light.triIndex];
+	posA = glm::vec3(localToWorld * glm::vec4(tri.posA, 1.0f));
+	edgeAB = glm::vec3(localToWorld * glm::vec4(tri.posB - tri.posA, 0.0f));
+	edgeAC = glm::vec3(localToWorld * glm::vec4(tri.posC - tri.posA, 0.0f));
+}
+
+// Solid angle pdf of a light picked with probability & a uniform point on it at toLight: probability / area * dst^2 / cos,
+// with area = |cross| / 2 & cos = -dot(cross, toLight) / (|cross| * dst). Only the front emits, the back is culled by the
+// triangle tests so a bounce could never reach it
+static float emissivePdf(float probability, const glm::vec3& edgeAB, const glm::vec3& edgeAC, const glm::vec3& toLight) {
+	float dst2 = glm::dot(toLight, toLight);
+	float projected = -glm::dot(glm::cross(edgeAB, edgeAC), toLight);
+	return projected > 0.0f ? 2.0f * probability * dst2 * std::sqrt(dst2) / projected : 0.0f;
+}
+
+// Alias table: a uniform slot, then the slot's own light or its alias. The point folds the unit square onto the triangle
+glm::vec3 CPURayTracer::sampleEmissiveLight(const glm::vec3& origin, float uLight, const glm::vec2& uPoint, glm::vec3& emission, float& pdf) const {
+	const std::vector<Light>& lights = *m_lights;
+	int count = (int)lights.size();
+	float scaled = uLight * count;
+	int slot = std::min((int)scaled, count - 1);
+	const Light& light = lights[scaled - slot < lights[slot].aliasThreshold ? slot : lights[slot].alias];
+
+	glm::vec3 posA, edgeAB, edgeAC;
+	emissiveTriangle(light, posA, edgeAB, edgeAC);
+	float su = std::sqrt(uPoint.x);
+	glm::vec3 point = posA + edgeAB * (su * (1.0f - uPoint.y)) + edgeAC * (su * uPoint.y);
+
+	const RayTracingMaterial& material = (*m_materials)[(*m_triangles)[light.triIndex].materialIndex];
+	emission = glm::vec3(material.emissionColor) * material.emissionStrength;
+	pdf = emissivePdf(light.probability, edgeAB, edgeAC, point - origin);
+	return point;
+}
+
+static glm::vec2 mod2(glm::vec2 x, glm::vec2 y) {
+	return x - y * glm::floor(x / y);
+}
+
+// Also outputs the first hit features used by the denoiser, misses get the sky color as albedo, no normal & maxDist
+glm::vec3 CPURayTracer::Trace(glm::vec3 rayOrigin, glm::vec3 rayDir, const ModelHitInfo& primaryHit, Sampler& sampler, FirstHitInfo& firstHit) const {
+	glm::vec3 incomingLight = glm::vec3(0.0f);
+	glm::vec3 rayColor = glm::vec3(1.0f);
+
+	firstHit.albedo = glm::vec3(1.0f);
+	firstHit.normal = glm::vec3(0.0f);
+	firstHit.depth = maxDist;
+
+	// Set when the last hit sampled the environment / the emissive triangles explicitly, what this ray escapes to / hits
+	// is then MIS weighted
+	bool sampledEnvironment = false;
+	bool sampledEmitters = false;
+	glm::vec3 lastNormal = glm::vec3(0.0f);
+
+	// Texture LOD treats the whole path as one ray cone from the camera, spreading by a pixel's angle
+	float pixelSpread = viewParams.y / (viewParams.z * (float)m_height);
+	float dstSum = 0.0f;
+
+	for (int bounceIndex = 0; bounceIndex <= settings.maxBounces; ++bounceIndex) {
+		Ray ray;
+		ray.origin = rayOrigin;
+		ray.dir = rayDir;
+		ModelHitInfo hitInfo = bounceIndex == 0 ? primaryHit : CalculateRayCollision(ray);
+
+		if (hitInfo.didHit) {
+			dstSum += hitInfo.dst;
+			RayTracingMaterial material = hitInfo.material;
+
+			if (material.flag == 1) {
+				glm::vec2 c = mod2(glm::floor(glm::vec2(hitInfo.hitPoint)), glm::vec2(2.0f));
+				material.color = (c.x == c.y) ? material.color : glm::vec3(material.emissionColor);
+			}
+
+			// The cone's width at the hit, stretched by how slanted the surface is
+			if (material.diffuseTexture >= 0 && m_textureMips != nullptr) {
+				float cosTheta = std::max(std::abs(glm::dot(hitInfo.normal, rayDir)), 1e-3f);
+				float uvFootprint = hitInfo.uvDensity + std::log2(dstSum * pixelSpread / cosTheta);
+				material.color *= SampleTexture(m_textureMips->data(), m_textureTexels->data(), material.diffuseTexture, hitInfo.uv, uvFootprint);
+			}
+
+			// Albedo is the expected reflectance, so the specular lobe isn't divided out by the denoiser
+			if (bounceIndex == 0) {
+				firstHit.albedo = glm::mix(material.color, glm::vec3(material.specularColor), material.specularProbability);
+				firstHit.normal = hitInfo.normal;
+				firstHit.depth = hitInfo.dst;
+			}
+
+			// Figure out new ray pos & dir
+			bool isSpecularBounce = material.specularProbability >= SampleNext1D(sampler);
+
+			rayOrigin = hitInfo.hitPoint;
+			glm::vec3 diffuseDir = SampleCosineHemisphere(hitInfo.normal, SampleNext2D(sampler));
+			glm::vec3 specularDir = glm::reflect(rayDir, hitInfo.normal);
+
+			rayDir = glm::normalize(glm::mix(diffuseDir, specularDir, material.smoothness * float(isSpecularBounce)));
+
+			// Update light calculation, an emitter the last hit sampled only adds the bounce's MIS share
+			glm::vec3 emittedLight = glm::vec3(material.emissionColor) * material.emissionStrength;
+			float emissionWeight = 1.0f;
+			if (sampledEmitters && hitInfo.modelIndex >= 0) {
+				int lightIndex = (*m_triangles)[(*m_models)[hitInfo.modelIndex].triOffset + hitInfo.triIndex].lightIndex;
+				if (lightIndex >= 0) {
+					glm::vec3 posA, edgeAB, edgeAC;
+					emissiveTriangle((*m_lights)[lightIndex], posA, edgeAB, edgeAC);
+					float lightPdf = emissivePdf((*m_lights)[lightIndex].probability, edgeAB, edgeAC, hitInfo.hitPoint - ray.origin);
+					emissionWeight = PowerHeuristic(std::max(0.0f, glm::dot(lastNormal, ray.dir)) / PI, lightPdf);
+				}
+			}
+			incomingLight += emittedLight * emissionWeight * rayColor;
+
+			// Next event estimation toward the environment map's bright texels, or the sun for the procedural sky. Only for
+			// diffuse bounces whose continuation is still traced (the diffuse bounce is cosine distributed, so the BRDF is
+			// color / PI & its pdf is cos / PI)
+			sampledEnvironment = settings.sunSampling && !isSpecularBounce && bounceIndex < settings.maxBounces;
+			lastNormal = hitInfo.normal;
+			if (sampledEnvironment) {
+				glm::vec3 lightDir;
+				float lightPdf;
+				if (m_environment != nullptr)
+					lightDir = SampleEnvironmentDirection(*m_environment, SampleNext2D(sampler), lightPdf);
+				else {
+					lightDir = SampleSunDirection(SampleNext2D(sampler));
+					lightPdf = lightDir.y >= 0.0f ? SunPdf(lightDir) : 0.0f;
+				}
+				float cosTheta = glm::dot(hitInfo.normal, lightDir);
+
+				if (cosTheta > 0.0f && lightPdf > 0.0f) {
+					Ray shadowRay;
+					shadowRay.origin = hitInfo.hitPoint;
+					shadowRay.dir = lightDir;
+					shadowRay.invDir = 1.0f / lightDir;
+
+					if (!IsOccluded(shadowRay, inf)) {
+						float weight = PowerHeuristic(lightPdf, cosTheta / PI);
+						glm::vec3 light = m_environment != nullptr ? EnvironmentRadiance(*m_environment, lightDir) : GetSunLight(lightDir);
+						incomingLight += light * material.color * (cosTheta / PI / lightPdf * weight) * rayColor;
+					}
+				}
+			}
+
+			// Same toward one point on one emissive triangle, the shadow ray stops just short of it
+			sampledEmitters = settings.lightSampling && m_lights != nullptr && !m_lights->empty() && !isSpecularBounce && bounceIndex < settings.maxBounces;
+			if (sampledEmitters) {
+				float uLight = SampleNext1D(sampler);
+				glm::vec2 uPoint = SampleNext2D(sampler);
+				glm::vec3 emission;
+				float lightPdf;
+				glm::vec3 toLight = sampleEmissiveLight(hitInfo.hitPoint, uLight, uPoint, emission, lightPdf) - hitInfo.hitPoint;
+				float lightDst = glm::length(toLight);
+				glm::vec3 lightDir = toLight / lightDst;
+				float cosTheta = glm::dot(hitInfo.normal, lightDir);
+
+				if (cosTheta > 0.0f && lightPdf > 0.0f) {
+					Ray shadowRay;
+					shadowRay.origin = hitInfo.hitPoint;
+					shadowRay.dir = lightDir;
+					shadowRay.invDir = 1.0f / lightDir;
+
+					if (!IsOccluded(shadowRay, lightDst * (1.0f - 1e-4f))) {
+						float weight = PowerHeuristic(lightPdf, cosTheta / PI);
+						incomingLight += emission * material.color * (cosTheta / PI / lightPdf * weight) * rayColor;
+					}
+				}
+			}
+
+			rayColor *= isSpecularBounce ? glm::vec3(material.specularColor) : material.color;
+
+			// Random early exit if rayColor is nearly 0 (no contrib. to final color anyways)
+			float p = std::max(rayColor.r, std::max(rayColor.g, rayColor.b));
+			if (SampleNext1D(sampler) >= p)
+				break;
+			rayColor *= 1.0f / p;
+		}
+		else {
+			// The light was sampled at the last hit, only add the bounce's MIS share of it
+			float bouncePdf = std::max(0.0f, glm::dot(lastNormal, rayDir)) / PI;
+			if (m_environment != nullptr) {
+				glm::vec3 light = EnvironmentRadiance(*m_environment, rayDir);
+				if (bounceIndex == 0)
+					firstHit.albedo = glm::clamp(light, 0.0f, 1.0f);
+				float weight = sampledEnvironment ? PowerHeuristic(bouncePdf, EnvironmentPdf(*m_environment, rayDir)) : 1.0f;
+				incomingLight += light * weight * rayColor;
+			}
+			else {
+				if (bounceIndex == 0)
+					firstHit.albedo = glm::clamp(GetEnvironmentLight(rayDir), 0.0f, 1.0f);
+				float sunWeight = sampledEnvironment ? PowerHeuristic(bouncePdf, SunPdf(rayDir)) : 1.0f;
+				incomingLight += (GetSkyLight(rayDir) + GetSunLight(rayDir) * sunWeight) * rayColor;
+			}
+			break;
+		}
+	}
+
+	return incomingLight;
+}
@@ -0,0 +1,153 @@
+#include "Denoiser.h"
+
+#include <cmath>
+#include <algorithm>
+
+#include "ParallelFor.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DENOISER_USE_SSE 1
+#include <emmintrin.h>
+#endif
+
+// B3 spline kernel used by every a-trous iteration
+static const float kernelWeights[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+// Smallest albedo we divide by, keeps black materials from blowing up
+static const float minAlbedo = 1e-3f;
+
+#ifdef DENOISER_USE_SSE
+static inline float horizontalSum(__m128 v) {
+	__m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 sums = _mm_add_ps(v, shuf);
+	shuf = _mm_movehl_ps(shuf, sums);
+	sums = _mm_add_ss(sums, shuf);
+	return _mm_cvtss_f32(sums);
+}
+#endif
+
+void Denoiser::Denoise(int width, int height,
+	const std::vector<glm::vec4>& color,
+	const std::vector<glm::vec4>& albedoDepth,
+	const std::vector<glm::vec4>& normal,
+	std::vector<glm::vec4>& out)
+{
+	size_t pixelCount = (size_t)width * height;
+	out.resize(pixelCount);
+	if (pixelCount == 0)
+		return;
+
+	m_pingBuffer.resize(pixelCount);
+	m_pongBuffer.resize(pixelCount);
+
+	// Demodulate albedo, we filter irradiance only
+	ParallelFor((int)pixelCount, [&](int i) {
+		glm::vec3 albedo = glm::max(glm::vec3(albedoDepth[i]), glm::vec3(minAlbedo));
+		m_pingBuffer[i] = glm::vec4(glm::vec3(color[i]) / albedo, color[i].a);
+	}, 4096);
+
+	float colorSigma = settings.colorSigma;
+	for (int i = 0; i < settings.iterations; ++i) {
+		filterPass(width, height, 1 << i, colorSigma, m_pingBuffer, albedoDepth, normal, m_pongBuffer);
+		std::swap(m_pingBuffer, m_pongBuffer);
+		colorSigma *= 0.5f;
+	}
+
+	// Modulate albedo back in
+	ParallelFor((int)pixelCount, [&](int i) {
+		glm::vec3 albedo = glm::max(glm::vec3(albedoDepth[i]), glm::vec3(minAlbedo));
+		out[i] = glm::vec4(glm::vec3(m_pingBuffer[i]) * albedo, color[i].a);
+	}, 4096);
+}
+
+void Denoiser::filterPass(int width, int height, int stepSize, float colorSigma,
+	const std::vector<glm::vec4>& src,
+	const std::vector<glm::vec4>& albedoDepth,
+	const std::vector<glm::vec4>& normal,
+	std::vector<glm::vec4>& dst) const
+{
+	float invColorSigma2 = 1.0f / std::max(colorSigma * colorSigma, 1e-8f);
+	float invNormalSigma2 = 1.0f / (settings.normalSigma * settings.normalSigma);
+	float invAlbedoSigma2 = 1.0f / (settings.albedoSigma * settings.albedoSigma);
+	float invDepthSigma2 = 1.0f / (settings.depthSigma * settings.depthSigma);
+
+	ParallelFor(height, [&](int y) {
+		for (int x = 0; x < width; ++x) {
+			size_t p = (size_t)y * width + x;
+
+			// Depth difference is relative to the center depth so the filter behaves the same near & far
+			float centerDepth = std::max(albedoDepth[p].a, 1e-4f);
+			float depthScale = invDepthSigma2 / (centerDepth * centerDepth);
+
+#ifdef DENOISER_USE_SSE
+			const __m128 colorScale = _mm_set_ps(0.0f, invColorSigma2, invColorSigma2, invColorSigma2);
+			const __m128 normalScale = _mm_set_ps(0.0f, invNormalSigma2, invNormalSigma2, invNormalSigma2);
+			const __m128 albedoDepthScale = _mm_set_ps(depthScale, invAlbedoSigma2, invAlbedoSigma2, invAlbedoSigma2);
+
+			__m128 cp = _mm_loadu_ps(&src[p].x);
+			__m128 np = _mm_loadu_ps(&normal[p].x);
+			__m128 ap = _mm_loadu_ps(&albedoDepth[p].x);
+
+			__m128 sum = _mm_setzero_ps();
+			float weightSum = 0.0f;
+#else
+			glm::vec3 sum = glm::vec3(0.0f);
+			float weightSum = 0.0f;
+#endif
+
+			for (int ky = -2; ky <= 2; ++ky) {
+				int qy = y + ky * stepSize;
+				if (qy < 0 || qy >= height)
+					continue;
+
+				for (int kx = -2; kx <= 2; ++kx) {
+					int qx = x + kx * stepSize;
+					if (qx < 0 || qx >= width)
+						continue;
+
+					size_t q = (size_t)qy * width + qx;
+					float h = kernelWeights[kx + 2] * kernelWeights[ky + 2];
+
+#ifdef DENOISER_USE_SSE
+					__m128 cq = _mm_loadu_ps(&src[q].x);
+					__m128 dc = _mm_sub_ps(cq, cp);
+					__m128 dn = _mm_sub_ps(_mm_loadu_ps(&normal[q].x), np);
+					__m128 da = _mm_sub_ps(_mm_loadu_ps(&albedoDepth[q].x), ap);
+
+					// All 4 edge stopping terms summed in one register, one exp per tap
+					__m128 dist = _mm_mul_ps(_mm_mul_ps(dc, dc), colorScale);
+					dist = _mm_add_ps(dist, _mm_mul_ps(_mm_mul_ps(dn, dn), normalScale));
+					dist = _mm_add_ps(dist, _mm_mul_ps(_mm_mul_ps(da, da), albedoDepthScale));
+
+					float w = h * std::exp(-horizontalSum(dist));
+					sum = _mm_add_ps(sum, _mm_mul_ps(cq, _mm_set1_ps(w)));
+					weightSum += w;
+#else
+					glm::vec3 dc = glm::vec3(src[q]) - glm::vec3(src[p]);
+					glm::vec3 dn = glm::vec3(normal[q]) - glm::vec3(normal[p]);
+					glm::vec3 da = glm::vec3(albedoDepth[q]) - glm::vec3(albedoDepth[p]);
+					float dz = albedoDepth[q].a - albedoDepth[p].a;
+
+					float dist = glm::dot(dc, dc) * invColorSigma2
+						+ glm::dot(dn, dn) * invNormalSigma2
+						+ glm::dot(da, da) * invAlbedoSigma2
+						+ dz * dz * depthScale;
+
+					float w = h * std::exp(-dist);
+					sum += glm::vec3(src[q]) * w;
+					weightSum += w;
+#endif
+				}
+			}
+
+			// Center tap always has weight h > 0, so weightSum is never 0
+#ifdef DENOISER_USE_SSE
+			glm::vec4 result;
+			_mm_storeu_ps(&result.x, _mm_mul_ps(sum, _mm_set1_ps(1.0f / weightSum)));
+			dst[p] = glm::vec4(glm::vec3(result), src[p].a);
+#else
+			dst[p] = glm::vec4(sum / weightSum, src[p].a);
+#endif
+		}
+	});
+}
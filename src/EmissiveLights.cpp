@@ -0,0 +1,84 @@
+#include "EmissiveLights.h"
+
+#include <chrono>
+#include <cstdio>
+
+#include "ParallelFor.h"
+
+LightBuildStats AddEmissiveTriangles(std::vector<Light>& lights, std::vector<Triangle>& triangles,
+	const std::vector<RayTracingMaterial>& materials, int modelIndex, int triOffset) {
+	auto start = std::chrono::steady_clock::now();
+
+	LightBuildStats stats;
+	int count = (int)triangles.size() - triOffset;
+	stats.triangles = count;
+
+	// Power of every triangle, 0 for the ones that don't emit. Area is taken in model space, so the probabilities
+	// only approximate the power of non uniformly scaled models (the pdfs stay exact)
+	std::vector<float> power(count);
+	ParallelFor(count, [&](int i) {
+		const Triangle& tri = triangles[triOffset + i];
+		const RayTracingMaterial& material = materials[tri.materialIndex];
+		glm::vec3 emission = glm::vec3(material.emissionColor) * material.emissionStrength;
+		float luminance = glm::dot(emission, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+		float area = 0.5f * glm::length(glm::cross(tri.posB - tri.posA, tri.posC - tri.posA));
+		power[i] = luminance > 0.0f ? luminance * area : 0.0f;
+	}, LIGHT_SCAN_CHUNK_SIZE);
+
+	for (int i = 0; i < count; ++i) {
+		Triangle& tri = triangles[triOffset + i];
+		tri.lightIndex = -1;
+		if (!(power[i] > 0.0f))
+			continue;
+
+		tri.lightIndex = (int)lights.size();
+		Light& light = lights.emplace_back();
+		light.modelIndex = modelIndex;
+		light.triIndex = triOffset + i;
+		light.power = power[i];
+		stats.lights++;
+	}
+
+	if (stats.lights > 0)
+		BuildLightAliasTable(lights);
+
+	stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
+
+void BuildLightAliasTable(std::vector<Light>& lights) {
+	int count = (int)lights.size();
+	double totalPower = 0.0;
+	for (const Light& light : lights)
+		totalPower += light.power;
+
+	// Every slot holds 1 / count of the probability: lights below that share their slot with one above it
+	std::vector<double> scaled(count);
+	std::vector<int> small, large;
+	for (int i = 0; i < count; ++i) {
+		lights[i].probability = (float)(lights[i].power / totalPower);
+		lights[i].aliasThreshold = 1.0f;
+		lights[i].alias = i;
+		scaled[i] = lights[i].power / totalPower * count;
+		(scaled[i] < 1.0 ? small : large).push_back(i);
+	}
+
+	while (!small.empty() && !large.empty()) {
+		int under = small.back();
+		small.pop_back();
+		int over = large.back();
+		large.pop_back();
+
+		lights[under].aliasThreshold = (float)scaled[under];
+		lights[under].alias = over;
+		scaled[over] -= 1.0 - scaled[under];
+		(scaled[over] < 1.0 ? small : large).push_back(over);
+	}
+	// What's left is 1 up to rounding & keeps its own slot
+}
+
+std::string FormatLightBuildStats(const LightBuildStats& stats) {
+	char text[256];
+	snprintf(text, sizeof(text), "Found %d emissive triangles of %d in %.3f s\n", stats.lights, stats.triangles, stats.seconds);
+	return text;
+}
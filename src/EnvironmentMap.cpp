@@ -0,0 +1,97 @@
+#include "EnvironmentMap.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+#include <stb_image/stb_image.h>
+
+#include "ParallelFor.h"
+
+static const float PI = 3.1415926f;
+
+bool LoadEnvironmentMap(const std::string& path, float intensity, EnvironmentMap& map, EnvironmentLoadStats* stats) {
+	auto start = std::chrono::steady_clock::now();
+
+	map = EnvironmentMap();
+	int width = 0, height = 0, channels = 0;
+	float* pixels = stbi_loadf(path.c_str(), &width, &height, &channels, 3);
+	if (pixels == nullptr || width <= 0 || height <= 0) {
+		stbi_image_free(pixels);
+		return false;
+	}
+
+	map.width = width;
+	map.height = height;
+	map.texels.resize((size_t)width * height);
+	ParallelFor(height, [&](int y) {
+		for (int x = 0; x < width; ++x) {
+			const float* pixel = pixels + ((size_t)y * width + x) * 3;
+			map.texels[(size_t)y * width + x] = glm::vec4(pixel[0] * intensity, pixel[1] * intensity, pixel[2] * intensity, 0.0f);
+		}
+	}, 16);
+	stbi_image_free(pixels);
+
+	auto cdfStart = std::chrono::steady_clock::now();
+	BuildEnvironmentCdf(map);
+
+	if (stats != nullptr) {
+		auto end = std::chrono::steady_clock::now();
+		stats->width = width;
+		stats->height = height;
+		stats->loadSeconds = std::chrono::duration<double>(cdfStart - start).count();
+		stats->cdfSeconds = std::chrono::duration<double>(end - cdfStart).count();
+	}
+	return true;
+}
+
+void BuildEnvironmentCdf(EnvironmentMap& map) {
+	int width = map.width;
+	int height = map.height;
+	map.marginalCdf.assign(height, 0.0f);
+	if (map.Empty())
+		return;
+
+	// Every row on its own: running sum of luminance * sin(theta) (the solid angle of its texels), then normalised.
+	// Rows that are black everywhere get a uniform CDF, they are never picked anyway
+	std::vector<double> rowSums(height);
+	ParallelFor(height, [&](int y) {
+		glm::vec4* row = map.texels.data() + (size_t)y * width;
+		float sinTheta = std::sin(PI * (y + 0.5f) / height);
+
+		double sum = 0.0;
+		for (int x = 0; x < width; ++x) {
+			glm::vec3 radiance = glm::vec3(row[x]);
+			if (!(std::isfinite(radiance.x) && std::isfinite(radiance.y) && std::isfinite(radiance.z)))
+				radiance = glm::vec3(0.0f);
+			radiance = glm::max(radiance, glm::vec3(0.0f));
+
+			sum += glm::dot(radiance, glm::vec3(0.2126f, 0.7152f, 0.0722f)) * sinTheta;
+			row[x] = glm::vec4(radiance, (float)sum);
+		}
+		rowSums[y] = sum;
+
+		for (int x = 0; x < width; ++x)
+			row[x].a = sum > 0.0 ? (float)(row[x].a / sum) : (float)(x + 1) / width;
+		row[width - 1].a = 1.0f;
+	}, 8);
+
+	double total = 0.0;
+	for (double rowSum : rowSums)
+		total += rowSum;
+
+	double running = 0.0;
+	for (int y = 0; y < height; ++y) {
+		running += rowSums[y];
+		map.marginalCdf[y] = total > 0.0 ? (float)(running / total) : (float)(y + 1) / height;
+	}
+	map.marginalCdf[height - 1] = 1.0f;
+}
+
+std::string FormatEnvironmentLoadStats(const EnvironmentLoadStats& stats) {
+	char text[256];
+	snprintf(text, sizeof(text), "Loaded %dx%d environment map in %.3f s, sampling CDF built in %.3f s\n",
+		stats.width, stats.height, stats.loadSeconds, stats.cdfSeconds);
+	return text;
+}
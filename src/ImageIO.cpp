@@ -0,0 +1,137 @@
+#include "ImageIO.h"
+
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+
+// PFM stores rows bottom to top, which is already our layout.
+// A negative scale marks the data as little endian.
+bool WritePFM(const std::string& path, int width, int height, const std::vector<glm::vec4>& pixels)
+{
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == nullptr)
+		return false;
+
+	fprintf(file, "PF\n%d %d\n-1.0\n", width, height);
+
+	std::vector<float> row((size_t)width * 3);
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			const glm::vec4& p = pixels[(size_t)y * width + x];
+			row[x * 3 + 0] = p.r;
+			row[x * 3 + 1] = p.g;
+			row[x * 3 + 2] = p.b;
+		}
+		fwrite(row.data(), sizeof(float), row.size(), file);
+	}
+
+	bool ok = ferror(file) == 0;
+	fclose(file);
+	return ok;
+}
+
+static uint32_t pngCrc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+{
+	static uint32_t table[256];
+	static bool tableReady = false;
+	if (!tableReady) {
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k)
+				c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+		tableReady = true;
+	}
+
+	crc = ~crc;
+	for (size_t i = 0; i < size; ++i)
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+static void appendBigEndian(std::vector<uint8_t>& out, uint32_t value)
+{
+	out.push_back((uint8_t)(value >> 24));
+	out.push_back((uint8_t)(value >> 16));
+	out.push_back((uint8_t)(value >> 8));
+	out.push_back((uint8_t)(value));
+}
+
+static void writeChunk(FILE* file, const char* type, const std::vector<uint8_t>& data)
+{
+	std::vector<uint8_t> chunk;
+	chunk.reserve(data.size() + 12);
+	appendBigEndian(chunk, (uint32_t)data.size());
+	chunk.insert(chunk.end(), type, type + 4);
+	chunk.insert(chunk.end(), data.begin(), data.end());
+	appendBigEndian(chunk, pngCrc32(chunk.data() + 4, data.size() + 4));
+	fwrite(chunk.data(), 1, chunk.size(), file);
+}
+
+// PNG with uncompressed (stored) deflate blocks, no zlib dependency needed
+bool WritePNG(const std::string& path, int width, int height, const std::vector<glm::vec4>& pixels)
+{
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == nullptr)
+		return false;
+
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	fwrite(signature, 1, sizeof(signature), file);
+
+	std::vector<uint8_t> header;
+	appendBigEndian(header, (uint32_t)width);
+	appendBigEndian(header, (uint32_t)height);
+	header.push_back(8); // bit depth
+	header.push_back(2); // RGB
+	header.push_back(0); // deflate
+	header.push_back(0); // adaptive filtering
+	header.push_back(0); // no interlace
+	writeChunk(file, "IHDR", header);
+
+	// Raw scanlines, PNG is top to bottom so flip rows
+	size_t stride = (size_t)width * 3 + 1;
+	std::vector<uint8_t> raw(stride * height);
+	for (int y = 0; y < height; ++y) {
+		uint8_t* line = &raw[stride * y];
+		line[0] = 0; // filter: none
+		for (int x = 0; x < width; ++x) {
+			const glm::vec4& p = pixels[(size_t)(height - 1 - y) * width + x];
+			for (int c = 0; c < 3; ++c)
+				line[1 + x * 3 + c] = (uint8_t)(std::min(std::max(p[c], 0.0f), 1.0f) * 255.0f + 0.5f);
+		}
+	}
+
+	// zlib stream made of stored blocks (max 65535 bytes each) & adler32 checksum
+	std::vector<uint8_t> zlib;
+	zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+	zlib.push_back(0x78);
+	zlib.push_back(0x01);
+
+	uint32_t adlerA = 1, adlerB = 0;
+	size_t offset = 0;
+	do {
+		size_t blockSize = std::min<size_t>(raw.size() - offset, 65535);
+		bool lastBlock = offset + blockSize == raw.size();
+		zlib.push_back(lastBlock ? 1 : 0);
+		zlib.push_back((uint8_t)(blockSize & 0xFF));
+		zlib.push_back((uint8_t)(blockSize >> 8));
+		zlib.push_back((uint8_t)(~blockSize & 0xFF));
+		zlib.push_back((uint8_t)((~blockSize >> 8) & 0xFF));
+		zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + blockSize);
+
+		for (size_t i = offset; i < offset + blockSize; ++i) {
+			adlerA = (adlerA + raw[i]) % 65521;
+			adlerB = (adlerB + adlerA) % 65521;
+		}
+		offset += blockSize;
+	} while (offset < raw.size());
+	appendBigEndian(zlib, (adlerB << 16) | adlerA);
+
+	writeChunk(file, "IDAT", zlib);
+	writeChunk(file, "IEND", std::vector<uint8_t>());
+
+	bool ok = ferror(file) == 0;
+	fclose(file);
+	return ok;
+}
@@ -0,0 +1,141 @@
+#include "MeshSanitizer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+#include "ParallelFor.h"
+
+// Triangles per ParallelFor work item
+#define SANITIZE_CHUNK_SIZE 1024
+
+static bool isFinite(const glm::vec3& v) {
+	return std::isfinite(v.x) && std::isfinite(v.y) && std::isfinite(v.z);
+}
+
+// Unnormalized normals are fine as long as normalize() can't divide by zero or a denormal
+static bool isValidNormal(const glm::vec3& n) {
+	return isFinite(n) && glm::dot(n, n) >= std::numeric_limits<float>::min();
+}
+
+namespace {
+
+// Corners rotated so the smallest comes first, two triangles with the same key cover the same points with the same
+// winding. A flipped copy faces the other way, so it is kept
+struct TriangleKey {
+	glm::vec3 corners[3];
+
+	TriangleKey() = default;
+
+	static bool less(const glm::vec3& a, const glm::vec3& b) {
+		if (a.x != b.x) return a.x < b.x;
+		if (a.y != b.y) return a.y < b.y;
+		return a.z < b.z;
+	}
+
+	explicit TriangleKey(const Triangle& tri) {
+		const glm::vec3 pos[3] = { tri.posA, tri.posB, tri.posC };
+		int first = 0;
+		if (less(pos[1], pos[first])) first = 1;
+		if (less(pos[2], pos[first])) first = 2;
+		for (int i = 0; i < 3; ++i)
+			corners[i] = pos[(first + i) % 3];
+	}
+
+	bool operator<(const TriangleKey& other) const {
+		for (int i = 0; i < 3; ++i) {
+			if (corners[i] != other.corners[i])
+				return less(corners[i], other.corners[i]);
+		}
+		return false;
+	}
+
+	bool operator==(const TriangleKey& other) const {
+		return corners[0] == other.corners[0] && corners[1] == other.corners[1] && corners[2] == other.corners[2];
+	}
+};
+
+}
+
+MeshSanitizeStats SanitizeTriangles(std::vector<Triangle>& triangles, int triOffset) {
+	auto start = std::chrono::steady_clock::now();
+
+	MeshSanitizeStats stats;
+	Triangle* tris = triangles.data() + triOffset;
+	int count = (int)triangles.size() - triOffset;
+	stats.inputTriangles = count;
+
+	// Per triangle: kept or not & how many of its normals were repaired, summed afterwards so workers never share a counter
+	std::vector<uint8_t> keep(count);
+	std::vector<uint8_t> repaired(count);
+	std::vector<TriangleKey> keys(count);
+
+	ParallelFor(count, [&](int i) {
+		Triangle& tri = tris[i];
+		glm::vec3 edgeAB = tri.posB - tri.posA;
+		glm::vec3 edgeAC = tri.posC - tri.posA;
+		glm::vec3 edgeBC = tri.posC - tri.posB;
+		glm::vec3 cross = glm::cross(edgeAB, edgeAC);
+
+		float longestEdge2 = std::max(glm::dot(edgeAB, edgeAB), std::max(glm::dot(edgeAC, edgeAC), glm::dot(edgeBC, edgeBC)));
+		bool valid = isFinite(tri.posA) && isFinite(tri.posB) && isFinite(tri.posC)
+			&& glm::length(cross) > DEGENERATE_TRIANGLE_EPSILON * longestEdge2;
+		keep[i] = valid;
+		if (!valid)
+			return;
+		keys[i] = TriangleKey(tri);
+
+		glm::vec3 faceNormal = glm::normalize(cross);
+		glm::vec3* normals[3] = { &tri.normA, &tri.normB, &tri.normC };
+		for (glm::vec3* normal : normals) {
+			if (!isValidNormal(*normal)) {
+				*normal = faceNormal;
+				repaired[i]++;
+			}
+		}
+	}, SANITIZE_CHUNK_SIZE);
+
+	// Duplicates: sort the valid triangles by key, every run of equal keys keeps its lowest index
+	std::vector<int> order;
+	order.reserve(count);
+	for (int i = 0; i < count; ++i) {
+		if (keep[i])
+			order.push_back(i);
+	}
+	std::sort(order.begin(), order.end(), [&](int a, int b) {
+		if (keys[a] == keys[b])
+			return a < b;
+		return keys[a] < keys[b];
+	});
+	for (size_t i = 1; i < order.size(); ++i) {
+		if (keys[order[i]] == keys[order[i - 1]]) {
+			keep[order[i]] = 0;
+			stats.duplicateTriangles++;
+		}
+	}
+
+	// Compact, kept triangles keep their order
+	int kept = 0;
+	for (int i = 0; i < count; ++i) {
+		if (keep[i]) {
+			if (kept != i)
+				tris[kept] = tris[i];
+			stats.repairedNormals += repaired[i];
+			kept++;
+		}
+	}
+	triangles.resize(triOffset + kept);
+
+	stats.degenerateTriangles = count - kept - stats.duplicateTriangles;
+	stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
+
+std::string FormatMeshSanitizeStats(const MeshSanitizeStats& stats) {
+	char text[256];
+	snprintf(text, sizeof(text), "Sanitized %d triangles in %.3f s: %d degenerate & %d duplicate removed, %d normals repaired\n",
+		stats.inputTriangles, stats.seconds, stats.degenerateTriangles, stats.duplicateTriangles, stats.repairedNormals);
+	return text;
+}
@@ -0,0 +1,146 @@
+#include "NormalGenerator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "ParallelFor.h"
+
+// Triangles per ParallelFor work item
+#define NORMAL_CHUNK_SIZE 1024
+
+static uint32_t hashPosition(const glm::vec3& pos) {
+	uint32_t bits[3];
+	std::memcpy(bits, &pos, sizeof(bits));
+	// -0 & +0 compare equal, so they must land in the same bucket
+	for (uint32_t& b : bits) {
+		if (b == 0x80000000u)
+			b = 0;
+	}
+
+	uint32_t h = (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	return h;
+}
+
+static bool lessPosition(const glm::vec3& a, const glm::vec3& b) {
+	if (a.x != b.x) return a.x < b.x;
+	if (a.y != b.y) return a.y < b.y;
+	return a.z < b.z;
+}
+
+static float cornerAngle(const glm::vec3& corner, const glm::vec3& a, const glm::vec3& b) {
+	glm::vec3 edgeA = a - corner;
+	glm::vec3 edgeB = b - corner;
+	float lengths = std::sqrt(glm::dot(edgeA, edgeA) * glm::dot(edgeB, edgeB));
+	if (!(lengths > 0.0f))
+		return 0.0f;
+	return std::acos(glm::clamp(glm::dot(edgeA, edgeB) / lengths, -1.0f, 1.0f));
+}
+
+NormalGenerationStats GenerateSmoothNormals(std::vector<Triangle>& triangles, int triOffset, float creaseAngleDegrees) {
+	auto start = std::chrono::steady_clock::now();
+
+	NormalGenerationStats stats;
+	Triangle* tris = triangles.data() + triOffset;
+	int triCount = (int)triangles.size() - triOffset;
+	int cornerCount = triCount * 3;
+	stats.triangles = triCount;
+	if (triCount <= 0)
+		return stats;
+
+	// Below -1 every face passes, even with rounding
+	float cosCrease = creaseAngleDegrees >= 180.0f ? -2.0f : std::cos(glm::radians(creaseAngleDegrees));
+	int bucketCount = std::max(1, cornerCount / NORMAL_BUCKET_CORNERS);
+
+	// Unit face normals (zero for degenerate faces), the angle at every corner & the bucket of every corner
+	std::vector<glm::vec3> faceNormals(triCount);
+	std::vector<float> cornerWeights(cornerCount);
+	std::vector<uint32_t> cornerBuckets(cornerCount);
+
+	ParallelFor(triCount, [&](int t) {
+		const Triangle& tri = tris[t];
+		glm::vec3 cross = glm::cross(tri.posB - tri.posA, tri.posC - tri.posA);
+		float length = glm::length(cross);
+		faceNormals[t] = length > 0.0f && std::isfinite(length) ? cross / length : glm::vec3(0.0f);
+
+		cornerWeights[t * 3 + 0] = cornerAngle(tri.posA, tri.posB, tri.posC);
+		cornerWeights[t * 3 + 1] = cornerAngle(tri.posB, tri.posC, tri.posA);
+		cornerWeights[t * 3 + 2] = cornerAngle(tri.posC, tri.posA, tri.posB);
+
+		cornerBuckets[t * 3 + 0] = hashPosition(tri.posA) % (uint32_t)bucketCount;
+		cornerBuckets[t * 3 + 1] = hashPosition(tri.posB) % (uint32_t)bucketCount;
+		cornerBuckets[t * 3 + 2] = hashPosition(tri.posC) % (uint32_t)bucketCount;
+	}, NORMAL_CHUNK_SIZE);
+
+	// Counting sort of the corners by bucket
+	std::vector<int> bucketStart(bucketCount + 1, 0);
+	for (uint32_t bucket : cornerBuckets)
+		bucketStart[bucket + 1]++;
+	for (int i = 0; i < bucketCount; ++i)
+		bucketStart[i + 1] += bucketStart[i];
+
+	std::vector<int> sortedCorners(cornerCount);
+	{
+		std::vector<int> fill(bucketStart.begin(), bucketStart.end() - 1);
+		for (int c = 0; c < cornerCount; ++c)
+			sortedCorners[fill[cornerBuckets[c]]++] = c;
+	}
+
+	auto cornerPosition = [&](int c) -> const glm::vec3& {
+		const Triangle& tri = tris[c / 3];
+		return c % 3 == 0 ? tri.posA : (c % 3 == 1 ? tri.posB : tri.posC);
+	};
+	auto cornerNormal = [&](int c) -> glm::vec3& {
+		Triangle& tri = tris[c / 3];
+		return c % 3 == 0 ? tri.normA : (c % 3 == 1 ? tri.normB : tri.normC);
+	};
+
+	// Every bucket on its own: equal positions become runs after sorting, a run is one welded vertex.
+	// Corners of one triangle can sit in different buckets, but every corner's normal is only written by its bucket
+	std::vector<int> bucketVertices(bucketCount, 0);
+	ParallelFor(bucketCount, [&](int bucket) {
+		int* first = sortedCorners.data() + bucketStart[bucket];
+		int* last = sortedCorners.data() + bucketStart[bucket + 1];
+		std::sort(first, last, [&](int a, int b) { return lessPosition(cornerPosition(a), cornerPosition(b)); });
+
+		for (int* run = first; run != last;) {
+			int* runEnd = run + 1;
+			while (runEnd != last && cornerPosition(*runEnd) == cornerPosition(*run))
+				runEnd++;
+			bucketVertices[bucket]++;
+
+			for (int* corner = run; corner != runEnd; ++corner) {
+				const glm::vec3& ownNormal = faceNormals[*corner / 3];
+				glm::vec3 sum = glm::vec3(0.0f);
+				for (int* other = run; other != runEnd; ++other) {
+					const glm::vec3& otherNormal = faceNormals[*other / 3];
+					if (glm::dot(ownNormal, otherNormal) >= cosCrease)
+						sum += otherNormal * cornerWeights[*other];
+				}
+
+				// Degenerate faces have no normal of their own, they keep what they had
+				float length = glm::length(sum);
+				if (length > 1e-12f)
+					cornerNormal(*corner) = sum / length;
+			}
+			run = runEnd;
+		}
+	});
+
+	for (int vertices : bucketVertices)
+		stats.vertices += vertices;
+	stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
+
+std::string FormatNormalGenerationStats(const NormalGenerationStats& stats) {
+	char text[256];
+	snprintf(text, sizeof(text), "Generated smooth normals for %d triangles (%d welded vertices) in %.3f s\n",
+		stats.triangles, stats.vertices, stats.seconds);
+	return text;
+}
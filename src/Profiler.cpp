@@ -0,0 +1,189 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+
+const char* GetProfilePhaseName(ProfilePhase phase) {
+	switch (phase) {
+		case ProfilePhase::CpuFrame: return "frame";
+		case ProfilePhase::CpuTrace: return "cpu trace";
+		case ProfilePhase::CpuDenoise: return "denoise";
+		case ProfilePhase::GpuDispatch: return "gpu dispatch";
+		case ProfilePhase::GpuBlit: return "gpu blit";
+		case ProfilePhase::GpuSwap: return "gpu swap";
+		default: return "?";
+	}
+}
+
+// === ProfileSampleRing ===
+
+ProfileSampleRing::ProfileSampleRing(size_t capacity) {
+	size_t size = 1;
+	while (size < capacity)
+		size <<= 1;
+
+	m_slots.reset(new Slot[size]);
+	for (size_t i = 0; i < size; ++i)
+		m_slots[i].sequence.store(i, std::memory_order_relaxed);
+	m_mask = size - 1;
+	m_writeIndex.store(0, std::memory_order_relaxed);
+	m_readIndex = 0;
+}
+
+// A slot is free for write position pos when its sequence is pos, & readable when it is pos + 1
+bool ProfileSampleRing::Push(const ProfileSample& sample) {
+	size_t pos = m_writeIndex.load(std::memory_order_relaxed);
+	Slot* slot;
+	while (true) {
+		slot = &m_slots[pos & m_mask];
+		size_t sequence = slot->sequence.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+		if (diff == 0) {
+			if (m_writeIndex.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0) {
+			return false; // full, the reader is a whole lap behind
+		}
+		else {
+			pos = m_writeIndex.load(std::memory_order_relaxed);
+		}
+	}
+
+	slot->sample = sample;
+	slot->sequence.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+bool ProfileSampleRing::Pop(ProfileSample& sample) {
+	Slot& slot = m_slots[m_readIndex & m_mask];
+	size_t sequence = slot.sequence.load(std::memory_order_acquire);
+	if (sequence != m_readIndex + 1)
+		return false;
+
+	sample = slot.sample;
+	slot.sequence.store(m_readIndex + m_mask + 1, std::memory_order_release);
+	++m_readIndex;
+	return true;
+}
+
+// === FrameProfiler ===
+
+FrameProfiler::FrameProfiler() :
+	m_querySet(0),
+	m_activeGpuPhase(-1),
+	m_ring(4096)
+{
+	glGenQueries(QUERY_SETS * PHASE_COUNT, &m_queries[0][0]);
+	for (int set = 0; set < QUERY_SETS; ++set)
+		std::fill(m_queryPending[set], m_queryPending[set] + PHASE_COUNT, false);
+
+	for (int i = 0; i < PHASE_COUNT; ++i) {
+		m_history[i].reserve(HISTORY_SIZE);
+		m_historyNext[i] = 0;
+	}
+}
+
+FrameProfiler::~FrameProfiler() {
+	glDeleteQueries(QUERY_SETS * PHASE_COUNT, &m_queries[0][0]);
+}
+
+void FrameProfiler::BeginFrame() {
+	m_querySet = (m_querySet + 1) % QUERY_SETS;
+
+	// These were issued QUERY_SETS frames ago, a result that still isn't ready is dropped rather than waited for
+	for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+		if (!m_queryPending[m_querySet][phase])
+			continue;
+		m_queryPending[m_querySet][phase] = false;
+
+		GLuint query = m_queries[m_querySet][phase];
+		GLint available = GL_FALSE;
+		glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available == GL_FALSE)
+			continue;
+
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+		m_ring.Push({ (ProfilePhase)phase, (float)(nanoseconds / 1e6) });
+	}
+}
+
+void FrameProfiler::BeginGpu(ProfilePhase phase) {
+	if (m_activeGpuPhase >= 0)
+		EndGpu();
+
+	m_activeGpuPhase = (int)phase;
+	glBeginQuery(GL_TIME_ELAPSED, m_queries[m_querySet][m_activeGpuPhase]);
+}
+
+void FrameProfiler::EndGpu() {
+	if (m_activeGpuPhase < 0)
+		return;
+
+	glEndQuery(GL_TIME_ELAPSED);
+	m_queryPending[m_querySet][m_activeGpuPhase] = true;
+	m_activeGpuPhase = -1;
+}
+
+void FrameProfiler::RecordCpu(ProfilePhase phase, double milliseconds) {
+	m_ring.Push({ phase, (float)milliseconds });
+}
+
+void FrameProfiler::Collect() {
+	ProfileSample sample;
+	while (m_ring.Pop(sample)) {
+		int phase = (int)sample.phase;
+		std::vector<float>& history = m_history[phase];
+		if ((int)history.size() < HISTORY_SIZE)
+			history.push_back(sample.milliseconds);
+		else
+			history[m_historyNext[phase]] = sample.milliseconds;
+		m_historyNext[phase] = (m_historyNext[phase] + 1) % HISTORY_SIZE;
+	}
+}
+
+ProfilePhaseStats FrameProfiler::GetStats(ProfilePhase phase) const {
+	ProfilePhaseStats stats;
+	std::vector<float> sorted = m_history[(int)phase];
+	if (sorted.empty())
+		return stats;
+
+	std::sort(sorted.begin(), sorted.end());
+	auto percentile = [&](float p) {
+		return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+	};
+	stats.count = (int)sorted.size();
+	stats.p50 = percentile(0.50f);
+	stats.p95 = percentile(0.95f);
+	stats.p99 = percentile(0.99f);
+	stats.max = sorted.back();
+	return stats;
+}
+
+std::string FrameProfiler::FormatReport() const {
+	std::string report;
+	char line[128];
+	for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+		ProfilePhaseStats stats = GetStats((ProfilePhase)phase);
+		if (stats.count == 0)
+			continue;
+
+		snprintf(line, sizeof(line), "%s%s p50 %.2f p95 %.2f p99 %.2f ms", report.empty() ? "" : " | ",
+			GetProfilePhaseName((ProfilePhase)phase), stats.p50, stats.p95, stats.p99);
+		report += line;
+	}
+	return report;
+}
+
+// === CpuProfileScope ===
+
+CpuProfileScope::CpuProfileScope(FrameProfiler& profiler, ProfilePhase phase) :
+	m_profiler(profiler),
+	m_phase(phase),
+	m_start(std::chrono::steady_clock::now())
+{}
+
+CpuProfileScope::~CpuProfileScope() {
+	m_profiler.RecordCpu(m_phase, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count());
+}
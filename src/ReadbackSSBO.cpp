@@ -0,0 +1,107 @@
+#include "ReadbackSSBO.h"
+
+#include <cstring>
+#include <algorithm>
+
+ReadbackSSBO::ReadbackSSBO(GLuint bindingLoc, GLsizeiptr size)
+{
+	m_bindingLocation = bindingLoc;
+	m_size = std::max<GLsizeiptr>(size, 1);
+	m_oldest = 0;
+	m_inFlight = 0;
+
+	// Every region has to start at a valid glBindBufferRange offset
+	GLint alignment = 1;
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	alignment = std::max(alignment, 1);
+	m_regionStride = (m_size + alignment - 1) / alignment * alignment;
+
+	// Immutable storage, mapped once for the lifetime of the buffer. Only cleared by the gpu, so no write access
+	GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &m_id);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_id);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, m_regionStride * REGION_COUNT, nullptr, flags);
+	m_mapped = (const char*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, m_regionStride * REGION_COUNT, flags);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	for (int i = 0; i < REGION_COUNT; ++i)
+		m_fences[i] = nullptr;
+
+	// Something valid stays bound even while no frame writes the buffer
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, m_bindingLocation, m_id, 0, m_size);
+}
+
+ReadbackSSBO::~ReadbackSSBO()
+{
+	Discard();
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_id);
+	glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glDeleteBuffers(1, &m_id);
+}
+
+void ReadbackSSBO::Begin()
+{
+	if (IsFull())
+		return;
+
+	// Zeroed by the gpu in command order, nothing waits for the cpu
+	int region = (m_oldest + m_inFlight) % REGION_COUNT;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_id);
+	glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, m_regionStride * region, m_regionStride, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, m_bindingLocation, m_id, m_regionStride * region, m_size);
+}
+
+void ReadbackSSBO::End()
+{
+	if (IsFull())
+		return;
+
+	// Shader writes have to reach the mapping before the fence signals
+	glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+	int region = (m_oldest + m_inFlight) % REGION_COUNT;
+	m_fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	m_inFlight++;
+}
+
+bool ReadbackSSBO::Read(void* data, bool wait)
+{
+	if (m_inFlight == 0)
+		return false;
+
+	GLbitfield waitFlags = 0;
+	GLuint64 timeout = 0;
+	while (true) {
+		GLenum result = glClientWaitSync(m_fences[m_oldest], waitFlags, timeout);
+		if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED)
+			break;
+		if (!wait)
+			return false;
+
+		// Make sure the fence is actually submitted before waiting on it
+		waitFlags = GL_SYNC_FLUSH_COMMANDS_BIT;
+		timeout = 1000000; // 1 ms
+	}
+
+	memcpy(data, m_mapped + m_regionStride * m_oldest, m_size);
+	glDeleteSync(m_fences[m_oldest]);
+	m_fences[m_oldest] = nullptr;
+	m_oldest = (m_oldest + 1) % REGION_COUNT;
+	m_inFlight--;
+	return true;
+}
+
+void ReadbackSSBO::Discard()
+{
+	for (int i = 0; i < REGION_COUNT; ++i) {
+		if (m_fences[i] != nullptr)
+			glDeleteSync(m_fences[i]);
+		m_fences[i] = nullptr;
+	}
+	m_oldest = 0;
+	m_inFlight = 0;
+}
@@ -44,3 +44,10 @@ void SSBO::SetData(GLsizeiptr size, const void* data)
 	glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, m_usage);
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0); // Unbind it after use
 }
+
+void SSBO::GetData(GLintptr offset, GLsizeiptr size, void* data)
+{
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_id); // Bind it as a SSBO
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, size, data);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0); // Unbind it after use
+}
@@ -0,0 +1,118 @@
+#include "Sampler.h"
+
+#include <cmath>
+#include <algorithm>
+
+#include "CPURayTracer.h"
+
+#define PI 3.14159265359f
+
+static uint32_t pcgHash(uint32_t v) {
+	uint32_t state = v * 747796405u + 2891336453u;
+	uint32_t word = ((state >> ((state >> 28) + 4)) ^ state) * 277803737u;
+	return (word >> 22) ^ word;
+}
+
+static uint32_t hashCombine(uint32_t seed, uint32_t v) {
+	return seed ^ (v + (seed << 6) + (seed >> 2));
+}
+
+static uint32_t reverseBits(uint32_t x) {
+	x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+	x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+	x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+	x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+	return (x >> 16) | (x << 16);
+}
+
+// Hash based Owen scramble of reversed bits, each bit only depends on the bits below it
+static uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed) {
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return x;
+}
+
+static uint32_t nestedUniformScramble(uint32_t x, uint32_t seed) {
+	return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+}
+
+// Second Sobol dimension, the first one is just reverseBits(index)
+static uint32_t sobolDimension1(uint32_t index) {
+	uint32_t result = 0;
+	for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1) {
+		if (index & 1)
+			result ^= v;
+	}
+	return result;
+}
+
+// Keeps the top 24 bits so the float never rounds up to 1
+static float toUnitFloat(uint32_t x) {
+	return (float)(x >> 8) * (1.0f / 16777216.0f);
+}
+
+static float fract(float x) {
+	return x - std::floor(x);
+}
+
+Sampler CreateSampler(SamplerType type, int pixelX, int pixelY, uint32_t sampleIndex, uint32_t rngState) {
+	Sampler sampler;
+	sampler.type = type;
+	sampler.rngState = rngState;
+	sampler.index = sampleIndex;
+	sampler.dimension = 0;
+
+	// R2 & interleaved gradient noise dither masks, both have most of their energy at high frequencies
+	float x = (float)pixelX;
+	float y = (float)pixelY;
+	sampler.shift = glm::vec2(
+		fract(0.7548776662f * x + 0.5698402909f * y),
+		fract(52.9829189f * fract(0.06711056f * x + 0.00583715f * y)));
+	return sampler;
+}
+
+glm::vec2 SampleNext2D(Sampler& sampler) {
+	if (sampler.type == SamplerType::Independent) {
+		// Sequenced like GLSL's left to right arguments, C++ leaves their order unspecified
+		float ux = RandomValue(sampler.rngState);
+		float uy = RandomValue(sampler.rngState);
+		return glm::vec2(ux, uy);
+	}
+
+	uint32_t dimension = sampler.dimension++;
+	uint32_t seed = pcgHash(dimension);
+
+	// Shuffle the index so dimension pairs aren't correlated, then scramble both coordinates
+	uint32_t index = nestedUniformScramble(sampler.index, seed);
+	glm::vec2 u = glm::vec2(
+		toUnitFloat(nestedUniformScramble(reverseBits(index), hashCombine(seed, 0u))),
+		toUnitFloat(nestedUniformScramble(sobolDimension1(index), hashCombine(seed, 1u))));
+
+	// Per pixel shift, offset along the R2 sequence for every dimension
+	glm::vec2 shift = sampler.shift + (float)dimension * glm::vec2(0.7548776662f, 0.5698402909f);
+	u += shift - glm::floor(shift);
+	return u - glm::floor(u);
+}
+
+float SampleNext1D(Sampler& sampler) {
+	if (sampler.type == SamplerType::Independent)
+		return RandomValue(sampler.rngState);
+	return SampleNext2D(sampler).x;
+}
+
+glm::vec2 SampleDisk(const glm::vec2& u) {
+	float angle = u.x * 2 * PI;
+	return glm::vec2(std::cos(angle), std::sin(angle)) * std::sqrt(u.y);
+}
+
+// normal + a uniform point on the unit sphere is cosine distributed around normal
+glm::vec3 SampleCosineHemisphere(const glm::vec3& normal, const glm::vec2& u) {
+	float z = 1.0f - 2.0f * u.x;
+	float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+	float phi = 2.0f * PI * u.y;
+	glm::vec3 spherePoint = glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+	return glm::normalize(normal + spherePoint);
+}
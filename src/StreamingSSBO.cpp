@@ -0,0 +1,113 @@
+#include "StreamingSSBO.h"
+
+#include <cstring>
+#include <algorithm>
+
+StreamingSSBO::StreamingSSBO(GLuint bindingLoc, GLsizeiptr size, const void* data)
+{
+	m_bindingLocation = bindingLoc;
+	m_size = std::max<GLsizeiptr>(size, 1);
+	m_region = 0;
+
+	// Every region has to start at a valid glBindBufferRange offset
+	GLint alignment = 1;
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	alignment = std::max(alignment, 1);
+	m_regionStride = (m_size + alignment - 1) / alignment * alignment;
+
+	m_data.assign(m_size, 0);
+	if (data != nullptr)
+		memcpy(m_data.data(), data, size);
+
+	// Immutable storage, mapped once for the lifetime of the buffer
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &m_id);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_id);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, m_regionStride * REGION_COUNT, nullptr, flags);
+	m_mapped = (char*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, m_regionStride * REGION_COUNT, flags);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	// Nothing has been dispatched yet, so every region can be filled right away
+	for (int i = 0; i < REGION_COUNT; ++i) {
+		memcpy(m_mapped + m_regionStride * i, m_data.data(), m_size);
+		m_fences[i] = nullptr;
+		m_dirtyBegin[i] = m_size;
+		m_dirtyEnd[i] = 0;
+	}
+
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, m_bindingLocation, m_id, 0, m_size);
+}
+
+StreamingSSBO::~StreamingSSBO()
+{
+	for (int i = 0; i < REGION_COUNT; ++i) {
+		if (m_fences[i] != nullptr)
+			glDeleteSync(m_fences[i]);
+	}
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_id);
+	glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glDeleteBuffers(1, &m_id);
+}
+
+void StreamingSSBO::Update(GLintptr offset, GLsizeiptr size, const void* data)
+{
+	if (size <= 0 || offset < 0 || offset + size > m_size)
+		return;
+
+	memcpy(m_data.data() + offset, data, size);
+
+	// Every region is now behind by this range
+	for (int i = 0; i < REGION_COUNT; ++i) {
+		m_dirtyBegin[i] = std::min<GLintptr>(m_dirtyBegin[i], offset);
+		m_dirtyEnd[i] = std::max<GLintptr>(m_dirtyEnd[i], offset + size);
+	}
+}
+
+void StreamingSSBO::Advance()
+{
+	if (HasPendingUpdates()) {
+		// The current region may still be read by the last dispatch, write into the oldest one instead
+		m_region = (m_region + 1) % REGION_COUNT;
+		waitForRegion(m_region);
+
+		GLintptr begin = m_dirtyBegin[m_region];
+		GLintptr end = m_dirtyEnd[m_region];
+		if (begin < end)
+			memcpy(m_mapped + m_regionStride * m_region + begin, m_data.data() + begin, end - begin);
+		m_dirtyBegin[m_region] = m_size;
+		m_dirtyEnd[m_region] = 0;
+	}
+
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, m_bindingLocation, m_id, m_regionStride * m_region, m_size);
+}
+
+void StreamingSSBO::Fence()
+{
+	if (m_fences[m_region] != nullptr)
+		glDeleteSync(m_fences[m_region]);
+	m_fences[m_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+// With 3 regions the fence is normally signaled long before, so this rarely blocks
+void StreamingSSBO::waitForRegion(int region)
+{
+	if (m_fences[region] == nullptr)
+		return;
+
+	GLbitfield waitFlags = 0;
+	GLuint64 timeout = 0;
+	while (true) {
+		GLenum result = glClientWaitSync(m_fences[region], waitFlags, timeout);
+		if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED)
+			break;
+
+		// Make sure the fence is actually submitted before waiting on it
+		waitFlags = GL_SYNC_FLUSH_COMMANDS_BIT;
+		timeout = 1000000; // 1 ms
+	}
+
+	glDeleteSync(m_fences[region]);
+	m_fences[region] = nullptr;
+}
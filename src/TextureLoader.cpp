@@ -0,0 +1,192 @@
+#include "TextureLoader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include <stb_image/stb_image.h>
+
+#include "ParallelFor.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_USE_SSE 1
+#include <emmintrin.h>
+#endif
+
+// 8 bit sRGB to 16 bit linear & back, mips are averaged in linear space so high contrast textures don't darken
+static const std::vector<uint16_t>& srgbToLinearTable() {
+	static const std::vector<uint16_t> table = []() {
+		std::vector<uint16_t> values(256);
+		for (int i = 0; i < 256; ++i) {
+			float c = i / 255.0f;
+			float linear = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+			values[i] = (uint16_t)std::lround(linear * 65535.0f);
+		}
+		return values;
+	}();
+	return table;
+}
+
+static const std::vector<uint8_t>& linearToSrgbTable() {
+	static const std::vector<uint8_t> table = []() {
+		std::vector<uint8_t> values(65536);
+		for (int i = 0; i < 65536; ++i) {
+			float linear = i / 65535.0f;
+			float c = linear <= 0.0031308f ? linear * 12.92f : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+			values[i] = (uint8_t)std::lround(std::min(std::max(c, 0.0f), 1.0f) * 255.0f);
+		}
+		return values;
+	}();
+	return table;
+}
+
+static inline uint16_t average(uint16_t a, uint16_t b) {
+	return (uint16_t)((a + b + 1) >> 1);
+}
+
+void DownsampleTextureRow(const uint16_t* src, int srcWidth, int srcHeight, uint16_t* dst, int dstWidth, int y) {
+	const uint16_t* row0 = src + (size_t)std::min(2 * y, srcHeight - 1) * srcWidth * 4;
+	const uint16_t* row1 = src + (size_t)std::min(2 * y + 1, srcHeight - 1) * srcWidth * 4;
+	uint16_t* out = dst + (size_t)y * dstWidth * 4;
+
+	int x = 0;
+#ifdef TEXTURE_USE_SSE
+	// 2 destination texels from 4 source texels of both rows, rows first then columns like the scalar loop
+	for (; x + 2 <= dstWidth && 2 * x + 4 <= srcWidth; x += 2) {
+		__m128i top0 = _mm_loadu_si128((const __m128i*)(row0 + 8 * x));
+		__m128i top1 = _mm_loadu_si128((const __m128i*)(row0 + 8 * x + 8));
+		__m128i bottom0 = _mm_loadu_si128((const __m128i*)(row1 + 8 * x));
+		__m128i bottom1 = _mm_loadu_si128((const __m128i*)(row1 + 8 * x + 8));
+
+		// Texels 0 & 1, 2 & 3 averaged vertically, then even with odd texels
+		__m128i column01 = _mm_avg_epu16(top0, bottom0);
+		__m128i column23 = _mm_avg_epu16(top1, bottom1);
+		__m128i result = _mm_avg_epu16(_mm_unpacklo_epi64(column01, column23), _mm_unpackhi_epi64(column01, column23));
+		_mm_storeu_si128((__m128i*)(out + 4 * x), result);
+	}
+#endif
+
+	for (; x < dstWidth; ++x) {
+		int x0 = std::min(2 * x, srcWidth - 1);
+		int x1 = std::min(2 * x + 1, srcWidth - 1);
+		for (int channel = 0; channel < 4; ++channel) {
+			uint16_t left = average(row0[x0 * 4 + channel], row1[x0 * 4 + channel]);
+			uint16_t right = average(row0[x1 * 4 + channel], row1[x1 * 4 + channel]);
+			out[x * 4 + channel] = average(left, right);
+		}
+	}
+}
+
+TextureLoadStats LoadTextures(const std::vector<std::string>& paths, std::vector<TextureMip>& mips,
+	std::vector<uint32_t>& texels, std::vector<int>& textureIndices) {
+	auto start = std::chrono::steady_clock::now();
+
+	TextureLoadStats stats;
+	int count = (int)paths.size();
+	textureIndices.assign(count, -1);
+	if (count == 0)
+		return stats;
+
+	// Decoding dominates, stb_image keeps no shared state while loading so every file gets its own worker
+	std::vector<stbi_uc*> pixels(count, nullptr);
+	std::vector<glm::ivec2> sizes(count, glm::ivec2(0));
+	ParallelFor(count, [&](int i) {
+		int channels = 0;
+		pixels[i] = stbi_load(paths[i].c_str(), &sizes[i].x, &sizes[i].y, &channels, 4);
+	});
+
+	// Lay out every level of every chain, so the workers below only write their own texels
+	size_t texelCount = texels.size();
+	int maxLevels = 0;
+	for (int i = 0; i < count; ++i) {
+		if (pixels[i] == nullptr || sizes[i].x <= 0 || sizes[i].y <= 0) {
+			stats.failed++;
+			continue;
+		}
+
+		int levelCount = 1;
+		while ((std::max(sizes[i].x, sizes[i].y) >> levelCount) > 0)
+			levelCount++;
+		maxLevels = std::max(maxLevels, levelCount);
+
+		textureIndices[i] = (int)mips.size();
+		for (int level = 0; level < levelCount; ++level) {
+			TextureMip& mip = mips.emplace_back();
+			mip.width = std::max(sizes[i].x >> level, 1);
+			mip.height = std::max(sizes[i].y >> level, 1);
+			mip.offset = (int)texelCount;
+			mip.levelCount = levelCount - level;
+			texelCount += (size_t)mip.width * mip.height;
+		}
+		stats.loaded++;
+	}
+	stats.texels = texelCount - texels.size();
+	texels.resize(texelCount);
+
+	// Every level is also kept as 16 bit linear RGBA while the chains are built, at the same offsets as the texels
+	size_t firstTexel = texelCount - stats.texels;
+	std::vector<uint16_t> linear(stats.texels * 4);
+	const std::vector<uint16_t>& toLinear = srgbToLinearTable();
+	const std::vector<uint8_t>& toSrgb = linearToSrgbTable();
+
+	// Level by level, the rows of that level of all textures form one job list so a few large textures spread too
+	std::vector<int> levelTextures;
+	std::vector<int> rowStart;
+	for (int level = 0; level < maxLevels; ++level) {
+		levelTextures.clear();
+		rowStart.assign(1, 0);
+		for (int i = 0; i < count; ++i) {
+			if (textureIndices[i] < 0 || mips[textureIndices[i]].levelCount <= level)
+				continue;
+			levelTextures.push_back(i);
+			rowStart.push_back(rowStart.back() + mips[textureIndices[i] + level].height);
+		}
+
+		ParallelFor(rowStart.back(), [&](int row) {
+			int job = (int)(std::upper_bound(rowStart.begin(), rowStart.end(), row) - rowStart.begin()) - 1;
+			int texture = levelTextures[job];
+			int y = row - rowStart[job];
+			const TextureMip& dst = mips[textureIndices[texture] + level];
+			uint32_t* dstTexels = texels.data() + dst.offset + (size_t)y * dst.width;
+			uint16_t* dstLinear = linear.data() + (dst.offset - firstTexel + (size_t)y * dst.width) * 4;
+
+			// Level 0 comes straight from the file, the others from the level before
+			if (level == 0) {
+				std::memcpy(dstTexels, pixels[texture] + (size_t)y * dst.width * 4, (size_t)dst.width * sizeof(uint32_t));
+				for (int x = 0; x < dst.width; ++x) {
+					uint32_t texel = dstTexels[x];
+					dstLinear[x * 4 + 0] = toLinear[texel & 0xFFu];
+					dstLinear[x * 4 + 1] = toLinear[(texel >> 8) & 0xFFu];
+					dstLinear[x * 4 + 2] = toLinear[(texel >> 16) & 0xFFu];
+					dstLinear[x * 4 + 3] = (uint16_t)((texel >> 24) * 257u);
+				}
+				return;
+			}
+
+			const TextureMip& src = mips[textureIndices[texture] + level - 1];
+			DownsampleTextureRow(linear.data() + (src.offset - firstTexel) * 4, src.width, src.height,
+				linear.data() + (dst.offset - firstTexel) * 4, dst.width, y);
+			for (int x = 0; x < dst.width; ++x) {
+				dstTexels[x] = (uint32_t)toSrgb[dstLinear[x * 4 + 0]]
+					| ((uint32_t)toSrgb[dstLinear[x * 4 + 1]] << 8)
+					| ((uint32_t)toSrgb[dstLinear[x * 4 + 2]] << 16)
+					| ((uint32_t)((dstLinear[x * 4 + 3] + 128u) / 257u) << 24);
+			}
+		}, TEXTURE_ROW_CHUNK);
+	}
+
+	for (stbi_uc* image : pixels)
+		stbi_image_free(image);
+
+	stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
+
+std::string FormatTextureLoadStats(const TextureLoadStats& stats) {
+	char text[256];
+	snprintf(text, sizeof(text), "Loaded %d textures (%.1f MB with mips, %d failed) in %.3f s\n",
+		stats.loaded, stats.texels * sizeof(uint32_t) / (1024.0 * 1024.0), stats.failed, stats.seconds);
+	return text;
+}
@@ -0,0 +1,128 @@
+#include "TraversalStats.h"
+
+#include <algorithm>
+#include <cstdio>
+
+const char* GetTraversalMetricName(TraversalMetric metric) {
+	switch (metric) {
+		case TraversalMetric::Nodes: return "nodes";
+		case TraversalMetric::BoxTests: return "box tests";
+		case TraversalMetric::TriangleTests: return "triangle tests";
+		default: return "?";
+	}
+}
+
+// Per ray value of every pixel that traced something
+static std::vector<float> perRayValues(const std::vector<glm::vec4>& cost, TraversalMetric metric) {
+	std::vector<float> values;
+	values.reserve(cost.size());
+	for (const glm::vec4& pixel : cost) {
+		if (pixel.w > 0)
+			values.push_back(pixel[(int)metric] / pixel.w);
+	}
+	return values;
+}
+
+TraversalCostSummary SummarizeTraversalCost(const std::vector<glm::vec4>& cost, TraversalMetric metric, int binCount) {
+	TraversalCostSummary summary;
+	std::vector<float> values = perRayValues(cost, metric);
+	if (values.empty())
+		return summary;
+
+	std::sort(values.begin(), values.end());
+	auto percentile = [&](float p) {
+		return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+	};
+
+	double sum = 0.0;
+	for (float value : values)
+		sum += value;
+
+	summary.pixels = (int)values.size();
+	summary.mean = (float)(sum / values.size());
+	summary.p50 = percentile(0.50f);
+	summary.p99 = percentile(0.99f);
+	summary.max = values.back();
+
+	binCount = std::max(binCount, 1);
+	summary.histogram.assign(binCount, 0);
+	summary.binWidth = summary.max > 0 ? summary.max / binCount : 1.0f;
+	for (float value : values)
+		summary.histogram[std::min(binCount - 1, (int)(value / summary.binWidth))]++;
+
+	return summary;
+}
+
+std::string FormatTraversalCostSummary(const std::vector<glm::vec4>& cost, int binCount) {
+	std::string report;
+	char line[256];
+	for (int metric = 0; metric < 3; ++metric) {
+		TraversalCostSummary summary = SummarizeTraversalCost(cost, (TraversalMetric)metric, binCount);
+		snprintf(line, sizeof(line), "%s per ray: mean %.1f p50 %.1f p99 %.1f max %.1f (%d pixels)\n",
+			GetTraversalMetricName((TraversalMetric)metric), summary.mean, summary.p50, summary.p99, summary.max, summary.pixels);
+		report += line;
+
+		// One row per bin, the bar is scaled to the fullest bin
+		int fullest = summary.histogram.empty() ? 0 : *std::max_element(summary.histogram.begin(), summary.histogram.end());
+		for (size_t bin = 0; bin < summary.histogram.size(); ++bin) {
+			int count = summary.histogram[bin];
+			int barLength = fullest > 0 ? (count * 40 + fullest - 1) / fullest : 0;
+			snprintf(line, sizeof(line), "  %8.1f - %8.1f %8d %s\n", bin * summary.binWidth, (bin + 1) * summary.binWidth,
+				count, std::string(barLength, '#').c_str());
+			report += line;
+		}
+	}
+	return report;
+}
+
+void TraversalCostHeatmap(const std::vector<glm::vec4>& cost, TraversalMetric metric, float maxValue, std::vector<glm::vec4>& out) {
+	if (maxValue <= 0)
+		maxValue = std::max(SummarizeTraversalCost(cost, metric, 1).p99, 1.0f);
+
+	// Black, blue, red, yellow, white
+	static const glm::vec3 ramp[] = {
+		glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(1.0f, 1.0f, 0.0f), glm::vec3(1.0f)
+	};
+	const int segments = (int)(sizeof(ramp) / sizeof(ramp[0])) - 1;
+
+	out.resize(cost.size());
+	for (size_t i = 0; i < cost.size(); ++i) {
+		float value = cost[i].w > 0 ? cost[i][(int)metric] / cost[i].w : 0.0f;
+		float t = std::min(value / maxValue, 1.0f) * segments;
+		int segment = std::min((int)t, segments - 1);
+		out[i] = glm::vec4(glm::mix(ramp[segment], ramp[segment + 1], t - segment), 1.0f);
+	}
+}
+
+// === NodeCacheModel ===
+
+NodeCacheModel::NodeCacheModel() :
+	m_setCount(NODE_CACHE_SIZE / (NODE_CACHE_LINE * NODE_CACHE_WAYS)),
+	m_lines((size_t)m_setCount * NODE_CACHE_WAYS, 0)
+{}
+
+int NodeCacheModel::Access(const void* address, size_t bytes) {
+	uintptr_t first = (uintptr_t)address / NODE_CACHE_LINE;
+	uintptr_t last = ((uintptr_t)address + bytes - 1) / NODE_CACHE_LINE;
+
+	int misses = 0;
+	for (uintptr_t line = first; line <= last; ++line) {
+		uintptr_t* ways = &m_lines[(line % m_setCount) * NODE_CACHE_WAYS];
+		uintptr_t tag = line + 1;
+
+		// Move the line to the front, a miss shifts out the least recently used way
+		int way = 0;
+		while (way < NODE_CACHE_WAYS - 1 && ways[way] != tag)
+			way++;
+		if (ways[way] != tag)
+			misses++;
+		for (; way > 0; --way)
+			ways[way] = ways[way - 1];
+		ways[0] = tag;
+	}
+	return misses;
+}
+
+void NodeCacheModel::Clear() {
+	std::fill(m_lines.begin(), m_lines.end(), 0);
+}
@@ -6,11 +6,21 @@
 
 #include <stb_image/stb_image.h>
 #include <imgui.h>
+#include <backends/imgui_impl_sdl3.h>
+#include <backends/imgui_impl_opengl3.h>
 
 #include "shader.h"
 #include "ModelLoaderBVHBuilder.h"
+#include "CPURayTracer.h"
+#include "Denoiser.h"
+#include "ImageIO.h"
+#include "TraversalStats.h"
+#include "BVHAnalysis.h"
 #include "openglDebug.h"
 #include "SSBO.h"
+#include "StreamingSSBO.h"
+#include "ReadbackSSBO.h"
+#include "Profiler.h"
 #include "EBO.h"
 #include "VBO.h"
 #include "VAO.h"
@@ -36,6 +46,23 @@ extern "C"
 	__declspec(dllexport) int AmdPowerXpressRequestHighPerformance = USE_GPU_ENGINE;
 }
 
+// (Re)allocates a RGBA32F texture used as a compute shader image
+void allocateImageTexture(unsigned int texture, int width, int height) {
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+}
+
+// Reads a RGBA32F texture back into cpu memory, bottom row first
+void readImageTexture(unsigned int texture, int width, int height, std::vector<glm::vec4>& out) {
+	out.resize((size_t)width * height);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, out.data());
+}
+
 int main(void) {
 
 	int width = 0, height = 0;
@@ -94,23 +121,82 @@ int main(void) {
 	SDL_GetWindowSizeInPixels(pWindow, &width, &height);
 	glViewport(0, 0, width, height);
 
+	// Frame phase timings, shown in an overlay (toggled with F1) & logged once per second
+	IMGUI_CHECKVERSION();
+	ImGui::CreateContext();
+	ImGui::GetIO().IniFilename = nullptr;
+	ImGui_ImplSDL3_InitForOpenGL(pWindow, glContext);
+	ImGui_ImplOpenGL3_Init("#version 440");
+	FrameProfiler profiler;
+	bool showStats = true;
+	double lastReportTime = 0.0;
+
+	// Render settings shared by the gpu & cpu paths, the sample & bounce counts are baked into the compute shader
+	RenderSettings renderSettings;
+
+	// Compute dispatch: TILE_SIZE x TILE_SIZE pixel tiles with one pixel per thread,
+	// 0 falls back to one workgroup per pixel with one sample per thread
+	const int computeTileSize = 8;
+
 	// Create a computer shader
-	Shader computeShader(RESOURCES_PATH "compute.glsl", GL_COMPUTE_SHADER);
+	std::vector<ShaderDefine> computeDefines = {
+		{ "RAYS_PER_PIXEL", std::to_string(renderSettings.raysPerPixel) },
+		{ "MAX_BOUNCES", std::to_string(renderSettings.maxBounces) },
+		{ "TILE_SIZE", std::to_string(computeTileSize) },
+		{ "STACKLESS_TRAVERSAL", renderSettings.stacklessTraversal ? "1" : "0" },
+		{ "PRECOMPUTED_TRIANGLES", renderSettings.precomputedTriangles ? "1" : "0" },
+	};
+#ifdef TRAVERSAL_STATS
+	computeDefines.push_back({ "TRAVERSAL_STATS", "1" });
+#endif
+	Shader computeShader(RESOURCES_PATH "compute.glsl", GL_COMPUTE_SHADER, computeDefines);
 
 	// Computer shader output texture
 	unsigned int texture;
 
 	glGenTextures(1, &texture);
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, texture);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+	allocateImageTexture(texture, width, height);
 
 	glBindImageTexture(0, texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
 
+	// Accumulation texture, holds the running sum of samples while nothing changes
+	unsigned int accumTexture;
+
+	glGenTextures(1, &accumTexture);
+	allocateImageTexture(accumTexture, width, height);
+
+	glBindImageTexture(1, accumTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+
+	// Per pixel luminance mean/variance used by adaptive sampling
+	unsigned int varianceTexture;
+
+	glGenTextures(1, &varianceTexture);
+	allocateImageTexture(varianceTexture, width, height);
+
+	glBindImageTexture(2, varianceTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+
+	// Denoiser features: first hit albedo & distance, first hit normal
+	unsigned int albedoDepthTexture, normalTexture;
+
+	glGenTextures(1, &albedoDepthTexture);
+	allocateImageTexture(albedoDepthTexture, width, height);
+	glGenTextures(1, &normalTexture);
+	allocateImageTexture(normalTexture, width, height);
+
+	glBindImageTexture(3, albedoDepthTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+	glBindImageTexture(4, normalTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+
+#ifdef TRAVERSAL_STATS
+	// Per pixel BVH traversal cost, dumped with H
+	unsigned int traversalCostTexture;
+
+	glGenTextures(1, &traversalCostTexture);
+	allocateImageTexture(traversalCostTexture, width, height);
+
+	glBindImageTexture(5, traversalCostTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+#endif
+
 	// Create a basic Vertex and Fragment shader application
 	Shader shader(RESOURCES_PATH "shader.vert", RESOURCES_PATH "shader.frag");
 	shader.Activate();
@@ -139,12 +225,49 @@ int main(void) {
 		LoadModel(modelPath.c_str(), "model");
 		double timeToLoad = (double)(SDL_GetPerformanceCounter() - startTime) / SDL_GetPerformanceFrequency();
 		std::cout << "It took: " << timeToLoad << " seconds to load the model.\n";
+		if (!modelsBuffer.empty())
+			std::cout << FormatBVHQualityReport(AnalyzeBVH(BVHBuffer, modelsBuffer.back().nodeOffset, TrianglesBuffer, modelsBuffer.back().triOffset));
+	}
+
+	// HDR environment map, "-" keeps the procedural sky & sun
+	EnvironmentMap environment;
+	{
+		std::cout << "Give filepath of HDR environment map (- for the default sky): ";
+		std::string environmentPath;
+		std::cin >> environmentPath;
+		EnvironmentLoadStats environmentStats;
+		if (environmentPath != "-") {
+			if (LoadEnvironmentMap(environmentPath, 1.0f, environment, &environmentStats))
+				std::cout << FormatEnvironmentLoadStats(environmentStats);
+			else
+				std::cout << "Failed to load " << environmentPath << ", using the default sky\n";
+		}
 	}
 
 	// Create 3 SSBO for models[], BVHNode[] and Triangle[]
-	SSBO modelBO(1, GL_DYNAMIC_COPY_ARB, sizeof(Model) * modelsBuffer.size(), modelsBuffer.data());
+	// Models change at runtime (transforms), so they are streamed through a persistently mapped ring
+	StreamingSSBO modelBO(1, sizeof(Model) * modelsBuffer.size(), modelsBuffer.data());
 	SSBO bvhBO(2, GL_DYNAMIC_COPY_ARB, sizeof(BVHNode) * BVHBuffer.size(), BVHBuffer.data());
 	SSBO triBO(3, GL_DYNAMIC_COPY_ARB, sizeof(Triangle) * TrianglesBuffer.size(), TrianglesBuffer.data());
+	// Material table shared by all models, indexed by Triangle::materialIndex
+	SSBO materialBO(9, GL_DYNAMIC_COPY_ARB, sizeof(RayTracingMaterial) * MaterialsBuffer.size(), MaterialsBuffer.data());
+	// Mip levels & texels of the materials' textures, at least one element long like the primitive buffers below
+	SSBO textureMipBO(10, GL_DYNAMIC_COPY_ARB, sizeof(TextureMip) * std::max<size_t>(TextureMipsBuffer.size(), 1), TextureMipsBuffer.empty() ? nullptr : TextureMipsBuffer.data());
+	SSBO textureTexelBO(11, GL_DYNAMIC_COPY_ARB, sizeof(uint32_t) * std::max<size_t>(TextureTexelsBuffer.size(), 1), TextureTexelsBuffer.empty() ? nullptr : TextureTexelsBuffer.data());
+	// Environment map radiance & row CDFs, then the CDF over the rows. Also at least one element long, uEnvironmentWidth says if it's there
+	SSBO environmentTexelBO(12, GL_DYNAMIC_COPY_ARB, sizeof(glm::vec4) * std::max<size_t>(environment.texels.size(), 1), environment.texels.empty() ? nullptr : environment.texels.data());
+	SSBO environmentMarginalBO(13, GL_DYNAMIC_COPY_ARB, sizeof(float) * std::max<size_t>(environment.marginalCdf.size(), 1), environment.marginalCdf.empty() ? nullptr : environment.marginalCdf.data());
+	// Emissive triangles for light sampling, at least one element long too, uLightCount says how many there are
+	SSBO lightBO(14, GL_DYNAMIC_COPY_ARB, sizeof(Light) * std::max<size_t>(LightsBuffer.size(), 1), LightsBuffer.empty() ? nullptr : LightsBuffer.data());
+	// Precomputed intersection data read by the leaf tests (PRECOMPUTED_TRIANGLES), parallel to triBO
+	SSBO triRecordBO(8, GL_DYNAMIC_COPY_ARB, sizeof(TriangleRecord) * std::max<size_t>(TriangleRecordsBuffer.size(), 1), TriangleRecordsBuffer.empty() ? nullptr : TriangleRecordsBuffer.data());
+
+	// Analytic primitives, add them here (AddPlane, AddSphere, AddDisk) before the BVH is built
+	BuildPrimitiveBVH();
+
+	// Kept at least one element long so the bindings are valid without primitives, the shader reads the counts from uniforms
+	SSBO primitiveBO(5, GL_DYNAMIC_COPY_ARB, sizeof(Primitive) * std::max<size_t>(PrimitivesBuffer.size(), 1), PrimitivesBuffer.empty() ? nullptr : PrimitivesBuffer.data());
+	SSBO primitiveBvhBO(6, GL_DYNAMIC_COPY_ARB, sizeof(BVHNode) * std::max<size_t>(PrimitiveBVHBuffer.size(), 1), PrimitiveBVHBuffer.empty() ? nullptr : PrimitiveBVHBuffer.data());
 	
 	// Binds SSBOs to compute shader
 	//modelBO.BindBase();
@@ -160,14 +283,60 @@ int main(void) {
 	// Frame variables
 	int frame = 0;
 
+	// Progressive accumulation, frames summed since the last camera/scene change
+	int accumFrame = 0;
+
+	// Adaptive sampling (toggled with A), rendering stops once the noise target is met
+	// The counters are read back a frame or two late from a ring of buffers, so the check never stalls the gpu
+	AdaptiveStats adaptiveStats = {};
+	ReadbackSSBO adaptiveStatsBO(4, sizeof(AdaptiveStats));
+	uint64_t gpuTotalSamples = 0;
+	bool gpuConverged = false;
+
+	// Primary hit cache (toggled with P), primaryCacheSamples hits per pixel. Must be resized with the window or sample count
+	auto primaryHitCacheSize = [&]() {
+		return (GLsizeiptr)sizeof(PrimaryHit) * std::max<GLsizeiptr>((GLsizeiptr)width * height * renderSettings.primaryCacheSamples, 1);
+	};
+	SSBO primaryHitBO(7, GL_DYNAMIC_COPY_ARB, primaryHitCacheSize(), nullptr);
+
+	// CPU render path, toggled with C. Traces 1 spp per frame & relies on accumulation to converge
+	CPURayTracer cpuTracer;
+	cpuTracer.settings = renderSettings;
+	cpuTracer.settings.raysPerPixel = 1;
+	cpuTracer.SetScene(modelsBuffer, BVHBuffer, TrianglesBuffer, MaterialsBuffer, &TriangleRecordsBuffer);
+	cpuTracer.SetTextures(TextureMipsBuffer, TextureTexelsBuffer);
+	cpuTracer.SetLights(LightsBuffer);
+	cpuTracer.SetEnvironment(&environment);
+	cpuTracer.SetPrimitives(PrimitivesBuffer, PrimitiveBVHBuffer, primitivePlaneCount);
+	cpuTracer.Resize(width, height);
+	std::vector<glm::vec4> cpuImage;
+	bool useCPUTracer = false;
+
+	// CPU denoiser (toggled with D), reruns on the accumulated image whenever new samples arrive
+	Denoiser denoiser;
+	bool useDenoiser = false;
+	bool denoiseDirty = false;
+	std::vector<glm::vec4> colorReadback, albedoDepthReadback, normalReadback, denoisedImage;
+
+	// Throws away every accumulated sample, call when camera, scene or settings change
+	auto resetAccumulation = [&]() {
+		accumFrame = 0;
+		gpuTotalSamples = 0;
+		gpuConverged = false;
+		adaptiveStatsBO.Discard();
+		cpuTracer.ResetAccumulation();
+	};
+
 	bool running = true;
 	while (running) {
 		// Update Frame count
 		frame++;
+		profiler.BeginFrame();
 
 		// Handle events
 		SDL_Event event;
 		while (SDL_PollEvent(&event)) {
+			ImGui_ImplSDL3_ProcessEvent(&event);
 			if (event.type == SDL_EVENT_QUIT) {
 				running = false;
 			}
@@ -182,9 +351,85 @@ int main(void) {
 					glViewport(0, 0, newWidth, newHeight);
 					width = newWidth;
 					height = newHeight;
+
+					// Output size changed, old samples no longer line up
+					allocateImageTexture(texture, width, height);
+					allocateImageTexture(accumTexture, width, height);
+					allocateImageTexture(varianceTexture, width, height);
+					allocateImageTexture(albedoDepthTexture, width, height);
+					allocateImageTexture(normalTexture, width, height);
+#ifdef TRAVERSAL_STATS
+					allocateImageTexture(traversalCostTexture, width, height);
+#endif
+					primaryHitBO.SetData(primaryHitCacheSize(), nullptr);
+					cpuTracer.Resize(width, height);
+					resetAccumulation();
 					break;
 				}
-				break;
+				case SDL_EVENT_KEY_DOWN:
+					if (event.key.key == SDLK_C) {
+						useCPUTracer = !useCPUTracer;
+						resetAccumulation();
+					}
+					else if (event.key.key == SDLK_A) {
+						renderSettings.adaptiveSampling = !renderSettings.adaptiveSampling;
+						cpuTracer.settings.adaptiveSampling = renderSettings.adaptiveSampling;
+						resetAccumulation();
+					}
+					else if (event.key.key == SDLK_D) {
+						// Restart so the raw image is rewritten when turning it off
+						useDenoiser = !useDenoiser;
+						denoiseDirty = useDenoiser;
+						resetAccumulation();
+					}
+					else if (event.key.key == SDLK_L) {
+						renderSettings.samplerType = renderSettings.samplerType == SamplerType::Sobol ? SamplerType::Independent : SamplerType::Sobol;
+						cpuTracer.settings.samplerType = renderSettings.samplerType;
+						resetAccumulation();
+					}
+					else if (event.key.key == SDLK_S) {
+						renderSettings.sunSampling = !renderSettings.sunSampling;
+						cpuTracer.settings.sunSampling = renderSettings.sunSampling;
+						resetAccumulation();
+					}
+					else if (event.key.key == SDLK_E) {
+						renderSettings.lightSampling = !renderSettings.lightSampling;
+						cpuTracer.settings.lightSampling = renderSettings.lightSampling;
+						resetAccumulation();
+					}
+					else if (event.key.key == SDLK_P) {
+						renderSettings.primaryCacheSamples = renderSettings.primaryCacheSamples > 0 ? 0 : 8;
+						cpuTracer.settings.primaryCacheSamples = renderSettings.primaryCacheSamples;
+						primaryHitBO.SetData(primaryHitCacheSize(), nullptr);
+						resetAccumulation();
+					}
+					else if (event.key.key == SDLK_F1) {
+						showStats = !showStats;
+					}
+#ifdef TRAVERSAL_STATS
+					else if (event.key.key == SDLK_H) {
+						// Summary of the traversal cost so far & a heatmap of the nodes visited per ray
+						std::vector<glm::vec4> traversalCost, heatmap;
+						if (useCPUTracer) {
+							cpuTracer.ResolveTraversalCost(traversalCost);
+						}
+						else {
+							glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+							readImageTexture(traversalCostTexture, width, height, traversalCost);
+						}
+						std::cout << FormatTraversalCostSummary(traversalCost);
+						TraversalCostHeatmap(traversalCost, TraversalMetric::Nodes, 0.0f, heatmap);
+						if (WritePNG("traversal_cost.png", width, height, heatmap))
+							std::cout << "Wrote traversal_cost.png\n";
+					}
+#endif
+					else if (event.key.key == SDLK_R && !modelsBuffer.empty()) {
+						// Spin the first model, only its two matrices are uploaded
+						SetModelTransform(0, glm::rotate(modelsBuffer[0].localToWorldMatrix, glm::radians(15.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+						modelBO.Update(offsetof(Model, worldToLocalMatrix), 2 * sizeof(glm::mat4), &modelsBuffer[0].worldToLocalMatrix);
+						resetAccumulation();
+					}
+					break;
 			}
 			// Handle other events as needed
 		}
@@ -195,29 +440,131 @@ int main(void) {
 		// Calculate deltaTime (time elapsed between frames)
 		deltaT = (double)(NOW - LAST) / SDL_GetPerformanceFrequency();
 		timeElapsed += deltaT;
+		if (frame > 1)
+			profiler.RecordCpu(ProfilePhase::CpuFrame, deltaT * 1000.0);
 		
 
 		glClearColor(1.0, 0.3, 0.3, 1.0);
 		glClear(GL_COLOR_BUFFER_BIT);
 		
-		// Update the compute shader uniforms
-		computeShader.Activate();
-		computeShader.SetUniform2fv("uResolution", glm::vec2(width, height));
-		computeShader.SetUniform1f("uTime", (float)timeElapsed);
-		computeShader.SetUniform1i("uFrame", frame);
-
-		// Bind the output texture image & activate it
-		glBindImageTexture(0, texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
-		glActiveTexture(GL_TEXTURE0);
+		// Adaptive sampling counters of earlier gpu frames that are done, only waits when every buffer of the ring is in flight
+		while (!useCPUTracer && renderSettings.adaptiveSampling && adaptiveStatsBO.Read(&adaptiveStats, adaptiveStatsBO.IsFull())) {
+			gpuTotalSamples += (uint64_t)adaptiveStats.tracedPixels * renderSettings.raysPerPixel;
+			double meanRelativeError = adaptiveStats.RelativeErrorSum() / 1000.0 / ((double)width * height);
+			gpuConverged = adaptiveStats.activePixels == 0 || meanRelativeError <= renderSettings.noiseTarget;
+		}
+
+		int samplesPerPixel = 0;
+		bool newSamples = false;
+		if (useCPUTracer) {
+			// Trace on the CPU & upload the accumulated average into the output texture
+			if (!cpuTracer.IsConverged()) {
+				CpuProfileScope traceScope(profiler, ProfilePhase::CpuTrace);
+				cpuTracer.RenderFrame();
+				newSamples = true;
+			}
+			samplesPerPixel = cpuTracer.GetEffectiveSamplesPerPixel();
+
+			if (newSamples && !useDenoiser) {
+				cpuTracer.ResolveImage(cpuImage);
+				glBindTexture(GL_TEXTURE_2D, texture);
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, cpuImage.data());
+			}
+		}
+		else if (!gpuConverged) {
+			// Update the compute shader uniforms
+			computeShader.Activate();
+			computeShader.SetUniform2fv("uResolution", glm::vec2(width, height));
+			computeShader.SetUniform1f("uTime", (float)timeElapsed);
+			computeShader.SetUniform1i("uFrame", frame);
+			computeShader.SetUniform1i("uAccumFrame", accumFrame);
+			computeShader.SetUniform1i("uAdaptiveSampling", renderSettings.adaptiveSampling);
+			computeShader.SetUniform1f("uAdaptiveThreshold", renderSettings.adaptiveThreshold);
+			computeShader.SetUniform1i("uAdaptiveMinSamples", renderSettings.adaptiveMinSamples);
+			computeShader.SetUniform1i("uSunSampling", renderSettings.sunSampling);
+			computeShader.SetUniform1i("uLightSampling", renderSettings.lightSampling);
+			computeShader.SetUniform1i("uLightCount", (int)LightsBuffer.size());
+			computeShader.SetUniform1i("uEnvironmentWidth", environment.width);
+			computeShader.SetUniform1i("uEnvironmentHeight", environment.height);
+			computeShader.SetUniform1i("uSamplerType", (int)renderSettings.samplerType);
+			computeShader.SetUniform1i("uPrimitiveCount", (int)PrimitivesBuffer.size());
+			computeShader.SetUniform1i("uPlaneCount", primitivePlaneCount);
+			computeShader.SetUniform1i("uPrimaryCacheSamples", renderSettings.primaryCacheSamples);
+
+			// Bind the output, accumulation & variance texture images
+			glBindImageTexture(0, texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+			glBindImageTexture(1, accumTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+			glBindImageTexture(2, varianceTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+			glBindImageTexture(3, albedoDepthTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+			glBindImageTexture(4, normalTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+#ifdef TRAVERSAL_STATS
+			glBindImageTexture(5, traversalCostTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+#endif
+			glActiveTexture(GL_TEXTURE0);
+
+			// Clear this frame's counters, without adaptive sampling the shader doesn't touch them
+			if (renderSettings.adaptiveSampling)
+				adaptiveStatsBO.Begin();
+
+			// Latest model data, then fence the region so it isn't rewritten while this dispatch reads it
+			modelBO.Advance();
+
+			// Dispatch Compute shader to run
+			profiler.BeginGpu(ProfilePhase::GpuDispatch);
+			if (computeTileSize > 0)
+				glDispatchCompute((width + computeTileSize - 1) / computeTileSize, (height + computeTileSize - 1) / computeTileSize, 1);
+			else
+				glDispatchCompute(width, height, 1);
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+			profiler.EndGpu();
+			modelBO.Fence();
+
+			accumFrame++;
+
+			// Every pixel traced, nothing to read back
+			if (renderSettings.adaptiveSampling)
+				adaptiveStatsBO.End();
+			else
+				gpuTotalSamples += (uint64_t)width * height * renderSettings.raysPerPixel;
+			newSamples = true;
+		}
+
+		// Denoise on the CPU & replace the output texture
+		if (useDenoiser && (newSamples || denoiseDirty)) {
+			CpuProfileScope denoiseScope(profiler, ProfilePhase::CpuDenoise);
+			if (useCPUTracer) {
+				cpuTracer.ResolveImage(colorReadback);
+				cpuTracer.ResolveAuxiliary(albedoDepthReadback, normalReadback);
+			}
+			else {
+				// GPU images hold running sums, divide by the sample count in accum.a
+				glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+				readImageTexture(accumTexture, width, height, colorReadback);
+				readImageTexture(albedoDepthTexture, width, height, albedoDepthReadback);
+				readImageTexture(normalTexture, width, height, normalReadback);
+				for (size_t i = 0; i < colorReadback.size(); ++i) {
+					float invCount = colorReadback[i].a > 0 ? 1.0f / colorReadback[i].a : 0.0f;
+					colorReadback[i] = glm::vec4(glm::vec3(colorReadback[i]) * invCount, colorReadback[i].a);
+					albedoDepthReadback[i] *= invCount;
+					normalReadback[i] *= invCount;
+				}
+			}
+
+			denoiser.Denoise(width, height, colorReadback, albedoDepthReadback, normalReadback, denoisedImage);
+
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, denoisedImage.data());
+			denoiseDirty = false;
+		}
 
-		// Dispatch Compute shader to run
-		glDispatchCompute(width, height, 1);
-		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		if (!useCPUTracer)
+			samplesPerPixel = (int)(gpuTotalSamples / ((uint64_t)width * height));
 
 		// Read data back into cpu buffer
 		glBindTexture(GL_TEXTURE_2D, texture);
 
 		// Draw full screen quad
+		profiler.BeginGpu(ProfilePhase::GpuBlit);
 		shader.Activate();
 		VAO1.Bind();
 
@@ -229,15 +576,60 @@ int main(void) {
 		// Draw elements (EBO must be bound, last param is offset)
 		glDrawElements(GL_TRIANGLES, quadIndices.size(), GL_UNSIGNED_INT, 0);
 		VAO1.Unbind();
-		
-		// Print fps
-		std::cout << "Avg FPS: " << floor(frame / timeElapsed) << std::endl;
-		std::cout << "Current FPS: " << floor(1.0f / deltaT) << std::endl;
+
+		profiler.Collect();
+
+		// Stats overlay
+		ImGui_ImplOpenGL3_NewFrame();
+		ImGui_ImplSDL3_NewFrame();
+		ImGui::NewFrame();
+		if (showStats) {
+			ImGui::SetNextWindowPos(ImVec2(10.0f, 10.0f));
+			ImGui::SetNextWindowBgAlpha(0.6f);
+			ImGui::Begin("Stats", nullptr, ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoInputs);
+			ImGui::Text("%.0f fps (avg %.0f), %d spp", 1.0 / deltaT, frame / timeElapsed, samplesPerPixel);
+			if (ImGui::BeginTable("phases", 5)) {
+				ImGui::TableSetupColumn("ms");
+				ImGui::TableSetupColumn("p50");
+				ImGui::TableSetupColumn("p95");
+				ImGui::TableSetupColumn("p99");
+				ImGui::TableSetupColumn("max");
+				ImGui::TableHeadersRow();
+				for (int i = 0; i < (int)ProfilePhase::Count; ++i) {
+					ProfilePhaseStats stats = profiler.GetStats((ProfilePhase)i);
+					if (stats.count == 0)
+						continue;
+					ImGui::TableNextRow();
+					ImGui::TableNextColumn(); ImGui::TextUnformatted(GetProfilePhaseName((ProfilePhase)i));
+					ImGui::TableNextColumn(); ImGui::Text("%.2f", stats.p50);
+					ImGui::TableNextColumn(); ImGui::Text("%.2f", stats.p95);
+					ImGui::TableNextColumn(); ImGui::Text("%.2f", stats.p99);
+					ImGui::TableNextColumn(); ImGui::Text("%.2f", stats.max);
+				}
+				ImGui::EndTable();
+			}
+			ImGui::End();
+		}
+		ImGui::Render();
+		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+		profiler.EndGpu();
+
+		// Log the percentiles once per second, no flush in the render loop
+		if (timeElapsed - lastReportTime >= 1.0) {
+			lastReportTime = timeElapsed;
+			std::cout << samplesPerPixel << " spp | " << profiler.FormatReport() << '\n';
+		}
 		
 		// Swap frame buffers
+		profiler.BeginGpu(ProfilePhase::GpuSwap);
 		SDL_GL_SwapWindow(pWindow);
+		profiler.EndGpu();
 	}
 
+	ImGui_ImplOpenGL3_Shutdown();
+	ImGui_ImplSDL3_Shutdown();
+	ImGui::DestroyContext();
+
 	//there is no need to call the clear function for the libraries since the os will do that for us.
 	//by calling this functions we are just wasting time.
 	shader.Delete();
@@ -1,5 +1,12 @@
 #include "shader.h"
 
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <chrono>
+
+std::string Shader::BinaryCacheDirectory = "shader_cache";
+
 
 // Reads a text file and outputs a string with everything in the text file
 std::string get_file_contents(const char* filename)
@@ -36,7 +43,7 @@ Shader::Shader(const char* vertexFile, const char* fragmentFile)
 }
 
 // Constructor that builds the Compute Shader Program
-Shader::Shader(const char* shaderFile, GLenum type)
+Shader::Shader(const char* shaderFile, GLenum type, const std::vector<ShaderDefine>& defines)
 {
 	shaderType = type;
 
@@ -47,6 +54,12 @@ Shader::Shader(const char* shaderFile, GLenum type)
 
 	// Parse include directive of each shader
 	parsePreprocessorDirectives(code, get_directory_from_path(shaderFile));
+	injectDefines(code, defines);
+
+	// A cached binary of the same source on the same driver skips compiling & linking entirely
+	std::string cachePath = binaryCachePath(shaderFile, code);
+	if (loadProgramBinary(cachePath))
+		return;
 	
 	// Convert the shader source strings into character arrays
 	const char* sourceCode = code.c_str();
@@ -71,12 +84,15 @@ Shader::Shader(const char* shaderFile, GLenum type)
 	// Attach the Vertex and Fragment Shaders to the Shader Program
 	glAttachShader(ID, shaderT);
 	// Wrap-up/Link all the shaders together into the Shader Program
+	glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(ID);
 	// Checks if Shaders linked successfully
 	compileErrors(ID, "PROGRAM");
 
 	// Delete the now useless Vertex and Fragment Shader objects
 	glDeleteShader(shaderT);
+
+	saveProgramBinary(cachePath);
 }
 
 // Activates the Shader Program
@@ -276,3 +292,170 @@ void Shader::parsePreprocessorDirectives(std::string& source, const std::string&
 		i = lineEnd;
 	}
 }
+
+
+// #version must stay the first line, so the defines go right after it
+void Shader::injectDefines(std::string& source, const std::vector<ShaderDefine>& defines)
+{
+	if (defines.empty())
+		return;
+
+	std::string defineBlock;
+	for (const ShaderDefine& define : defines)
+		defineBlock += "#define " + define.name + " " + define.value + "\n";
+
+	size_t insertPos = 0;
+	if (source.compare(0, 8, "#version") == 0)
+	{
+		size_t versionEnd = source.find('\n');
+		if (versionEnd == std::string::npos)
+		{
+			source += '\n';
+			versionEnd = source.length() - 1;
+		}
+		insertPos = versionEnd + 1;
+	}
+	source.insert(insertPos, defineBlock);
+}
+
+// FNV-1a, the cache key & file name
+static uint64_t hashString(const std::string& text, uint64_t hash = 14695981039346656037ull)
+{
+	for (unsigned char c : text)
+	{
+		hash ^= c;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// Multiply & rotate with splitmix64's constants, unrelated to FNV-1a so a key collision almost never collides here too
+static uint64_t checkHashString(const std::string& text, uint64_t hash = 0x9e3779b97f4a7c15ull)
+{
+	for (unsigned char c : text)
+	{
+		hash = (hash ^ c) * 0xbf58476d1ce4e5b9ull;
+		hash = (hash << 27) | (hash >> 37);
+	}
+	return hash;
+}
+
+// Cache file header. The file name already holds the key, the length & the second hash are what tell a colliding
+// program (or a renamed or corrupt file) apart
+struct ProgramBinaryHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	uint64_t check;
+	uint64_t sourceLength;
+	uint32_t format;
+	uint32_t length;
+};
+
+static const uint32_t PROGRAM_BINARY_VERSION = 2;
+
+// Returns "" when the driver can't save binaries or the cache is disabled
+std::string Shader::binaryCachePath(const char* shaderFile, const std::string& source)
+{
+	GLint formatCount = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+	if (formatCount <= 0 || BinaryCacheDirectory.empty())
+		return "";
+
+	// Binaries are only valid for the driver that made them, a driver update changes the version string
+	binaryKey = hashString(source);
+	binaryCheck = checkHashString(source);
+	for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+	{
+		binaryKey = hashString((const char*)glGetString(name), binaryKey);
+		binaryCheck = checkHashString((const char*)glGetString(name), binaryCheck);
+	}
+	binarySourceLength = source.length();
+
+	char keyText[17];
+	snprintf(keyText, sizeof(keyText), "%016llx", (unsigned long long)binaryKey);
+	std::string name = std::filesystem::path(shaderFile).stem().string();
+	return (std::filesystem::path(BinaryCacheDirectory) / (name + "_" + keyText + ".bin")).string();
+}
+
+bool Shader::loadProgramBinary(const std::string& path)
+{
+	if (path.empty())
+		return false;
+
+	std::ifstream in(path, std::ios::binary);
+	if (!in.is_open())
+		return false;
+
+	ProgramBinaryHeader header;
+	in.read((char*)&header, sizeof(header));
+	if (!in || memcmp(header.magic, "CRTB", 4) != 0 || header.version != PROGRAM_BINARY_VERSION
+		|| header.key != binaryKey || header.check != binaryCheck || header.sourceLength != binarySourceLength)
+		return false;
+
+	std::vector<char> binary(header.length);
+	in.read(binary.data(), binary.size());
+	if (!in)
+		return false;
+
+	// The driver may still reject it (e.g. after an update with the same version string), then we compile as usual
+	glProgramBinary(ID, header.format, binary.data(), (GLsizei)binary.size());
+	GLint linked = GL_FALSE;
+	glGetProgramiv(ID, GL_LINK_STATUS, &linked);
+	if (linked == GL_TRUE)
+	{
+		std::cout << "Loaded cached program binary: " << path << "\n";
+		return true;
+	}
+	return false;
+}
+
+// Written to a temporary file & renamed, so a crash or a second instance never leaves a half written cache file
+void Shader::saveProgramBinary(const std::string& path)
+{
+	GLint linked = GL_FALSE;
+	glGetProgramiv(ID, GL_LINK_STATUS, &linked);
+	if (path.empty() || linked != GL_TRUE)
+		return;
+
+	GLint length = 0;
+	glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(ID, length, &length, &format, binary.data());
+
+	ProgramBinaryHeader header;
+	memcpy(header.magic, "CRTB", 4);
+	header.version = PROGRAM_BINARY_VERSION;
+	header.key = binaryKey;
+	header.check = binaryCheck;
+	header.sourceLength = binarySourceLength;
+	header.format = format;
+	header.length = (uint32_t)length;
+
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+
+	// Unique per writer, so two instances starting together don't write into the same temporary file
+	unsigned long long stamp = (unsigned long long)std::chrono::steady_clock::now().time_since_epoch().count();
+	std::string tempPath = path + ".tmp" + std::to_string(stamp ^ (uintptr_t)this);
+	{
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		out.write((const char*)&header, sizeof(header));
+		out.write(binary.data(), length);
+		if (!out)
+		{
+			out.close();
+			std::filesystem::remove(tempPath, error);
+			return;
+		}
+	}
+
+	std::filesystem::rename(tempPath, path, error);
+	if (error)
+		std::filesystem::remove(tempPath, error);
+}
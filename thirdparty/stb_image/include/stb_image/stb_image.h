@@ -337,6 +337,7 @@ RECENT REVISION HISTORY:
 //    very big.
 
 #include <memory>
+#include <cstring>
 
 inline void *STBIMAGE_CUSTOM_REALOC(void *p, size_t oldSize, size_t newsz)
 {
@@ -344,13 +345,13 @@ inline void *STBIMAGE_CUSTOM_REALOC(void *p, size_t oldSize, size_t newsz)
 
 	std::memcpy(newPtr, p, oldSize);
 
-	delete[] p;
+	delete[] (char*)p;
 	return newPtr;
 };
 
 #define STBI_MALLOC(sz)           new char[(sz)]
 #define STBI_REALLOC_SIZED(p, oldsz, newsz) STBIMAGE_CUSTOM_REALOC((p), (oldsz), (newsz))
-#define STBI_FREE(p)              delete[] (p)
+#define STBI_FREE(p)              delete[] (char*)(p)
 
 
 
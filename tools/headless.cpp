@@ -0,0 +1,482 @@
+// Headless batch renderer: loads models, renders with the CPU tracer & writes HDR + LDR images.
+// No window or OpenGL context needed, per phase timings are printed to stdout as JSON.
+//
+// Usage: rayTracerHeadless --model <file.obj> [options]
+//   --model <path>         model to load, can be repeated
+//   --width <n>            image width (default 512)
+//   --height <n>           image height (default 512)
+//   --spp <n>              samples per pixel (default 64)
+//   --bounces <n>          max bounces (default 3)
+//   --adaptive             stop early once the adaptive sampling noise target is met
+//   --denoise              run the a-trous denoiser before writing
+//   --no-sun-sampling      disable next event estimation toward the sun / environment map (for comparisons)
+//   --no-light-sampling    disable next event estimation toward emissive triangles (for comparisons)
+//   --environment <path>   light the scene with an equirectangular HDR image instead of the procedural sky & sun
+//   --environment-intensity <s>  scale the environment map's radiance (default 1)
+//   --sampler <pcg|sobol>  random numbers per path: independent PCG or Owen scrambled Sobol (default sobol)
+//   --no-sanitize          keep degenerate & duplicate triangles and broken normals as loaded
+//   --no-generate-normals  keep objl's flat normals for OBJ files without vn lines instead of generating smooth ones
+//   --crease-angle <deg>   faces meeting at a sharper angle keep a hard edge when generating normals (default 60)
+//   --stack-traversal      walk the triangle BVHs with the 32 entry stack instead of the stackless traversal
+//   --no-triangle-records  test the triangles directly instead of their precomputed intersection records
+//   --bvh-layout <name>    node order of the BVHs: build, depth-first, veb or treelet (default depth-first)
+//   --bvh-optimize <s>     spend up to s seconds per model improving the SAH of its BVH with treelet restructuring
+//   --layout-benchmark     render once per node layout first & report the time & simulated node cache misses per ray
+//                          of each (misses need a build with RAYTRACER_TRAVERSAL_STATS)
+//   --primary-cache <n>    cache the camera ray hits of n jittered samples per pixel & reuse them (default 0, off)
+//   --ground <y>           add a grey ground plane at height y
+//   --sphere <x,y,z,r[,e]> add a white sphere, e > 0 makes it emissive, can be repeated
+//   --camera <x,y,z>       camera position (default 0,0,0)
+//   --look-at <x,y,z>      point the camera looks at (default 0,0,1)
+//   --fov <degrees>        vertical field of view (default 90)
+//   --output <path>        output path without extension, writes <path>.pfm & <path>.png (default "render")
+//   --bvh-report           print the BVH quality (SAH, EPO, depth, leaf sizes) of every model & add it to the report
+//   --traversal-stats      also write the BVH traversal cost per ray (<path>_cost.pfm: nodes, box tests, triangle tests)
+//                          & a heatmap of the nodes (<path>_cost.png), needs a build with RAYTRACER_TRAVERSAL_STATS
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+
+#include "ModelLoaderBVHBuilder.h"
+#include "CPURayTracer.h"
+#include "Denoiser.h"
+#include "ImageIO.h"
+#include "TraversalStats.h"
+#include "BVHAnalysis.h"
+#include "BVHLayout.h"
+
+struct HeadlessOptions {
+	std::vector<std::string> modelPaths;
+	std::vector<glm::vec4> spheres;           // center & radius
+	std::vector<float> sphereEmission;
+	bool hasGround = false;
+	float groundHeight = 0.0f;
+	int width = 512;
+	int height = 512;
+	int spp = 64;
+	int bounces = 3;
+	bool adaptive = false;
+	bool denoise = false;
+	bool sunSampling = true;
+	bool lightSampling = true;
+	std::string environmentPath;
+	float environmentIntensity = 1.0f;
+	bool traversalStats = false;
+	bool bvhReport = false;
+	bool stacklessTraversal = true;
+	bool triangleRecords = true;
+	bool sanitize = true;
+	bool generateNormals = true;
+	float creaseAngle = normalCreaseAngle;
+	BVHLayout layout = bvhLayout;
+	double bvhOptimizeSeconds = 0.0;
+	bool layoutBenchmark = false;
+	SamplerType samplerType = SamplerType::Sobol;
+	int primaryCacheSamples = 0;
+	glm::vec3 cameraPos = glm::vec3(0.0f);
+	glm::vec3 lookAt = glm::vec3(0.0f, 0.0f, 1.0f);
+	float fov = 90.0f;
+	std::string output = "render";
+};
+
+static void printUsage() {
+	std::cerr << "Usage: rayTracerHeadless --model <file.obj> [--width n] [--height n] [--spp n] [--bounces n]\n"
+		"                         [--adaptive] [--denoise] [--no-sun-sampling] [--no-light-sampling] [--sampler pcg|sobol] [--primary-cache n]\n"
+		"                         [--environment file.hdr] [--environment-intensity s]\n"
+		"                         [--ground y] [--sphere x,y,z,r[,e]] [--camera x,y,z] [--look-at x,y,z] [--fov deg] [--output path]\n"
+		"                         [--no-sanitize] [--no-generate-normals] [--crease-angle deg]\n"
+		"                         [--stack-traversal] [--no-triangle-records]\n"
+		"                         [--bvh-layout build|depth-first|veb|treelet] [--bvh-optimize s] [--layout-benchmark]\n"
+		"                         [--bvh-report] [--traversal-stats]\n";
+}
+
+static bool parseVec3(const char* text, glm::vec3& out) {
+	return sscanf(text, "%f,%f,%f", &out.x, &out.y, &out.z) == 3;
+}
+
+// Returns false on bad arguments
+static bool parseArguments(int argc, char** argv, HeadlessOptions& options) {
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (arg == "--adaptive") {
+			options.adaptive = true;
+		}
+		else if (arg == "--denoise") {
+			options.denoise = true;
+		}
+		else if (arg == "--no-sun-sampling") {
+			options.sunSampling = false;
+		}
+		else if (arg == "--no-light-sampling") {
+			options.lightSampling = false;
+		}
+		else if (arg == "--stack-traversal") {
+			options.stacklessTraversal = false;
+		}
+		else if (arg == "--no-triangle-records") {
+			options.triangleRecords = false;
+		}
+		else if (arg == "--no-sanitize") {
+			options.sanitize = false;
+		}
+		else if (arg == "--no-generate-normals") {
+			options.generateNormals = false;
+		}
+		else if (arg == "--layout-benchmark") {
+			options.layoutBenchmark = true;
+		}
+		else if (arg == "--bvh-report") {
+			options.bvhReport = true;
+		}
+		else if (arg == "--traversal-stats") {
+			options.traversalStats = true;
+		}
+		else if (!hasValue) {
+			std::cerr << "Missing value for " << arg << "\n";
+			return false;
+		}
+		else if (arg == "--model") {
+			options.modelPaths.push_back(argv[++i]);
+		}
+		else if (arg == "--width") {
+			options.width = atoi(argv[++i]);
+		}
+		else if (arg == "--height") {
+			options.height = atoi(argv[++i]);
+		}
+		else if (arg == "--spp") {
+			options.spp = atoi(argv[++i]);
+		}
+		else if (arg == "--bounces") {
+			options.bounces = atoi(argv[++i]);
+		}
+		else if (arg == "--fov") {
+			options.fov = (float)atof(argv[++i]);
+		}
+		else if (arg == "--sampler") {
+			std::string type = argv[++i];
+			if (type == "pcg")
+				options.samplerType = SamplerType::Independent;
+			else if (type == "sobol")
+				options.samplerType = SamplerType::Sobol;
+			else
+				return false;
+		}
+		else if (arg == "--bvh-layout") {
+			if (!ParseBVHLayout(argv[++i], options.layout))
+				return false;
+		}
+		else if (arg == "--bvh-optimize") {
+			options.bvhOptimizeSeconds = atof(argv[++i]);
+		}
+		else if (arg == "--environment") {
+			options.environmentPath = argv[++i];
+		}
+		else if (arg == "--environment-intensity") {
+			options.environmentIntensity = (float)atof(argv[++i]);
+		}
+		else if (arg == "--crease-angle") {
+			options.creaseAngle = (float)atof(argv[++i]);
+		}
+		else if (arg == "--primary-cache") {
+			options.primaryCacheSamples = atoi(argv[++i]);
+		}
+		else if (arg == "--output") {
+			options.output = argv[++i];
+		}
+		else if (arg == "--ground") {
+			options.hasGround = true;
+			options.groundHeight = (float)atof(argv[++i]);
+		}
+		else if (arg == "--sphere") {
+			glm::vec4 sphere;
+			float emission = 0.0f;
+			if (sscanf(argv[++i], "%f,%f,%f,%f,%f", &sphere.x, &sphere.y, &sphere.z, &sphere.w, &emission) < 4)
+				return false;
+			options.spheres.push_back(sphere);
+			options.sphereEmission.push_back(emission);
+		}
+		else if (arg == "--camera") {
+			if (!parseVec3(argv[++i], options.cameraPos))
+				return false;
+		}
+		else if (arg == "--look-at") {
+			if (!parseVec3(argv[++i], options.lookAt))
+				return false;
+		}
+		else {
+			std::cerr << "Unknown argument " << arg << "\n";
+			return false;
+		}
+	}
+
+	return !options.modelPaths.empty() && options.width > 0 && options.height > 0 && options.spp > 0 && options.bounces >= 0
+		&& options.primaryCacheSamples >= 0 && options.bvhOptimizeSeconds >= 0;
+}
+
+// Camera looks down its local +z, like the fixed camera in compute.glsl
+static glm::mat4 makeCameraMatrix(const glm::vec3& pos, const glm::vec3& target) {
+	glm::vec3 forward = glm::normalize(target - pos);
+	glm::vec3 worldUp = std::abs(forward.y) > 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	glm::vec3 right = glm::normalize(glm::cross(worldUp, forward));
+	glm::vec3 up = glm::cross(forward, right);
+
+	glm::mat4 mat(1.0f);
+	mat[0] = glm::vec4(right, 0.0f);
+	mat[1] = glm::vec4(up, 0.0f);
+	mat[2] = glm::vec4(forward, 0.0f);
+	mat[3] = glm::vec4(pos, 1.0f);
+	return mat;
+}
+
+// Paths may contain backslashes on Windows
+static std::string jsonEscape(const std::string& text) {
+	std::string out;
+	for (char c : text) {
+		if (c == '"' || c == '\\')
+			out += '\\';
+		out += c;
+	}
+	return out;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Without adaptive sampling everything is traced in one pass, else in small passes so it can stop early.
+// The last pass only takes what is left of the budget
+static void renderImage(CPURayTracer& tracer, const HeadlessOptions& options) {
+	int passSize = options.adaptive ? std::min(options.spp, 16) : options.spp;
+	for (int done = 0; done < options.spp && !tracer.IsConverged(); done += tracer.settings.raysPerPixel) {
+		tracer.settings.raysPerPixel = std::min(passSize, options.spp - done);
+		tracer.RenderFrame();
+	}
+}
+
+// Renders the image once per node layout, leaves the BVHs in options.layout. Results go to stderr & the report.
+// Every layout traces the same paths (also with the independent sampler), so only the layout changes the timings
+static std::string benchmarkLayouts(CPURayTracer& tracer, const HeadlessOptions& options) {
+	std::string json = ",\"layouts\":[";
+	for (int layout = 0; layout < BVH_LAYOUT_COUNT; ++layout) {
+		for (const Model& model : modelsBuffer)
+			ReorderBVH(BVHBuffer, model.nodeOffset, (BVHLayout)layout);
+		tracer.ResetAccumulation();
+		tracer.ResetFrameSeed();
+
+		auto start = std::chrono::steady_clock::now();
+		renderImage(tracer, options);
+		double seconds = secondsSince(start);
+
+		// Per ray over the whole image
+		std::vector<glm::vec4> cost;
+		std::vector<float> misses;
+		char stats[128] = "";
+		char statsJson[128] = "";
+		if (tracer.ResolveTraversalCost(cost) && tracer.ResolveNodeCacheMisses(misses)) {
+			double rays = 0.0, nodes = 0.0, missSum = 0.0;
+			for (size_t i = 0; i < cost.size(); ++i) {
+				rays += cost[i].w;
+				nodes += cost[i].x;
+				missSum += misses[i];
+			}
+			rays = std::max(rays, 1.0);
+			snprintf(stats, sizeof(stats), " | %.2f nodes, %.3f node cache misses per ray", nodes / rays, missSum / rays);
+			snprintf(statsJson, sizeof(statsJson), ",\"nodes_per_ray\":%.4f,\"node_misses_per_ray\":%.4f", nodes / rays, missSum / rays);
+		}
+
+		fprintf(stderr, "layout %-12s %.3f s%s\n", GetBVHLayoutName((BVHLayout)layout), seconds, stats);
+		char text[256];
+		snprintf(text, sizeof(text), "%s{\"layout\":\"%s\",\"render_seconds\":%.6f%s}",
+			layout > 0 ? "," : "", GetBVHLayoutName((BVHLayout)layout), seconds, statsJson);
+		json += text;
+	}
+	json += "]";
+
+	for (const Model& model : modelsBuffer)
+		ReorderBVH(BVHBuffer, model.nodeOffset, options.layout);
+	tracer.ResetAccumulation();
+	tracer.ResetFrameSeed();
+	return json;
+}
+
+int main(int argc, char** argv) {
+	HeadlessOptions options;
+	if (!parseArguments(argc, argv, options)) {
+		printUsage();
+		return 1;
+	}
+
+	// The OBJ loader reports progress on std::cout, keep stdout for the JSON report
+	std::streambuf* stdoutBuffer = std::cout.rdbuf(std::cerr.rdbuf());
+
+	ModelLoadTimings loadTimings;
+	bvhLayout = options.layout;
+	bvhOptimizeSeconds = options.bvhOptimizeSeconds;
+	buildTriangleRecords = options.triangleRecords;
+	sanitizeMeshes = options.sanitize;
+	generateMissingNormals = options.generateNormals;
+	normalCreaseAngle = options.creaseAngle;
+	for (const std::string& path : options.modelPaths) {
+		if (LoadModel(path.c_str(), path, &loadTimings) < 0) {
+			std::cout.rdbuf(stdoutBuffer);
+			std::cerr << "Failed to load model: " << path << "\n";
+			return 1;
+		}
+	}
+
+	std::cout.rdbuf(stdoutBuffer);
+
+	// BVH quality per model, text on stderr & the numbers in the report
+	std::string bvhJson;
+	if (options.bvhReport) {
+		bvhJson = ",\"bvh\":[";
+		for (size_t i = 0; i < modelsBuffer.size(); ++i) {
+			BVHQualityReport report = AnalyzeBVH(BVHBuffer, modelsBuffer[i].nodeOffset, TrianglesBuffer, modelsBuffer[i].triOffset);
+			std::cerr << options.modelPaths[i] << "\n" << FormatBVHQualityReport(report);
+
+			char text[512];
+			snprintf(text, sizeof(text), "%s{\"model\":\"%s\",\"nodes\":%d,\"leaves\":%d,\"sah\":%.4f,\"epo\":%.4f,"
+				"\"max_depth\":%d,\"avg_depth\":%.3f,\"max_leaf_triangles\":%d,\"avg_leaf_triangles\":%.3f,\"stack_overflow\":%s,\"leaf_histogram\":[",
+				i > 0 ? "," : "", jsonEscape(options.modelPaths[i]).c_str(), report.nodeCount, report.leafCount, report.sahCost, report.epo,
+				report.maxDepth, report.averageLeafDepth, report.maxLeafTriangles, report.averageLeafTriangles, report.exceedsStack ? "true" : "false");
+			bvhJson += text;
+			for (size_t bin = 0; bin < report.leafSizeHistogram.size(); ++bin)
+				bvhJson += (bin > 0 ? "," : "") + std::to_string(report.leafSizeHistogram[bin]);
+			bvhJson += "]}";
+		}
+		bvhJson += "]";
+	}
+
+	if (options.hasGround)
+		AddPlane(glm::vec3(0.0f, options.groundHeight, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), makeMaterial(glm::vec3(0.5f)));
+	for (size_t i = 0; i < options.spheres.size(); ++i)
+		AddSphere(glm::vec3(options.spheres[i]), options.spheres[i].w, makeMaterial(glm::vec3(1.0f), options.sphereEmission[i]));
+	BuildPrimitiveBVH();
+
+	EnvironmentMap environment;
+	EnvironmentLoadStats environmentStats;
+	if (!options.environmentPath.empty()) {
+		if (!LoadEnvironmentMap(options.environmentPath, options.environmentIntensity, environment, &environmentStats)) {
+			std::cerr << "Failed to load environment map: " << options.environmentPath << "\n";
+			return 1;
+		}
+		std::cerr << FormatEnvironmentLoadStats(environmentStats);
+	}
+
+	CPURayTracer tracer;
+	tracer.settings.maxBounces = options.bounces;
+	tracer.settings.adaptiveSampling = options.adaptive;
+	tracer.settings.sunSampling = options.sunSampling;
+	tracer.settings.lightSampling = options.lightSampling;
+	tracer.settings.samplerType = options.samplerType;
+	tracer.settings.primaryCacheSamples = options.primaryCacheSamples;
+	tracer.settings.stacklessTraversal = options.stacklessTraversal;
+	tracer.settings.precomputedTriangles = options.triangleRecords;
+	tracer.camLocalToWorldMatrix = makeCameraMatrix(options.cameraPos, options.lookAt);
+	float planeHeight = 2.0f * std::tan(glm::radians(options.fov) * 0.5f);
+	tracer.viewParams = glm::vec3(planeHeight * options.width / options.height, planeHeight, 1.0f);
+	tracer.SetScene(modelsBuffer, BVHBuffer, TrianglesBuffer, MaterialsBuffer, &TriangleRecordsBuffer);
+	tracer.SetTextures(TextureMipsBuffer, TextureTexelsBuffer);
+	tracer.SetPrimitives(PrimitivesBuffer, PrimitiveBVHBuffer, primitivePlaneCount);
+	tracer.SetLights(LightsBuffer);
+	tracer.SetEnvironment(&environment);
+	tracer.Resize(options.width, options.height);
+
+	std::string layoutJson;
+	if (options.layoutBenchmark)
+		layoutJson = benchmarkLayouts(tracer, options);
+
+	// Render
+	auto renderStart = std::chrono::steady_clock::now();
+	renderImage(tracer, options);
+
+	std::vector<glm::vec4> image;
+	tracer.ResolveImage(image);
+	double renderSeconds = secondsSince(renderStart);
+
+	// Denoise
+	double denoiseSeconds = 0.0;
+	if (options.denoise) {
+		auto denoiseStart = std::chrono::steady_clock::now();
+
+		std::vector<glm::vec4> albedoDepth, normal, denoised;
+		tracer.ResolveAuxiliary(albedoDepth, normal);
+
+		Denoiser denoiser;
+		denoiser.Denoise(options.width, options.height, image, albedoDepth, normal, denoised);
+		image.swap(denoised);
+
+		denoiseSeconds = secondsSince(denoiseStart);
+	}
+
+	// Write
+	auto writeStart = std::chrono::steady_clock::now();
+	std::string hdrPath = options.output + ".pfm";
+	std::string ldrPath = options.output + ".png";
+	bool written = WritePFM(hdrPath, options.width, options.height, image)
+		&& WritePNG(ldrPath, options.width, options.height, image);
+	double writeSeconds = secondsSince(writeStart);
+
+	if (!written) {
+		std::cerr << "Failed to write " << options.output << ".pfm/.png\n";
+		return 1;
+	}
+
+	// Traversal cost, the summary goes to stderr & into the report
+	std::string traversalJson;
+	if (options.traversalStats) {
+		std::vector<glm::vec4> cost;
+		if (!tracer.ResolveTraversalCost(cost)) {
+			std::cerr << "--traversal-stats needs a build with RAYTRACER_TRAVERSAL_STATS=ON\n";
+			return 1;
+		}
+
+		std::vector<glm::vec4> perRay(cost.size()), heatmap;
+		for (size_t i = 0; i < cost.size(); ++i)
+			perRay[i] = cost[i].w > 0 ? cost[i] / cost[i].w : glm::vec4(0.0f);
+		TraversalCostHeatmap(cost, TraversalMetric::Nodes, 0.0f, heatmap);
+		if (!WritePFM(options.output + "_cost.pfm", options.width, options.height, perRay)
+			|| !WritePNG(options.output + "_cost.png", options.width, options.height, heatmap)) {
+			std::cerr << "Failed to write " << options.output << "_cost.pfm/.png\n";
+			return 1;
+		}
+		std::cerr << FormatTraversalCostSummary(cost);
+
+		const char* keys[] = { "nodes", "box_tests", "triangle_tests" };
+		traversalJson = ",\"traversal\":{";
+		for (int metric = 0; metric < 3; ++metric) {
+			TraversalCostSummary summary = SummarizeTraversalCost(cost, (TraversalMetric)metric);
+			char text[256];
+			snprintf(text, sizeof(text), "%s\"%s\":{\"mean\":%.3f,\"p50\":%.3f,\"p99\":%.3f,\"max\":%.3f,\"bin_width\":%.3f,\"histogram\":[",
+				metric > 0 ? "," : "", keys[metric], summary.mean, summary.p50, summary.p99, summary.max, summary.binWidth);
+			traversalJson += text;
+			for (size_t bin = 0; bin < summary.histogram.size(); ++bin)
+				traversalJson += (bin > 0 ? "," : "") + std::to_string(summary.histogram[bin]);
+			traversalJson += "]}";
+		}
+		traversalJson += "}";
+	}
+
+	// Machine readable report, one line
+	printf("{\"width\":%d,\"height\":%d,\"spp\":%d,\"bounces\":%d,\"models\":%d,\"triangles\":%d,\"materials\":%d,\"textures\":%d,\"lights\":%d,\"primitives\":%d,\"bvh_nodes\":%d,"
+		"\"degenerate_triangles\":%d,\"duplicate_triangles\":%d,\"repaired_normals\":%d,"
+		"\"load_seconds\":%.6f,\"sanitize_seconds\":%.6f,\"normals_seconds\":%.6f,\"texture_seconds\":%.6f,\"environment_seconds\":%.6f,\"build_seconds\":%.6f,\"optimize_seconds\":%.6f,\"render_seconds\":%.6f,\"denoise_seconds\":%.6f,\"write_seconds\":%.6f,"
+		"\"bvh_layout\":\"%s\",\"hdr\":\"%s\",\"ldr\":\"%s\"%s%s%s}\n",
+		options.width, options.height, tracer.GetEffectiveSamplesPerPixel(), options.bounces,
+		(int)modelsBuffer.size(), (int)TrianglesBuffer.size(), (int)MaterialsBuffer.size(), loadTimings.textures, (int)LightsBuffer.size(), (int)PrimitivesBuffer.size(), (int)BVHBuffer.size(),
+		loadTimings.sanitize.degenerateTriangles, loadTimings.sanitize.duplicateTriangles, loadTimings.sanitize.repairedNormals,
+		loadTimings.parseSeconds, loadTimings.sanitize.seconds, loadTimings.normalSeconds, loadTimings.textureSeconds,
+		environmentStats.loadSeconds + environmentStats.cdfSeconds, loadTimings.buildSeconds, loadTimings.optimizeSeconds, renderSeconds, denoiseSeconds, writeSeconds,
+		GetBVHLayoutName(options.layout), jsonEscape(hdrPath).c_str(), jsonEscape(ldrPath).c_str(), bvhJson.c_str(), layoutJson.c_str(),
+		traversalJson.c_str());
+
+	return 0;
+}